@@ -0,0 +1,32 @@
+#!/bin/sh
+# Compares the time a client takes to pass cores to the daemon with the time
+# of processing them in-process.
+# Usage: daemon.sh [core] [proc directory] [runs]
+
+CORE=${1:-../t/inputdir/core}
+PROC=${2:-../t/inputdir/proc}
+RUNS=${3:-10}
+DIR=$(mktemp -d)
+
+run() {
+	start=$(date +%s%N)
+	for i in $(seq $RUNS); do
+		../crashinfo -oproc_path="$PROC" "$@" < "$CORE"
+	done
+	echo "$(( ($(date +%s%N) - start) / RUNS / 1000 )) us per core"
+}
+
+echo "In-process: $(run -ocore_output="$DIR/core-@Q" -ocore_exists=sequence \
+	-oinfo_output="$DIR/info-@Q" -oinfo_exists=sequence)"
+
+../crashinfo -D -odaemon_socket="$DIR/socket" -oproc_path="$PROC" \
+	-ocore_output="$DIR/daemon-core-@Q" -ocore_exists=sequence \
+	-oinfo_output="$DIR/daemon-info-@Q" -oinfo_exists=sequence &
+DAEMON=$!
+while [ ! -S "$DIR/socket" ]; do sleep 0.1; done
+
+echo "Daemon client: $(run -odaemon_socket="$DIR/socket")"
+
+kill $DAEMON
+wait $DAEMON 2>/dev/null
+rm -rf "$DIR"
@@ -0,0 +1,156 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+/* Compares the info stream writer with stdio on the output of registers,
+ * escaped strings and frame fields written to /dev/null. */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "info.h"
+#include "conf.h"
+
+/** Number of threads with 256 registers. */
+#define THREADS 20000
+
+static const char path[] = "/usr/lib/x86_64-linux-gnu/libstdc++.so.6.0.30 \"quoted\"";
+static const char sym[] = "_ZNSt6vectorIiSaIiEE17_M_realloc_insertIJRKiEEEvN9__gnu_cxx"
+		"17__normal_iteratorIPiS1_EEDpOT_";
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/** Write a double quoted YAML string by stdio, escaping a byte at a time. */
+static void stdio_yaml(const char *s, FILE *f)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		switch (*s) {
+			case '\n': fputs("\\n", f); break;
+			case '\t': fputs("\\t", f); break;
+			case '\r': fputs("\\r", f); break;
+			case '\\': fputs("\\\\", f); break;
+			case '"': fputs("\\\"", f); break;
+			default:
+				if (isprint((unsigned char)*s)) {
+					fputc(*s, f);
+				} else {
+					fprintf(f, "\\x%02x", (unsigned char)*s);
+				}
+		}
+	}
+	fputc('"', f);
+}
+
+static void report(const char *name, int count, double t0, double t1, double t2)
+{
+	printf("%-24s %8d: stdio %.3f s, info_out %.3f s, %.1fx\n",
+			name, count, t1 - t0, t2 - t1, (t1 - t0) / (t2 - t1));
+}
+
+int main(void)
+{
+	struct run_output_s stream = { .output_fd = -1 };
+	static char fbuf[65536];
+	struct info_out_s *o;
+	double t0, t1, t2;
+	uint64_t value;
+	int i, j;
+	FILE *f;
+
+	f = fopen("/dev/null", "w");
+	if (!f) {
+		perror("/dev/null");
+		return 1;
+	}
+	setvbuf(f, fbuf, _IOFBF, sizeof fbuf);
+	stream.output_fd = fileno(f);
+	o = info_out_open(&stream);
+	if (!o) {
+		return 1;
+	}
+
+	t0 = now();
+	for (i = 0; i < THREADS; i++) {
+		for (j = 0; j < 256; j++) {
+			value = (uint64_t)i * 0x9e3779b97f4a7c15ULL + j;
+			fprintf(f, " 0x%016" PRIx64, value);
+		}
+	}
+	fflush(f);
+	t1 = now();
+	for (i = 0; i < THREADS; i++) {
+		for (j = 0; j < 256; j++) {
+			value = (uint64_t)i * 0x9e3779b97f4a7c15ULL + j;
+			info_out_puts(o, " 0x");
+			info_out_hex16(o, value);
+		}
+	}
+	info_out_flush(o);
+	t2 = now();
+	report("registers x 256", THREADS, t0, t1, t2);
+
+	t0 = now();
+	for (i = 0; i < THREADS * 20; i++) {
+		stdio_yaml(path, f);
+		stdio_yaml(sym, f);
+	}
+	fflush(f);
+	t1 = now();
+	for (i = 0; i < THREADS * 20; i++) {
+		info_out_yaml(o, path);
+		info_out_yaml(o, sym);
+	}
+	info_out_flush(o);
+	t2 = now();
+	report("escaped strings x 2", THREADS * 20, t0, t1, t2);
+
+	t0 = now();
+	for (i = 0; i < THREADS * 50; i++) {
+		fprintf(f, ", s: %s,%s o: %#5lx, l: %#5lx, e: %d, S: %d",
+				"main", "   ", (long)i & 0xfff, (long)i & 0x3ff, 0, 0);
+	}
+	fflush(f);
+	t1 = now();
+	for (i = 0; i < THREADS * 50; i++) {
+		info_out_puts(o, ", s: main,    o: ");
+		info_out_hex_alt(o, i & 0xfff, 5);
+		info_out_puts(o, ", l: ");
+		info_out_hex_alt(o, i & 0x3ff, 5);
+		info_out_puts(o, ", e: ");
+		info_out_int(o, 0);
+		info_out_puts(o, ", S: ");
+		info_out_int(o, 0);
+	}
+	info_out_flush(o);
+	t2 = now();
+	report("frame fields", THREADS * 50, t0, t1, t2);
+
+	return 0;
+}
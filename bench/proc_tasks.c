@@ -0,0 +1,130 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+/* Measures reading of namespace PIDs of tasks and their lookups over
+ * a synthetic /proc/PID directory.
+ * Usage: proc_tasks [tasks] [groups] */
+
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "conf.h"
+#include "proc.h"
+
+/** First thread ID of synthetic tasks, they are 1, 2, ... in the namespace. */
+#define PROC_TASKS_TID 200000
+
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/** Create the status file of a task similar to ones of the kernel.
+ *  @return 0 on success, -1 on error */
+static int write_status(const char *dir, int tid, int nspid, int groups)
+{
+	char path[PATH_MAX];
+	FILE *f;
+	int i;
+
+	snprintf(path, sizeof path, "%s/task/%d", dir, tid);
+	if (mkdir(path, 0755)) {
+		perror(path);
+		return -1;
+	}
+
+	strcat(path, "/status");
+	f = fopen(path, "w");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	fprintf(f, "Name:\tcrash\nUmask:\t0022\nState:\tS (sleeping)\nTgid:\t%d\n"
+			"Ngid:\t0\nPid:\t%d\nPPid:\t1\nTracerPid:\t0\n"
+			"Uid:\t0\t0\t0\t0\nGid:\t0\t0\t0\t0\nFDSize:\t64\nGroups:\t",
+			PROC_TASKS_TID, tid);
+	for (i = 0; i < groups; i++) {
+		fprintf(f, "%d ", 1000 + i);
+	}
+	fprintf(f, "\nNStgid:\t%d\t1\nNSpid:\t%d\t%d\nNSpgid:\t1\t1\nNSsid:\t1\t1\n",
+			PROC_TASKS_TID, tid, nspid);
+	for (i = 0; i < 40; i++) {
+		fprintf(f, "VmPeak:\t  1000 kB\n");
+	}
+
+	return fclose(f) ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int tasks = argc > 1 ? atoi(argv[1]) : 10000;
+	int groups = argc > 2 ? atoi(argv[2]) : 0;
+	char dir[] = "/tmp/crashinfo-bench.XXXXXX", path[PATH_MAX];
+	double t0, t1, t2;
+	long sum = 0;
+	int i, rtn;
+
+	if (!mkdtemp(dir)) {
+		perror(dir);
+		return 1;
+	}
+	snprintf(path, sizeof path, "%s/task", dir);
+	rtn = mkdir(path, 0755);
+	for (i = 0; !rtn && i < tasks; i++) {
+		rtn = write_status(dir, PROC_TASKS_TID + i, i + 1, groups);
+	}
+
+	conf.proc.path = dir;
+	conf.proc.mappings_source = CONF_MAPPINGS_SOURCE_CORE;
+	run.proc_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	t0 = now();
+	if (!rtn && run.proc_fd >= 0) {
+		rtn = read_proc_info();
+	}
+	t1 = now();
+	for (i = 1; !rtn && i <= tasks; i++) {
+		sum += proc_pid_map(i) - PROC_TASKS_TID - i + 1;
+	}
+	t2 = now();
+
+	if (!rtn) {
+		printf("%7d tasks, %5d groups: read %.3f s, lookups %.3f s%s\n",
+				tasks, groups, t1 - t0, t2 - t1, sum ? ", WRONG MAPPING" : "");
+	}
+
+	snprintf(path, sizeof path, "rm -rf '%s'", dir);
+	if (system(path)) {
+		fprintf(stderr, "Can't remove '%s'\n", dir);
+	}
+
+	return rtn || sum ? 1 : 0;
+}
@@ -0,0 +1,254 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "cache.h"
+#include "conf.h"
+#include "log.h"
+
+/** Temporary files older than this number of seconds were left by a killed
+ *  instance and are removed. */
+#define CACHE_TEMP_AGE 3600
+
+/** Cached file considered for eviction. */
+struct cache_file_s {
+	char name[NAME_MAX + 1];
+	off_t size;
+	time_t mtime;
+};
+
+/** Check the cache key can't escape the cache directory. */
+static int cache_key_valid(const char *build_id, const char *kind)
+{
+	return *build_id && !strchr(build_id, '/') && *kind && !strchr(kind, '/');
+}
+
+/** Map a cached file and mark it as recently used.
+ *  @param[in] build_id - build-id of the image the file was derived from
+ *  @param[in] kind - kind of the cached data, used as the file suffix
+ *  @param[out] e - mapped file, must be released by cache_unmap()
+ *  @return 0 on a hit, -1 if the file isn't cached */
+int cache_map(const char *build_id, const char *kind, struct cache_entry_s *e)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	void *map;
+	int fd;
+
+	e->data = NULL;
+	e->size = 0;
+
+	if (!conf.cache.path || !cache_key_valid(build_id, kind)) {
+		return -1;
+	}
+
+	snprintf(path, sizeof path, "%s/%s.%s", conf.cache.path, build_id, kind);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		log_warn("Can't map '%s': %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	// Modification time orders files for the eviction
+	if (futimens(fd, NULL)) {
+		log_dbg("Can't touch '%s': %s", path, strerror(errno));
+	}
+	close(fd);
+
+	e->data = map;
+	e->size = st.st_size;
+	return 0;
+}
+
+/** Release a mapped file. */
+void cache_unmap(struct cache_entry_s *e)
+{
+	if (e->data) {
+		munmap((void *)e->data, e->size);
+		e->data = NULL;
+	}
+}
+
+/** Order files by the modification time, the oldest first. */
+static int cache_file_cmp(const void *a, const void *b)
+{
+	const struct cache_file_s *fa = a, *fb = b;
+
+	return fa->mtime < fb->mtime ? -1 : fa->mtime > fb->mtime;
+}
+
+/** Remove expired files and the least recently used files over the cache size. */
+static void cache_evict(void)
+{
+	struct cache_file_s *files = NULL, *tmp;
+	int i, count = 0, alloc = 0, dfd;
+	unsigned long long total = 0;
+	struct dirent *de;
+	struct stat st;
+	time_t now;
+	DIR *d;
+
+	dfd = open(conf.cache.path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd < 0 || !(d = fdopendir(dfd))) {
+		log_warn("Can't open '%s': %s", conf.cache.path, strerror(errno));
+		if (dfd >= 0) {
+			close(dfd);
+		}
+		return;
+	}
+
+	now = time(NULL);
+	while (NULL != (de = readdir(d))) {
+		if (fstatat(dfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW)
+		    || !S_ISREG(st.st_mode)) {
+			continue;
+		}
+
+		// Temporary files are being written by other instances
+		if (de->d_name[0] == '.') {
+			if (now - st.st_mtime > CACHE_TEMP_AGE) {
+				log_dbg("Removing stale '%s/%s'", conf.cache.path, de->d_name);
+				unlinkat(dfd, de->d_name, 0);
+			}
+			continue;
+		}
+
+		if (conf.cache.max_age > 0 && now - st.st_mtime > conf.cache.max_age) {
+			log_dbg("Removing expired '%s/%s'", conf.cache.path, de->d_name);
+			unlinkat(dfd, de->d_name, 0);
+			continue;
+		}
+
+		if (count == alloc) {
+			alloc = alloc ? 2 * alloc : 64;
+			tmp = realloc(files, alloc * sizeof *files);
+			if (!tmp) {
+				log_err("Can't allocate memory for the cache eviction");
+				goto out;
+			}
+			files = tmp;
+		}
+		strcpy(files[count].name, de->d_name);
+		files[count].size = st.st_size;
+		files[count].mtime = st.st_mtime;
+		total += st.st_size;
+		count++;
+	}
+
+	if (conf.cache.size >= 0 && total > (unsigned long long)conf.cache.size) {
+		qsort(files, count, sizeof *files, cache_file_cmp);
+		for (i = 0; i < count && total > (unsigned long long)conf.cache.size; i++) {
+			log_dbg("Evicting '%s/%s'", conf.cache.path, files[i].name);
+			if (!unlinkat(dfd, files[i].name, 0)) {
+				total -= files[i].size;
+			}
+		}
+	}
+
+out:	free(files);
+	closedir(d);
+}
+
+/** Store data to the cache. The file is written under a temporary name and
+ *  renamed, so concurrent crashinfo instances see either the whole file or
+ *  nothing.
+ *  @param[in] build_id - build-id of the image the data were derived from
+ *  @param[in] kind - kind of the cached data, used as the file suffix
+ *  @return 0 on success, -1 on error */
+int cache_store(const char *build_id, const char *kind, const void *data, size_t size)
+{
+	char path[PATH_MAX], tmp[PATH_MAX];
+	const char *p = data;
+	ssize_t rtn;
+	int fd;
+
+	if (!conf.cache.path || !cache_key_valid(build_id, kind)) {
+		return -1;
+	}
+
+	if (conf.cache.size >= 0 && size > (unsigned long long)conf.cache.size) {
+		log_dbg("%s.%s doesn't fit to the cache", build_id, kind);
+		return -1;
+	}
+
+	if (mkdir(conf.cache.path, 0755) && errno != EEXIST) {
+		log_warn("Can't create '%s': %s", conf.cache.path, strerror(errno));
+		return -1;
+	}
+
+	snprintf(path, sizeof path, "%s/%s.%s", conf.cache.path, build_id, kind);
+	snprintf(tmp, sizeof tmp, "%s/.%s.%s.XXXXXX", conf.cache.path, build_id, kind);
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0) {
+		log_warn("Can't create '%s': %s", tmp, strerror(errno));
+		return -1;
+	}
+
+	while (size) {
+		rtn = write(fd, p, size);
+		if (rtn < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			log_warn("Can't write '%s': %s", tmp, strerror(errno));
+			goto err0;
+		}
+		p += rtn;
+		size -= rtn;
+	}
+
+	if (fchmod(fd, 0644) || rename(tmp, path)) {
+		log_warn("Can't store '%s': %s", path, strerror(errno));
+		goto err0;
+	}
+	close(fd);
+
+	cache_evict();
+	return 0;
+
+err0:	unlink(tmp);
+	close(fd);
+	return -1;
+}
@@ -0,0 +1,40 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+/** Cached file mapped to the memory. */
+struct cache_entry_s {
+	/** File content or NULL if it's not mapped. */
+	const void *data;
+	size_t size;
+};
+
+int cache_map(const char *build_id, const char *kind, struct cache_entry_s *e);
+
+int cache_store(const char *build_id, const char *kind, const void *data, size_t size);
+
+void cache_unmap(struct cache_entry_s *e);
+
+#endif // CACHE_H
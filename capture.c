@@ -0,0 +1,467 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <elf.h>
+
+#include "elfcore.h"
+#include "capture.h"
+#include "log.h"
+
+/** Captured area below the stack pointer (red zone and signal frames). */
+#define CAPTURE_REDZONE 4096
+
+/** Segments containing an instruction pointer are captured entirely if they
+ *  are not bigger than this (e.g. JIT code or the dumped executable header). */
+#define CAPTURE_SEGMENT_MAX (1024*1024)
+
+/** Captured core region. */
+struct capture_region_s {
+	/** Virtual address of the region. */
+	uint64_t vaddr;
+	/** Offset of the region in the core. */
+	uint64_t offset;
+	/** Length of the region. */
+	uint64_t len;
+	/** Captured data. */
+	char *data;
+};
+
+/** Core regions needed by the unwinder. */
+struct capture_s {
+	/** Regions sorted by the virtual address. */
+	struct capture_region_s *regions;
+	/** Regions sorted by the offset in the core. */
+	struct capture_region_s **order;
+	/** Number of regions. */
+	int count;
+	/** First region in order, which wasn't fully captured yet. */
+	int next;
+	/** Offset of the end of the last region. */
+	unsigned long long end;
+	/** Number of core bytes passed to capture_data(). */
+	unsigned long long pos;
+	/** All regions were captured or the core ended. */
+	bool done;
+	/** Regions point to the mapped core file of the given size. */
+	void *map;
+	size_t map_size;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/** Find a loadable segment containing the address. */
+static const struct elf_phdr_s *find_segment(const struct elf_phdr_s *phdrs,
+		int num, uint64_t addr)
+{
+	int i;
+
+	for (i = 0; i < num; i++) {
+		if (phdrs[i].type == PT_LOAD && addr - phdrs[i].vaddr < phdrs[i].memsz) {
+			return &phdrs[i];
+		}
+	}
+
+	return NULL;
+}
+
+/** Add a region of the segment to the plan. */
+static void plan_add(struct capture_s *cap, const struct elf_phdr_s *seg,
+		uint64_t lo, uint64_t hi)
+{
+	struct capture_region_s *r = &cap->regions[cap->count];
+
+	if (lo < seg->vaddr) {
+		lo = seg->vaddr;
+	}
+	if (hi > seg->vaddr + seg->filesz) {
+		hi = seg->vaddr + seg->filesz;
+	}
+	if (lo >= hi) {
+		return;
+	}
+
+	r->vaddr = lo;
+	r->offset = seg->offset + (lo - seg->vaddr);
+	r->len = hi - lo;
+	cap->count++;
+}
+
+static int cmp_vaddr(const void *a, const void *b)
+{
+	const struct capture_region_s *ra = a, *rb = b;
+
+	return ra->vaddr < rb->vaddr ? -1 : ra->vaddr > rb->vaddr;
+}
+
+static int cmp_offset(const void *a, const void *b)
+{
+	const struct capture_region_s *ra = *(void **)a, *rb = *(void **)b;
+
+	return ra->offset < rb->offset ? -1 : ra->offset > rb->offset;
+}
+
+/** Get registers of all threads stored in the core.
+ *  @return Number of threads or -1, *threads must be freed by the caller */
+static int plan_threads(const void *head, size_t len, struct elf_thread_s **threads)
+{
+	struct elf_thread_s *tmp;
+	int count, max = 64;
+
+	for (*threads = NULL;; max *= 2) {
+		tmp = realloc(*threads, max * sizeof *tmp);
+		if (!tmp) {
+			return -1;
+		}
+		*threads = tmp;
+
+		count = elf_core_threads(head, len, *threads, max);
+		if (count < max) {
+			return count;
+		}
+	}
+}
+
+/** Plan capturing of core regions needed by the unwinder: a window of the
+ *  stack around the stack pointer of each thread and small segments holding
+ *  code threads were executing.
+ *  @param[in] head - beginning of the core with program headers and notes
+ *  @param[in] len - length of the head
+ *  @param[in] window - size of the captured stack above the stack pointer
+ *  @return The plan or NULL if the core can't be parsed */
+struct capture_s *capture_plan(const void *head, size_t len, size_t window)
+{
+	const struct elf_phdr_s *seg;
+	struct elf_phdr_s *phdrs;
+	struct elf_thread_s *threads;
+	struct capture_region_s *r;
+	unsigned long long bytes = 0;
+	struct capture_s *cap;
+	int num, count, i;
+
+	num = elf_core_phdrs(head, len, &phdrs);
+	if (num < 0) {
+		log_dbg("Core program headers are not available");
+		goto err0;
+	}
+
+	count = plan_threads(head, len, &threads);
+	if (count <= 0) {
+		log_dbg("Thread registers are not available in the core");
+		goto err1;
+	}
+
+	cap = calloc(1, sizeof *cap);
+	if (!cap) {
+		goto err2;
+	}
+
+	cap->regions = calloc(2 * count, sizeof *cap->regions);
+	if (!cap->regions) {
+		goto err3;
+	}
+
+	for (i = 0; i < count; i++) {
+		seg = find_segment(phdrs, num, threads[i].sp);
+		if (seg) {
+			plan_add(cap, seg, threads[i].sp - CAPTURE_REDZONE,
+					threads[i].sp + window);
+		}
+
+		seg = find_segment(phdrs, num, threads[i].ip);
+		if (seg && seg->filesz <= CAPTURE_SEGMENT_MAX) {
+			plan_add(cap, seg, seg->vaddr, seg->vaddr + seg->filesz);
+		}
+	}
+
+	if (!cap->count) {
+		log_dbg("No core region to capture");
+		free(cap->regions);
+		free(cap);
+		goto err1;
+	}
+
+	// Merge overlapping regions of the same segment
+	qsort(cap->regions, cap->count, sizeof *cap->regions, cmp_vaddr);
+	for (i = 1, r = cap->regions; i < cap->count; i++) {
+		struct capture_region_s *n = &cap->regions[i];
+
+		if (r->vaddr + r->len >= n->vaddr
+		    && r->offset - r->vaddr == n->offset - n->vaddr) {
+			if (n->vaddr + n->len > r->vaddr + r->len) {
+				r->len = n->vaddr + n->len - r->vaddr;
+			}
+		} else {
+			*++r = *n;
+		}
+	}
+	cap->count = r - cap->regions + 1;
+
+	cap->order = malloc(cap->count * sizeof *cap->order);
+	if (!cap->order) {
+		goto err4;
+	}
+
+	for (i = 0; i < cap->count; i++) {
+		r = &cap->regions[i];
+		r->data = malloc(r->len);
+		if (!r->data) {
+			goto err4;
+		}
+		cap->order[i] = r;
+		bytes += r->len;
+		if (r->offset + r->len > cap->end) {
+			cap->end = r->offset + r->len;
+		}
+	}
+	qsort(cap->order, cap->count, sizeof *cap->order, cmp_offset);
+
+	pthread_mutex_init(&cap->lock, NULL);
+	pthread_cond_init(&cap->cond, NULL);
+
+	log_dbg("Capturing %d core regions of %d threads, %llu bytes",
+			cap->count, count, bytes);
+
+	free(threads);
+	free(phdrs);
+	return cap;
+
+err4:	for (i = 0; i < cap->count; i++) {
+		free(cap->regions[i].data);
+	}
+	free(cap->order);
+	free(cap->regions);
+err3:	free(cap);
+err2:	log_err("Can't allocate memory for capturing the core");
+err1:	free(threads);
+	free(phdrs);
+err0:	return NULL;
+}
+
+/** Map the core file, so the unwinder has random access to all its
+ *  loadable segments. The capture is finished immediately.
+ *  @param[in] fd - the core file
+ *  @return The capture or NULL if the core can't be mapped or parsed */
+struct capture_s *capture_map(int fd)
+{
+	struct elf_phdr_s *phdrs;
+	struct capture_region_s *r;
+	struct capture_s *cap;
+	struct stat st;
+	int num, i;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		goto err0;
+	}
+
+	cap = calloc(1, sizeof *cap);
+	if (!cap) {
+		goto err0;
+	}
+
+	cap->map_size = st.st_size;
+	cap->map = mmap(NULL, cap->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (cap->map == MAP_FAILED) {
+		log_err("Can't map the core: %s", strerror(errno));
+		goto err1;
+	}
+	madvise(cap->map, cap->map_size, MADV_RANDOM);
+
+	num = elf_core_phdrs(cap->map, cap->map_size, &phdrs);
+	if (num < 0) {
+		log_dbg("Core program headers are not available");
+		goto err2;
+	}
+
+	cap->regions = calloc(num ?: 1, sizeof *cap->regions);
+	if (!cap->regions) {
+		goto err3;
+	}
+
+	// Segments of a truncated core are shortened
+	for (i = 0; i < num; i++) {
+		if (phdrs[i].type != PT_LOAD || phdrs[i].offset >= cap->map_size) {
+			continue;
+		}
+		r = &cap->regions[cap->count++];
+		r->vaddr = phdrs[i].vaddr;
+		r->offset = phdrs[i].offset;
+		r->len = phdrs[i].filesz;
+		if (r->len > cap->map_size - r->offset) {
+			r->len = cap->map_size - r->offset;
+		}
+		r->data = (char *)cap->map + r->offset;
+	}
+	qsort(cap->regions, cap->count, sizeof *cap->regions, cmp_vaddr);
+
+	pthread_mutex_init(&cap->lock, NULL);
+	pthread_cond_init(&cap->cond, NULL);
+	cap->pos = cap->end = cap->map_size;
+	cap->next = cap->count;
+	cap->done = true;
+
+	log_dbg("Mapped %d core segments, %zu bytes", cap->count, cap->map_size);
+
+	free(phdrs);
+	return cap;
+
+err3:	free(phdrs);
+err2:	munmap(cap->map, cap->map_size);
+err1:	free(cap);
+err0:	return NULL;
+}
+
+/** Pass the core data to the capture. Data must be passed sequentially.
+ *  @param[in] off - offset of the data in the core
+ *  @param[in] buf - the data
+ *  @param[in] len - length of the data */
+void capture_data(struct capture_s *cap, unsigned long long off,
+		const void *buf, size_t len)
+{
+	unsigned long long lo, hi, stop = off + len;
+	struct capture_region_s *r;
+	int i;
+
+	for (i = cap->next; i < cap->count; i++) {
+		r = cap->order[i];
+		if (r->offset >= stop) {
+			break;
+		}
+
+		lo = r->offset > off ? r->offset : off;
+		hi = r->offset + r->len < stop ? r->offset + r->len : stop;
+		if (lo < hi) {
+			memcpy(r->data + (lo - r->offset), (const char *)buf + (lo - off), hi - lo);
+		}
+	}
+
+	while (cap->next < cap->count
+	       && cap->order[cap->next]->offset + cap->order[cap->next]->len <= stop) {
+		cap->next++;
+	}
+
+	cap->pos = stop;
+	if (stop >= cap->end) {
+		capture_finish(cap);
+	}
+}
+
+/** Get the number of bytes, which are not captured, at the core offset.
+ *  @return 0 if the offset is inside a captured region, ULLONG_MAX if there
+ *          is no region behind the offset */
+unsigned long long capture_skip(struct capture_s *cap, unsigned long long off)
+{
+	struct capture_region_s *r;
+	int i;
+
+	for (i = cap->next; i < cap->count; i++) {
+		r = cap->order[i];
+		if (r->offset + r->len <= off) {
+			continue;
+		}
+		return r->offset <= off ? 0 : r->offset - off;
+	}
+
+	return ULLONG_MAX;
+}
+
+/** Mark the capture as finished, e.g. when the core ends. */
+void capture_finish(struct capture_s *cap)
+{
+	pthread_mutex_lock(&cap->lock);
+	cap->done = true;
+	pthread_cond_broadcast(&cap->cond);
+	pthread_mutex_unlock(&cap->lock);
+}
+
+/** Wait until the capture is finished. */
+void capture_wait(struct capture_s *cap)
+{
+	pthread_mutex_lock(&cap->lock);
+	while (!cap->done) {
+		pthread_cond_wait(&cap->cond, &cap->lock);
+	}
+	pthread_mutex_unlock(&cap->lock);
+}
+
+/** Read captured memory of the crashed process. Must be called after
+ *  capture_wait() returns.
+ *  @param[in] addr - virtual address
+ *  @param[out] buf - read data
+ *  @param[in] len - number of bytes to read
+ *  @return 0 on success, -1 if the memory wasn't captured */
+int capture_read(const struct capture_s *cap, uint64_t addr, void *buf, size_t len)
+{
+	const struct capture_region_s *r;
+	int lo = 0, hi = cap->count;
+
+	// Find the last region starting at or below addr
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (cap->regions[mid].vaddr <= addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == 0) {
+		return -1;
+	}
+
+	r = &cap->regions[lo - 1];
+	if (addr - r->vaddr + len > r->len
+	    || r->offset + (addr - r->vaddr) + len > cap->pos) {
+		return -1;
+	}
+
+	memcpy(buf, r->data + (addr - r->vaddr), len);
+	return 0;
+}
+
+/** Release the capture. */
+void capture_free(struct capture_s *cap)
+{
+	int i;
+
+	if (!cap) {
+		return;
+	}
+
+	if (cap->map) {
+		munmap(cap->map, cap->map_size);
+	} else for (i = 0; i < cap->count; i++) {
+		free(cap->regions[i].data);
+	}
+	pthread_cond_destroy(&cap->cond);
+	pthread_mutex_destroy(&cap->lock);
+	free(cap->order);
+	free(cap->regions);
+	free(cap);
+}
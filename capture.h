@@ -0,0 +1,47 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+struct capture_s;
+
+struct capture_s *capture_plan(const void *head, size_t len, size_t window);
+
+struct capture_s *capture_map(int fd);
+
+void capture_data(struct capture_s *cap, unsigned long long off,
+		const void *buf, size_t len);
+
+unsigned long long capture_skip(struct capture_s *cap, unsigned long long off);
+
+void capture_finish(struct capture_s *cap);
+
+void capture_wait(struct capture_s *cap);
+
+int capture_read(const struct capture_s *cap, uint64_t addr, void *buf, size_t len);
+
+void capture_free(struct capture_s *cap);
+
+#endif // CAPTURE_H
@@ -0,0 +1,584 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "cbor.h"
+#include "info.h"
+
+/** Additional information of the initial byte. */
+#define CBOR_AI_1 24
+#define CBOR_AI_8 27
+#define CBOR_AI_INDEFINITE 31
+
+/** Break stop code of indefinite length items. */
+#define CBOR_BREAK 0xff
+
+/** Maximum nesting of items skipped by the reader. */
+#define CBOR_MAX_DEPTH 64
+
+/** Messages logged while the document is written, they are added to its
+ *  end as items of the log array. */
+static struct {
+	struct info_out_s out;
+	int count;
+} cbor_log_buf = {
+	.out = { .bol = 1, .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+
+/** Write the head of an item with the shortest encoding of the argument. */
+static void cbor_head(struct info_out_s *out, enum cbor_major_e major, uint64_t arg)
+{
+	unsigned char buf[9];
+	int len, i;
+
+	if (arg < CBOR_AI_1) {
+		buf[0] = major << 5 | arg;
+		info_out_putc(out, buf[0]);
+		return;
+	}
+
+	for (len = 1, i = 0; len < 8 && arg >> len * 8; len *= 2, i++);
+	buf[0] = major << 5 | (CBOR_AI_1 + i);
+	for (i = len; i > 0; i--, arg >>= 8) {
+		buf[i] = arg;
+	}
+	info_out_write(out, buf, len + 1);
+}
+
+static void cbor_indefinite(struct info_out_s *out, enum cbor_major_e major)
+{
+	info_out_putc(out, major << 5 | CBOR_AI_INDEFINITE);
+}
+
+static void cbor_break(struct info_out_s *out)
+{
+	info_out_putc(out, CBOR_BREAK);
+}
+
+static void cbor_null(struct info_out_s *out)
+{
+	info_out_putc(out, CBOR_SIMPLE << 5 | CBOR_NULL);
+}
+
+static void cbor_str(struct info_out_s *out, const char *s)
+{
+	size_t len = strlen(s);
+
+	cbor_head(out, CBOR_TEXT, len);
+	info_out_write(out, s, len);
+}
+
+/** Write a string or null if it's NULL. */
+static void cbor_str_null(struct info_out_s *out, const char *s)
+{
+	if (s) {
+		cbor_str(out, s);
+	} else {
+		cbor_null(out);
+	}
+}
+
+static void cbor_int(struct info_out_s *out, int64_t value)
+{
+	if (value < 0) {
+		cbor_head(out, CBOR_NINT, -1 - value);
+	} else {
+		cbor_head(out, CBOR_UINT, value);
+	}
+}
+
+static void cbor_double(struct info_out_s *out, double value)
+{
+	unsigned char buf[9];
+	uint64_t bits;
+	int i;
+
+	memcpy(&bits, &value, sizeof bits);
+	buf[0] = CBOR_SIMPLE << 5 | CBOR_AI_8;
+	for (i = 8; i > 0; i--, bits >>= 8) {
+		buf[i] = bits;
+	}
+	info_out_write(out, buf, sizeof buf);
+}
+
+static void cbor_timeval(struct info_out_s *out, const struct timeval *tv)
+{
+	cbor_double(out, tv->tv_sec + tv->tv_usec / 1e6);
+}
+
+/** Start a key of the named section or null if it's empty. */
+static void cbor_section(struct info_out_s *out, const char *key, enum cbor_major_e major,
+		const char *none)
+{
+	cbor_str(out, key);
+	if (none) {
+		cbor_null(out);
+	} else {
+		cbor_indefinite(out, major);
+	}
+}
+
+static void cbor_begin(struct info_out_s *out, const char *datetime)
+{
+	cbor_head(out, CBOR_TAG, CBOR_TAG_SELF);
+	cbor_indefinite(out, CBOR_MAP);
+	cbor_str(out, "datetime");
+	cbor_head(out, CBOR_TAG, CBOR_TAG_DATETIME);
+	cbor_str(out, datetime);
+}
+
+static void cbor_exe(struct info_out_s *out, const char *exe)
+{
+	cbor_str(out, "exe");
+	cbor_str_null(out, exe);
+}
+
+static void cbor_cmdline_begin(struct info_out_s *out)
+{
+	cbor_section(out, "cmdline", CBOR_ARRAY, NULL);
+}
+
+static void cbor_cmdline_arg(struct info_out_s *out, int index, const char *arg)
+{
+	cbor_str(out, arg);
+}
+
+static void cbor_mappings_begin(struct info_out_s *out, int known)
+{
+	cbor_section(out, "executable_mappings", CBOR_MAP, known ? NULL : "");
+}
+
+static void cbor_mapping(struct info_out_s *out, uint64_t addr, const char *file, const char *build_id)
+{
+	cbor_head(out, CBOR_UINT, addr);
+	if (build_id) {
+		cbor_head(out, CBOR_MAP, 2);
+		cbor_str(out, "f");
+		cbor_str(out, file);
+		cbor_str(out, "b");
+		cbor_str_null(out, build_id[0] ? build_id : NULL);
+	} else {
+		cbor_str(out, file);
+	}
+}
+
+static void cbor_proc_dump_begin(struct info_out_s *out, int indent, const char *none)
+{
+	cbor_section(out, "proc_dump", CBOR_MAP, none);
+}
+
+static void cbor_proc_file(struct info_out_s *out, int indent, const char *name,
+		const char *data, size_t len, int err)
+{
+	cbor_str(out, name);
+	if (!data) {
+		cbor_null(out);
+		return;
+	}
+
+	cbor_head(out, CBOR_TEXT, len);
+	info_out_write(out, data, len);
+}
+
+static void cbor_threads_begin(struct info_out_s *out, const char *none)
+{
+	cbor_section(out, "threads", CBOR_ARRAY, none);
+}
+
+static void cbor_thread_begin(struct info_out_s *out, int tid)
+{
+	cbor_indefinite(out, CBOR_MAP);
+	cbor_str(out, "tid");
+	cbor_int(out, tid);
+}
+
+static void cbor_thread_time(struct info_out_s *out, const char *key, const struct timeval *tv)
+{
+	cbor_str(out, key);
+	cbor_timeval(out, tv);
+}
+
+static void cbor_registers_begin(struct info_out_s *out)
+{
+	cbor_section(out, "registers", CBOR_ARRAY, NULL);
+}
+
+static void cbor_reg(struct info_out_s *out, int index, uint64_t value)
+{
+	cbor_head(out, CBOR_UINT, value);
+}
+
+static void cbor_stack_ref(struct info_out_s *out, uint64_t id)
+{
+	cbor_str(out, "stack");
+	cbor_head(out, CBOR_UINT, id);
+}
+
+static void cbor_backtrace_begin(struct info_out_s *out)
+{
+	cbor_section(out, "backtrace", CBOR_ARRAY, NULL);
+}
+
+static void cbor_frame(struct info_out_s *out, int depth, const struct info_frame_s *f)
+{
+	if (f->deferred) {
+		cbor_head(out, CBOR_MAP, 2 + (f->module >= 0));
+	} else {
+		cbor_head(out, CBOR_MAP, 3 + (f->name ? 3 : 0) + (f->file != NULL));
+	}
+
+	cbor_str(out, "a");
+	if (f->ip_known) {
+		cbor_head(out, CBOR_UINT, f->ip);
+	} else {
+		cbor_null(out);
+	}
+
+	if (f->deferred) {
+		if (f->module >= 0) {
+			cbor_str(out, "m");
+			cbor_int(out, f->module);
+		}
+		cbor_str(out, "S");
+		cbor_int(out, f->signal);
+		return;
+	}
+
+	if (f->name) {
+		cbor_str(out, "s");
+		cbor_str(out, f->name);
+		cbor_str(out, "o");
+		cbor_head(out, CBOR_UINT, f->off);
+		cbor_str(out, "l");
+		cbor_head(out, CBOR_UINT, f->len);
+	}
+	cbor_str(out, "e");
+	cbor_int(out, f->exception);
+	cbor_str(out, "S");
+	cbor_int(out, f->signal);
+	if (f->file) {
+		cbor_str(out, "f");
+		cbor_str(out, f->file);
+	}
+}
+
+static void cbor_stacks_begin(struct info_out_s *out)
+{
+	cbor_section(out, "stacks", CBOR_ARRAY, NULL);
+}
+
+static void cbor_stack_begin(struct info_out_s *out, uint64_t id, const int *tids, int count)
+{
+	int i;
+
+	cbor_indefinite(out, CBOR_MAP);
+	cbor_str(out, "id");
+	cbor_head(out, CBOR_UINT, id);
+	cbor_str(out, "tids");
+	cbor_head(out, CBOR_ARRAY, count);
+	for (i = 0; i < count; i++) {
+		cbor_int(out, tids[i]);
+	}
+}
+
+static void cbor_counter(struct info_out_s *out, const char *key, unsigned long long value)
+{
+	cbor_str(out, key);
+	cbor_head(out, CBOR_UINT, value);
+}
+
+static void cbor_pair(struct info_out_s *out, const char *key, const char *key1,
+		unsigned long long value1, const char *key2, unsigned long long value2)
+{
+	cbor_str(out, key);
+	cbor_head(out, CBOR_MAP, 2);
+	cbor_counter(out, key1, value1);
+	cbor_counter(out, key2, value2);
+}
+
+static void cbor_end(struct info_out_s *out, const struct timeval *processing_time)
+{
+	cbor_str(out, "processing_time");
+	cbor_timeval(out, processing_time);
+
+	pthread_mutex_lock(&cbor_log_buf.out.lock);
+	if (cbor_log_buf.count) {
+		cbor_str(out, "log");
+		cbor_head(out, CBOR_ARRAY, cbor_log_buf.count);
+		info_out_write(out, cbor_log_buf.out.buf, cbor_log_buf.out.len);
+		free(cbor_log_buf.out.buf);
+		cbor_log_buf.out.buf = NULL;
+		cbor_log_buf.out.len = cbor_log_buf.out.size = 0;
+		cbor_log_buf.count = 0;
+	}
+	pthread_mutex_unlock(&cbor_log_buf.out.lock);
+
+	cbor_break(out);
+}
+
+/** Messages may be logged from any thread, the buffer is locked. */
+static void cbor_log(struct info_out_s *out, const char *prefix, const char *format, va_list ap)
+{
+	char *msg;
+	size_t len;
+
+	if (vasprintf(&msg, format, ap) < 0) {
+		return;
+	}
+
+	len = strlen(prefix) + strlen(msg);
+	pthread_mutex_lock(&cbor_log_buf.out.lock);
+	cbor_head(&cbor_log_buf.out, CBOR_TEXT, len);
+	info_out_puts(&cbor_log_buf.out, prefix);
+	info_out_puts(&cbor_log_buf.out, msg);
+	cbor_log_buf.count++;
+	pthread_mutex_unlock(&cbor_log_buf.out.lock);
+	free(msg);
+}
+
+/** CBOR encoder, messages are collected and written at the end. */
+const struct info_enc_s info_cbor = {
+	.begin = cbor_begin,
+	.exe = cbor_exe,
+	.cmdline_begin = cbor_cmdline_begin,
+	.cmdline_arg = cbor_cmdline_arg,
+	.cmdline_end = cbor_break,
+	.mappings_begin = cbor_mappings_begin,
+	.mapping = cbor_mapping,
+	.mappings_end = cbor_break,
+	.proc_dump_begin = cbor_proc_dump_begin,
+	.proc_file = cbor_proc_file,
+	.proc_dump_end = cbor_break,
+	.threads_begin = cbor_threads_begin,
+	.thread_begin = cbor_thread_begin,
+	.thread_time = cbor_thread_time,
+	.registers_begin = cbor_registers_begin,
+	.reg = cbor_reg,
+	.registers_end = cbor_break,
+	.stack_ref = cbor_stack_ref,
+	.backtrace_begin = cbor_backtrace_begin,
+	.frame = cbor_frame,
+	.backtrace_end = cbor_break,
+	.thread_end = cbor_break,
+	.threads_end = cbor_break,
+	.stacks_begin = cbor_stacks_begin,
+	.stack_begin = cbor_stack_begin,
+	.stack_end = cbor_break,
+	.stacks_end = cbor_break,
+	.counter = cbor_counter,
+	.signature = cbor_counter,
+	.pair = cbor_pair,
+	.end = cbor_end,
+	.log = cbor_log,
+};
+
+/** Read the head of the next item, the content of strings of known length
+ *  is skipped and pointed to by the item.
+ *  @return 0 on success, -1 if the buffer is malformed */
+int cbor_read(struct cbor_reader_s *r, struct cbor_item_s *item)
+{
+	unsigned ai, len, i;
+	uint64_t arg;
+
+	if (r->error || r->p >= r->end) {
+		goto err;
+	}
+
+	item->major = *r->p >> 5;
+	item->data = NULL;
+	item->is_real = 0;
+	ai = *r->p++ & 0x1f;
+
+	if (ai < CBOR_AI_1) {
+		arg = ai;
+	} else if (ai <= CBOR_AI_8) {
+		len = 1 << (ai - CBOR_AI_1);
+		if (r->end - r->p < len) {
+			goto err;
+		}
+		for (arg = 0, i = 0; i < len; i++) {
+			arg = arg << 8 | *r->p++;
+		}
+	} else if (ai == CBOR_AI_INDEFINITE && item->major >= CBOR_BYTES
+	           && item->major <= CBOR_MAP) {
+		arg = CBOR_INDEFINITE;
+	} else {
+		goto err;
+	}
+	item->arg = arg;
+
+	if (item->major == CBOR_SIMPLE && ai > CBOR_AI_1) {
+		item->is_real = 1;
+		if (ai == CBOR_AI_8) {
+			memcpy(&item->real, &arg, sizeof item->real);
+		} else if (ai == CBOR_AI_8 - 1) {
+			float f;
+			uint32_t bits = arg;
+			memcpy(&f, &bits, sizeof f);
+			item->real = f;
+		} else {
+			unsigned exp = arg >> 10 & 0x1f, mant = arg & 0x3ff;
+			item->real = exp == 0 ? ldexp(mant, -24) : exp != 31
+					? ldexp(mant + 1024, exp - 25) : mant ? NAN : INFINITY;
+			if (arg & 0x8000) {
+				item->real = -item->real;
+			}
+		}
+	}
+
+	if ((item->major == CBOR_BYTES || item->major == CBOR_TEXT) && arg != CBOR_INDEFINITE) {
+		if (r->end - r->p < arg) {
+			goto err;
+		}
+		item->data = (const char *)r->p;
+		r->p += arg;
+	}
+
+	return 0;
+
+err:	r->error = 1;
+	return -1;
+}
+
+/** Advance to the next item of a container.
+ *  @param[in,out] left - number of items left or CBOR_INDEFINITE, the break
+ *                        code is consumed at the end of indefinite containers
+ *  @return 1 if there is the next item, 0 at the end or on error */
+int cbor_next(struct cbor_reader_s *r, uint64_t *left)
+{
+	if (r->error) {
+		return 0;
+	}
+
+	if (*left == CBOR_INDEFINITE) {
+		if (r->p >= r->end) {
+			r->error = 1;
+			return 0;
+		}
+		if (*r->p == CBOR_BREAK) {
+			r->p++;
+			return 0;
+		}
+		return 1;
+	}
+
+	if (*left == 0) {
+		return 0;
+	}
+	(*left)--;
+	return 1;
+}
+
+/** Skip the content of an item, its head is already read.
+ *  @return 0 on success, -1 if the buffer is malformed */
+int cbor_skip(struct cbor_reader_s *r, const struct cbor_item_s *item)
+{
+	struct cbor_item_s nested;
+	uint64_t left = item->arg;
+
+	if (++r->depth > CBOR_MAX_DEPTH) {
+		r->error = 1;
+	}
+
+	switch (item->major) {
+		case CBOR_MAP:
+			if (left != CBOR_INDEFINITE) {
+				left = left > UINT64_MAX / 2 ? UINT64_MAX - 1 : left * 2;
+			}
+			// Fall through
+		case CBOR_ARRAY:
+			while (cbor_next(r, &left) && !cbor_read(r, &nested)
+			       && !cbor_skip(r, &nested));
+			break;
+		case CBOR_BYTES:
+		case CBOR_TEXT:
+			while (left == CBOR_INDEFINITE && cbor_next(r, &left)) {
+				if (cbor_read(r, &nested) || nested.major != item->major
+				    || !nested.data) {
+					r->error = 1;
+				}
+			}
+			break;
+		case CBOR_TAG:
+			if (!cbor_read(r, &nested)) {
+				cbor_skip(r, &nested);
+			}
+			break;
+		default:
+			break;
+	}
+
+	r->depth--;
+	return r->error ? -1 : 0;
+}
+
+/** Copy a text string, its head is already read.
+ *  @return The NUL terminated string or NULL if the item isn't a string or
+ *          on error, must be freed by the caller */
+char *cbor_text(struct cbor_reader_s *r, const struct cbor_item_s *item)
+{
+	struct cbor_item_s chunk;
+	uint64_t left = CBOR_INDEFINITE;
+	char *s = NULL, *tmp;
+	size_t len = 0;
+
+	if (item->major != CBOR_TEXT) {
+		cbor_skip(r, item);
+		return NULL;
+	}
+
+	if (item->arg != CBOR_INDEFINITE) {
+		s = malloc(item->arg + 1);
+		if (s) {
+			memcpy(s, item->data, item->arg);
+			s[item->arg] = 0;
+		}
+		return s;
+	}
+
+	while (cbor_next(r, &left)) {
+		if (cbor_read(r, &chunk) || chunk.major != CBOR_TEXT || !chunk.data) {
+			r->error = 1;
+			break;
+		}
+		tmp = realloc(s, len + chunk.arg + 1);
+		if (!tmp) {
+			r->error = 1;
+			break;
+		}
+		s = tmp;
+		memcpy(s + len, chunk.data, chunk.arg);
+		len += chunk.arg;
+		s[len] = 0;
+	}
+
+	if (r->error) {
+		free(s);
+		return NULL;
+	}
+
+	return s ?: calloc(1, 1);
+}
@@ -0,0 +1,82 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifndef CBOR_H
+#define CBOR_H
+
+#include <stdint.h>
+
+/** Major types of CBOR data items (RFC 8949). */
+enum cbor_major_e {
+	CBOR_UINT = 0,
+	CBOR_NINT,
+	CBOR_BYTES,
+	CBOR_TEXT,
+	CBOR_ARRAY,
+	CBOR_MAP,
+	CBOR_TAG,
+	CBOR_SIMPLE,
+};
+
+/** Simple values. */
+#define CBOR_FALSE 20
+#define CBOR_TRUE 21
+#define CBOR_NULL 22
+
+/** Argument of indefinite length items. */
+#define CBOR_INDEFINITE UINT64_MAX
+
+/** Tag of the date/time string. */
+#define CBOR_TAG_DATETIME 0
+/** Tag of self-described CBOR, the info stream starts with it. */
+#define CBOR_TAG_SELF 55799
+
+/** Reader of an encoded buffer. */
+struct cbor_reader_s {
+	const unsigned char *p, *end;
+	/** Nesting of skipped items. */
+	int depth;
+	/** The buffer is malformed or truncated. */
+	int error;
+};
+
+/** Head of a data item. */
+struct cbor_item_s {
+	enum cbor_major_e major;
+	/** Value, length, tag or simple value, CBOR_INDEFINITE if the length
+	 *  of a string or a container isn't known. */
+	uint64_t arg;
+	/** Content of a string of known length. */
+	const char *data;
+	/** Value of a float, it's major type is CBOR_SIMPLE. */
+	double real;
+	int is_real;
+};
+
+int cbor_read(struct cbor_reader_s *r, struct cbor_item_s *item);
+
+int cbor_next(struct cbor_reader_s *r, uint64_t *left);
+
+int cbor_skip(struct cbor_reader_s *r, const struct cbor_item_s *item);
+
+char *cbor_text(struct cbor_reader_s *r, const struct cbor_item_s *item);
+
+#endif // CBOR_H
@@ -0,0 +1,738 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <stdio.h>
+
+#ifdef CRASHINFO_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef CRASHINFO_WITH_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "compress.h"
+#include "util.h"
+#include "conf.h"
+#include "log.h"
+
+/** Maximum input passed to the compressor at once. */
+#define COMPRESS_CHUNK (64*1024)
+
+/** State of a chunk compressed by the pool. */
+enum compress_chunk_e {
+	/** Chunk can be filled by the producer. */
+	CHUNK_FREE = 0,
+	/** Chunk is being filled by the producer. */
+	CHUNK_FILLING,
+	/** Chunk is waiting for a worker. */
+	CHUNK_READY,
+	/** Chunk is being compressed. */
+	CHUNK_BUSY,
+	/** Chunk is waiting for the writer. */
+	CHUNK_DONE,
+};
+
+/** Chunk of the stream compressed by the pool into a separate frame. */
+struct compress_chunk_s {
+	/** Uncompressed data. */
+	char *in;
+	/** Number of bytes in the in buffer. */
+	size_t in_len;
+	/** Compressed frame. */
+	char *out;
+	/** Size of the compressed frame or 0 if the compression failed. */
+	size_t out_len;
+	/** Chunk state. */
+	enum compress_chunk_e state;
+};
+
+/** Pool of threads compressing chunks in parallel. Chunk with sequence
+ *  number N is stored in chunks[N % chunk_count], so the number of chunks
+ *  bounds the memory usage and frames are written in the stream order. */
+struct compress_pool_s {
+	/** Protects all members, except chunk buffers owned by a thread. */
+	pthread_mutex_t lock;
+	/** Signaled whenever a chunk changes its state. */
+	pthread_cond_t cond;
+	/** Ring of chunks. */
+	struct compress_chunk_s *chunks;
+	/** Number of chunks in the ring. */
+	int chunk_count;
+	/** Size of the chunk input buffer. */
+	size_t chunk_size;
+	/** Size of the chunk output buffer. */
+	size_t out_size;
+	/** Sequence number of the chunk being filled. */
+	unsigned long fill;
+	/** Sequence number of the next chunk to compress. */
+	unsigned long compress;
+	/** Sequence number of the next chunk to write. */
+	unsigned long write;
+	/** No more chunks will be filled. */
+	bool eof;
+	/** A chunk is missing or writing failed, the stream is truncated. */
+	bool error;
+	/** Number of worker threads. */
+	int thread_count;
+	/** Worker threads. */
+	pthread_t *threads;
+	/** Thread writing compressed frames. */
+	pthread_t writer;
+};
+
+/** Streaming compressor state. */
+struct compress_s {
+	/** Compression algorithm. */
+	enum conf_compress_e type;
+	/** Compression level. */
+	int level;
+	/** Compressed data are written here. */
+	int fd;
+	/** Parallel compressor or NULL. */
+	struct compress_pool_s *pool;
+	/** Compressed data buffer. */
+	char *out;
+	/** Size of the compressed data buffer. */
+	size_t out_size;
+#ifdef CRASHINFO_WITH_ZSTD
+	ZSTD_CCtx *zstd;
+#endif
+#ifdef CRASHINFO_WITH_LZ4
+	LZ4F_cctx *lz4;
+	LZ4F_preferences_t lz4_prefs;
+#endif
+};
+
+#if defined(CRASHINFO_WITH_ZSTD) || defined(CRASHINFO_WITH_LZ4)
+/** Write compressed data to the output.
+ *  @return 0 on success. */
+static int flush_out(struct compress_s *z, size_t len)
+{
+	if (len && safe_write(z->fd, z->out, len) != len) {
+		log_err("Can't write compressed stream: %s", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+#endif
+
+#ifdef CRASHINFO_WITH_ZSTD
+static int zstd_open(struct compress_s *z, int level)
+{
+	size_t rtn;
+
+	z->zstd = ZSTD_createCCtx();
+	if (!z->zstd) {
+		log_err("Can't create zstd context");
+		return -1;
+	}
+
+	rtn = ZSTD_CCtx_setParameter(z->zstd, ZSTD_c_compressionLevel, level);
+	if (!ZSTD_isError(rtn)) {
+		rtn = ZSTD_CCtx_setParameter(z->zstd, ZSTD_c_checksumFlag, 1);
+	}
+	if (ZSTD_isError(rtn)) {
+		log_err("Can't configure zstd: %s", ZSTD_getErrorName(rtn));
+		ZSTD_freeCCtx(z->zstd);
+		return -1;
+	}
+
+	z->out_size = ZSTD_CStreamOutSize();
+	return 0;
+}
+
+/** Pass data to zstd, with ZSTD_e_end finishes the frame. */
+static ssize_t zstd_write(struct compress_s *z, const void *buf, size_t count,
+		ZSTD_EndDirective mode)
+{
+	ZSTD_inBuffer in = { buf, count, 0 };
+	size_t remaining;
+
+	do {
+		ZSTD_outBuffer out = { z->out, z->out_size, 0 };
+
+		remaining = ZSTD_compressStream2(z->zstd, &out, &in, mode);
+		if (ZSTD_isError(remaining)) {
+			log_err("Compression failed: %s", ZSTD_getErrorName(remaining));
+			return -1;
+		}
+		if (flush_out(z, out.pos)) {
+			return -1;
+		}
+	} while (mode == ZSTD_e_end ? remaining : in.pos < in.size);
+
+	return count;
+}
+#endif // CRASHINFO_WITH_ZSTD
+
+#ifdef CRASHINFO_WITH_LZ4
+static int lz4_open(struct compress_s *z, int level)
+{
+	LZ4F_errorCode_t err;
+	size_t rtn;
+
+	err = LZ4F_createCompressionContext(&z->lz4, LZ4F_VERSION);
+	if (LZ4F_isError(err)) {
+		log_err("Can't create lz4 context: %s", LZ4F_getErrorName(err));
+		return -1;
+	}
+
+	memset(&z->lz4_prefs, 0, sizeof z->lz4_prefs);
+	z->lz4_prefs.compressionLevel = level;
+	z->lz4_prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+	z->out_size = LZ4F_compressBound(COMPRESS_CHUNK, &z->lz4_prefs);
+	if (z->out_size < LZ4F_HEADER_SIZE_MAX) {
+		z->out_size = LZ4F_HEADER_SIZE_MAX;
+	}
+
+	z->out = malloc(z->out_size);
+	if (!z->out) {
+		log_err("Can't allocate compression buffer");
+		LZ4F_freeCompressionContext(z->lz4);
+		return -1;
+	}
+
+	rtn = LZ4F_compressBegin(z->lz4, z->out, z->out_size, &z->lz4_prefs);
+	if (LZ4F_isError(rtn) || flush_out(z, rtn)) {
+		log_err("Can't start lz4 frame");
+		LZ4F_freeCompressionContext(z->lz4);
+		return -1;
+	}
+
+	return 0;
+}
+
+static ssize_t lz4_write(struct compress_s *z, const void *buf, size_t count)
+{
+	const char *p = buf, *end = p + count;
+	size_t len, rtn;
+
+	for (; p < end; p += len) {
+		len = end - p < COMPRESS_CHUNK ? end - p : COMPRESS_CHUNK;
+		rtn = LZ4F_compressUpdate(z->lz4, z->out, z->out_size, p, len, NULL);
+		if (LZ4F_isError(rtn)) {
+			log_err("Compression failed: %s", LZ4F_getErrorName(rtn));
+			return -1;
+		}
+		if (flush_out(z, rtn)) {
+			return -1;
+		}
+	}
+
+	return count;
+}
+#endif // CRASHINFO_WITH_LZ4
+
+/** Compress a chunk into a separate frame.
+ *  @param[in] z - the compressor
+ *  @param[in/out] ctx - thread private compression context
+ *  @param[in/out] chunk - the chunk
+ *  @return 0 on success. */
+static int compress_chunk(struct compress_s *z, void **ctx,
+		struct compress_chunk_s *chunk)
+{
+#if defined(CRASHINFO_WITH_ZSTD) || defined(CRASHINFO_WITH_LZ4)
+	size_t rtn;
+#endif
+
+	switch (z->type) {
+#ifdef CRASHINFO_WITH_ZSTD
+		case CONF_COMPRESS_ZSTD:
+			if (!*ctx) {
+				*ctx = ZSTD_createCCtx();
+				if (!*ctx) {
+					log_err("Can't create zstd context");
+					return -1;
+				}
+				ZSTD_CCtx_setParameter(*ctx, ZSTD_c_compressionLevel, z->level);
+				ZSTD_CCtx_setParameter(*ctx, ZSTD_c_checksumFlag, 1);
+			}
+			rtn = ZSTD_compress2(*ctx, chunk->out, z->pool->out_size,
+					chunk->in, chunk->in_len);
+			if (ZSTD_isError(rtn)) {
+				log_err("Compression failed: %s", ZSTD_getErrorName(rtn));
+				return -1;
+			}
+			chunk->out_len = rtn;
+			return 0;
+#endif
+#ifdef CRASHINFO_WITH_LZ4
+		case CONF_COMPRESS_LZ4:
+			rtn = LZ4F_compressFrame(chunk->out, z->pool->out_size,
+					chunk->in, chunk->in_len, &z->lz4_prefs);
+			if (LZ4F_isError(rtn)) {
+				log_err("Compression failed: %s", LZ4F_getErrorName(rtn));
+				return -1;
+			}
+			chunk->out_len = rtn;
+			return 0;
+#endif
+		default:
+			return -1;
+	}
+}
+
+/** Free a thread private compression context. */
+static void compress_chunk_free(struct compress_s *z, void *ctx)
+{
+#ifdef CRASHINFO_WITH_ZSTD
+	if (z->type == CONF_COMPRESS_ZSTD) {
+		ZSTD_freeCCtx(ctx);
+	}
+#endif
+}
+
+/** Pool worker, compresses chunks in any order. */
+static void *pool_worker(void *arg)
+{
+	struct compress_s *z = arg;
+	struct compress_pool_s *pool = z->pool;
+	struct compress_chunk_s *chunk;
+	void *ctx = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (pool->compress == pool->fill && !pool->eof) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		}
+		if (pool->compress == pool->fill) {
+			break;
+		}
+
+		chunk = &pool->chunks[pool->compress++ % pool->chunk_count];
+		chunk->state = CHUNK_BUSY;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (compress_chunk(z, &ctx, chunk)) {
+			chunk->out_len = 0;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		chunk->state = CHUNK_DONE;
+		pthread_cond_broadcast(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	compress_chunk_free(z, ctx);
+	return NULL;
+}
+
+/** Pool writer, writes compressed frames in the stream order. */
+static void *pool_writer(void *arg)
+{
+	struct compress_s *z = arg;
+	struct compress_pool_s *pool = z->pool;
+	struct compress_chunk_s *chunk;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		chunk = &pool->chunks[pool->write % pool->chunk_count];
+		while (pool->write != pool->fill && chunk->state != CHUNK_DONE) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		}
+		if (pool->write == pool->fill) {
+			if (pool->eof) {
+				break;
+			}
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		if (!chunk->out_len) {
+			log_err("Chunk %lu is missing in the compressed stream", pool->write);
+			pool->error = true;
+		} else if (safe_write(z->fd, chunk->out, chunk->out_len) != chunk->out_len) {
+			log_err("Can't write compressed stream: %s", strerror(errno));
+			pool->error = true;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		chunk->state = CHUNK_FREE;
+		pool->write++;
+		pthread_cond_broadcast(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/** Parse CPU list in the form used by cpuset(7), e.g. 0-3,8.
+ *  @return Number of CPUs stored in cpus or -1 on error. */
+static int parse_cpus(const char *list, int *cpus, int max)
+{
+	int count = 0, first, last;
+	char *end;
+
+	while (*list) {
+		first = last = strtol(list, &end, 10);
+		if (end == list) {
+			return -1;
+		}
+		if (*end == '-') {
+			list = end + 1;
+			last = strtol(list, &end, 10);
+			if (end == list || last < first) {
+				return -1;
+			}
+		}
+		for (; first <= last && count < max; first++) {
+			cpus[count++] = first;
+		}
+		list = *end == ',' ? end + 1 : end;
+		if (*end && *end != ',') {
+			return -1;
+		}
+	}
+
+	return count;
+}
+
+/** Terminate and free the pool. Pending chunks are compressed and written.
+ *  @return 0 on success, -1 if the stream is truncated. */
+static int pool_close(struct compress_s *z)
+{
+	struct compress_pool_s *pool = z->pool;
+	int i, rtn;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->chunks[pool->fill % pool->chunk_count].state == CHUNK_FILLING) {
+		pool->chunks[pool->fill++ % pool->chunk_count].state = CHUNK_READY;
+	}
+	pool->eof = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->thread_count; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	pthread_join(pool->writer, NULL);
+	rtn = pool->error ? -1 : 0;
+
+	for (i = 0; i < pool->chunk_count; i++) {
+		free(pool->chunks[i].in);
+		free(pool->chunks[i].out);
+	}
+	free(pool->chunks);
+	free(pool->threads);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+	z->pool = NULL;
+
+	return rtn;
+}
+
+/** Start the parallel compressor.
+ *  @return 0 on success. */
+static int pool_open(struct compress_s *z, const struct conf_compress_s *c)
+{
+	struct compress_pool_s *pool;
+	int i, err, cpu_count = 0;
+	int cpus[CPU_SETSIZE];
+
+	if (c->cpus) {
+		cpu_count = parse_cpus(c->cpus, cpus, ARRAY_SIZE(cpus));
+		if (cpu_count <= 0) {
+			log_err("Invalid CPU list '%s'", c->cpus);
+			cpu_count = 0;
+		}
+	}
+
+	pool = z->pool = calloc(1, sizeof *pool);
+	if (!pool) {
+		log_err("Can't allocate compression pool");
+		return -1;
+	}
+
+	pool->thread_count = c->threads > 0 ? c->threads : sysconf(_SC_NPROCESSORS_ONLN);
+	if (pool->thread_count <= 0) {
+		pool->thread_count = 1;
+	}
+	pool->chunk_count = c->chunks > 0 ? c->chunks : 2 * pool->thread_count;
+	pool->chunk_size = c->chunk_size > 0 ? c->chunk_size : 4*1024*1024;
+
+	switch (z->type) {
+#ifdef CRASHINFO_WITH_ZSTD
+		case CONF_COMPRESS_ZSTD:
+			pool->out_size = ZSTD_compressBound(pool->chunk_size);
+			break;
+#endif
+#ifdef CRASHINFO_WITH_LZ4
+		case CONF_COMPRESS_LZ4:
+			memset(&z->lz4_prefs, 0, sizeof z->lz4_prefs);
+			z->lz4_prefs.compressionLevel = z->level;
+			z->lz4_prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+			pool->out_size = LZ4F_compressFrameBound(pool->chunk_size, &z->lz4_prefs);
+			break;
+#endif
+		default:
+			log_err("Compression %d is not supported", z->type);
+			free(pool);
+			z->pool = NULL;
+			return -1;
+	}
+
+	pool->chunks = calloc(pool->chunk_count, sizeof *pool->chunks);
+	pool->threads = calloc(pool->thread_count, sizeof *pool->threads);
+	if (!pool->chunks || !pool->threads) {
+		log_err("Can't allocate compression pool");
+		goto err0;
+	}
+
+	for (i = 0; i < pool->chunk_count; i++) {
+		pool->chunks[i].in = malloc(pool->chunk_size);
+		pool->chunks[i].out = malloc(pool->out_size);
+		if (!pool->chunks[i].in || !pool->chunks[i].out) {
+			log_err("Can't allocate %d compression chunks", pool->chunk_count);
+			goto err1;
+		}
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	err = pthread_create(&pool->writer, NULL, pool_writer, z);
+	if (err) {
+		log_err("Failed to create compression writer: %s", strerror(err));
+		goto err2;
+	}
+
+	for (i = 0; i < pool->thread_count; i++) {
+		pthread_attr_t attr;
+
+		// Threads are bound before they start, so they don't run elsewhere
+		pthread_attr_init(&attr);
+		if (cpu_count) {
+			cpu_set_t set;
+
+			CPU_ZERO(&set);
+			CPU_SET(cpus[i % cpu_count], &set);
+			pthread_attr_setaffinity_np(&attr, sizeof set, &set);
+		}
+		err = pthread_create(&pool->threads[i], &attr, pool_worker, z);
+		pthread_attr_destroy(&attr);
+		if (err && cpu_count) {
+			log_warn("Can't bind compression thread to CPU %d: %s",
+					cpus[i % cpu_count], strerror(err));
+			err = pthread_create(&pool->threads[i], NULL, pool_worker, z);
+		}
+		if (err) {
+			log_warn("Failed to create compression thread: %s", strerror(err));
+			break;
+		}
+	}
+	pool->thread_count = i;
+
+	if (i == 0) {
+		pool_close(z);
+		return -1;
+	}
+
+	log_dbg("Compressing by %d threads, %d chunks of %zu bytes",
+			pool->thread_count, pool->chunk_count, pool->chunk_size);
+	return 0;
+
+err2:	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+err1:	for (i = 0; i < pool->chunk_count; i++) {
+		free(pool->chunks[i].in);
+		free(pool->chunks[i].out);
+	}
+err0:	free(pool->chunks);
+	free(pool->threads);
+	free(pool);
+	z->pool = NULL;
+	return -1;
+}
+
+/** Pass data to the parallel compressor.
+ *  @return Number of consumed bytes. */
+static ssize_t pool_write(struct compress_s *z, const void *buf, size_t count)
+{
+	struct compress_pool_s *pool = z->pool;
+	const char *p = buf, *end = p + count;
+	struct compress_chunk_s *chunk;
+	size_t len;
+
+	pthread_mutex_lock(&pool->lock);
+	while (p < end) {
+		chunk = &pool->chunks[pool->fill % pool->chunk_count];
+		while (chunk->state != CHUNK_FREE && chunk->state != CHUNK_FILLING) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		}
+		if (chunk->state == CHUNK_FREE) {
+			chunk->state = CHUNK_FILLING;
+			chunk->in_len = 0;
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		len = pool->chunk_size - chunk->in_len;
+		if (len > end - p) {
+			len = end - p;
+		}
+		memcpy(chunk->in + chunk->in_len, p, len);
+		chunk->in_len += len;
+		p += len;
+
+		pthread_mutex_lock(&pool->lock);
+		if (chunk->in_len == pool->chunk_size) {
+			chunk->state = CHUNK_READY;
+			pool->fill++;
+			pthread_cond_broadcast(&pool->cond);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return count;
+}
+
+/** Create a streaming compressor.
+ *  @param[in] c - compression configuration
+ *  @param[in] fd - compressed data are written to this file descriptor
+ *  @return The compressor or NULL on error. */
+struct compress_s *compress_open(const struct conf_compress_s *c, int fd)
+{
+	struct compress_s *z;
+	int rtn = -1;
+
+	z = calloc(1, sizeof *z);
+	if (!z) {
+		log_err("Can't allocate compressor: %s", strerror(errno));
+		return NULL;
+	}
+	z->type = c->type;
+	z->level = c->level;
+	z->fd = fd;
+
+	if (c->threads) {
+		if (pool_open(z, c) == 0) {
+			return z;
+		}
+		log_warn("Parallel compression is not available");
+	}
+
+	switch (c->type) {
+#ifdef CRASHINFO_WITH_ZSTD
+		case CONF_COMPRESS_ZSTD:
+			rtn = zstd_open(z, c->level);
+			break;
+#endif
+#ifdef CRASHINFO_WITH_LZ4
+		case CONF_COMPRESS_LZ4:
+			rtn = lz4_open(z, c->level);
+			break;
+#endif
+		default:
+			log_err("Compression %d is not supported", c->type);
+			break;
+	}
+
+	if (rtn == 0 && !z->out) {
+		z->out = malloc(z->out_size);
+		if (!z->out) {
+			log_err("Can't allocate compression buffer");
+			compress_close(z);
+			return NULL;
+		}
+	}
+
+	if (rtn) {
+		free(z->out);
+		free(z);
+		return NULL;
+	}
+
+	return z;
+}
+
+/** Compress data and write them to the output.
+ *  @return Number of consumed bytes or -1 on error. */
+ssize_t compress_write(struct compress_s *z, const void *buf, size_t count)
+{
+	if (z->pool) {
+		return pool_write(z, buf, count);
+	}
+
+	switch (z->type) {
+#ifdef CRASHINFO_WITH_ZSTD
+		case CONF_COMPRESS_ZSTD:
+			return zstd_write(z, buf, count, ZSTD_e_continue);
+#endif
+#ifdef CRASHINFO_WITH_LZ4
+		case CONF_COMPRESS_LZ4:
+			return lz4_write(z, buf, count);
+#endif
+		default:
+			return -1;
+	}
+}
+
+/** Finish the compressed stream and free the compressor. The output file
+ *  descriptor is not closed.
+ *  @return 0 on success. */
+int compress_close(struct compress_s *z)
+{
+	int rtn = -1;
+
+	if (z->pool) {
+		rtn = pool_close(z);
+		free(z);
+		return rtn;
+	}
+
+	switch (z->type) {
+#ifdef CRASHINFO_WITH_ZSTD
+		case CONF_COMPRESS_ZSTD:
+			rtn = z->out ? zstd_write(z, NULL, 0, ZSTD_e_end) : -1;
+			ZSTD_freeCCtx(z->zstd);
+			break;
+#endif
+#ifdef CRASHINFO_WITH_LZ4
+		case CONF_COMPRESS_LZ4: {
+			size_t len = LZ4F_compressEnd(z->lz4, z->out, z->out_size, NULL);
+			if (LZ4F_isError(len)) {
+				log_err("Compression failed: %s", LZ4F_getErrorName(len));
+			} else {
+				rtn = flush_out(z, len);
+			}
+			LZ4F_freeCompressionContext(z->lz4);
+			break;
+		}
+#endif
+		default:
+			break;
+	}
+
+	free(z->out);
+	free(z);
+
+	return rtn < 0 ? -1 : 0;
+}
@@ -42,9 +42,24 @@ struct conf_s conf = {
 	},
 	.core = {
 		.exists = CONF_EXISTS_KEEP,
+		.compress = {
+			.chunk_size = 4 * 1024 * 1024,
+		},
 	},
 	.core_buffer_size = 4 * 1024 * 1024,
+	.core_stack_window = 256 * 1024,
+	.core_splice = 1,
+	.core_pipe_size = 1024 * 1024,
+	.core_spill_size = -1,
 	.backtrace_max_depth = 50,
+	.cache = {
+		.size = 64 * 1024 * 1024,
+	},
+	.storm = {
+		.frames = 8,
+		.burst = 10,
+		.interval = 60,
+	},
 	.log = {
 		.syslog = -1,
 		.info = LOG_NOTICE,
@@ -59,6 +74,7 @@ struct conf_s conf = {
 /** Running data. */
 struct run_s run = {
 	.pid = -1,
+	.pidfd = -1,
 };
 
 struct parse_keywords_s;
@@ -99,6 +115,40 @@ static const struct parse_enum_s parse_enum_exists[] = {
 	{}
 };
 
+/** conf_info_format_e enum values. */
+static const struct parse_enum_s parse_enum_info_format[] = {
+	{ "yaml", CONF_INFO_FORMAT_YAML },
+	{ "cbor", CONF_INFO_FORMAT_CBOR },
+	{}
+};
+
+/** conf_symbolize_e enum values. */
+static const struct parse_enum_s parse_enum_symbolize[] = {
+	{ "live", CONF_SYMBOLIZE_LIVE },
+	{ "deferred", CONF_SYMBOLIZE_DEFERRED },
+	{}
+};
+
+/** conf_mappings_source_e enum values. */
+static const struct parse_enum_s parse_enum_mappings_source[] = {
+	{ "auto", CONF_MAPPINGS_SOURCE_AUTO },
+	{ "core", CONF_MAPPINGS_SOURCE_CORE },
+	{ "proc", CONF_MAPPINGS_SOURCE_PROC },
+	{}
+};
+
+/** conf_compress_e enum values, only compiled in algorithms are listed. */
+static const struct parse_enum_s parse_enum_compress[] = {
+	{ "none", CONF_COMPRESS_NONE },
+#ifdef CRASHINFO_WITH_ZSTD
+	{ "zstd", CONF_COMPRESS_ZSTD },
+#endif
+#ifdef CRASHINFO_WITH_LZ4
+	{ "lz4", CONF_COMPRESS_LZ4 },
+#endif
+	{}
+};
+
 /** Log level enum values. */
 static const struct parse_enum_s parse_enum_loglevel[] = {
 	{ "none", -1 },
@@ -254,40 +304,129 @@ static int parse_int(const struct parse_keywords_s *keyword, char *value)
 	return parse_endline();
 }
 
+/** Parse a long long integer option, used for sizes which may exceed 2 GB.
+ *  @param[in] keyword - keyword specification.
+ *  @param[in/out] value - string containing the integer value. The content of
+ *                         it is undefined after the return.
+ *  @return 0 on success. */
+static int parse_llong(const struct parse_keywords_s *keyword, char *value)
+{
+	long long *num = keyword->storage;
+	long long llong_value;
+	char *end;
+
+	value = strtok(value, delim);
+	llong_value = strtoll(value, &end, 0);
+	if (*end != '\0') {
+		log_crit("Keyword '%s' requires integer value. Got '%s'",
+				keyword->keyword, value);
+		return -1;
+	}
+
+	*num = llong_value;
+	return parse_endline();
+}
+
+/** Parse a compression option.
+ *  @param[in] keyword - keyword specification
+ *  @param[in] value - <algorithm>[:<level>] value
+ *  @return 0 on success. */
+static int parse_compress(const struct parse_keywords_s *keyword, char *value)
+{
+	struct conf_compress_s *compress = keyword->storage;
+	struct parse_keywords_s algorithm = *keyword;
+	char *level, *end;
+	long level_value = 0;
+
+	if (!strcmp("~", value)) {
+		compress->type = CONF_COMPRESS_NONE;
+		compress->level = 0;
+		return 0;
+	}
+
+	level = strchr(value, ':');
+	if (level) {
+		*level++ = 0;
+		level_value = strtol(level, &end, 0);
+		if (*end != '\0' || end == level) {
+			log_crit("Keyword '%s' requires the argument in the form "
+					"<algorithm>[:<level>]. Got level '%s'",
+					keyword->keyword, level);
+			return -1;
+		}
+	}
+
+	algorithm.storage = &compress->type;
+	algorithm.parser_arg = parse_enum_compress;
+	if (parse_enum(&algorithm, value)) {
+		return -1;
+	}
+
+	compress->level = (int)level_value;
+	return 0;
+}
+
+/** Append a mapping to proc_maps.
+ *  @param[in] addr - start of the mapping
+ *  @param[in] end - end of the mapping or 0 if it isn't known
+ *  @param[in] file - mapped image, not necessarily NUL terminated
+ *  @param[in] len - length of the file name
+ *  @return The mapping or NULL if it can't be allocated */
+struct conf_multi_mapping_s *conf_mapping_add(uint64_t addr, uint64_t end,
+		const char *file, size_t len)
+{
+	// The tail is remembered, so adding many mappings isn't quadratic
+	static struct conf_multi_mapping_s **tail;
+	struct conf_multi_mapping_s *map;
+
+	map = malloc(len + sizeof *map + 1);
+	if (!map) {
+		return NULL;
+	}
+
+	map->next = NULL;
+	memcpy(map->file, file, len);
+	map->file[len] = 0;
+	map->addr = addr;
+	map->end = end;
+
+	// Keep order for dumping
+	if (!tail || !conf.proc.maps) {
+		tail = &conf.proc.maps;
+	}
+	while (*tail) {
+		tail = &(*tail)->next;
+	}
+	*tail = map;
+	tail = &map->next;
+
+	return map;
+}
+
 /** Parse a mapping option.
  *  @param[in] keyword - keyword specification
- *  @param[in] value - <addr>:<path> value
+ *  @param[in] value - <addr>[-<end>]:<path> value
  *  @return 0 on success. */
 static int parse_mapping_multi(const struct parse_keywords_s *keyword, char *value)
 {
-	struct conf_multi_mapping_s *multi_map, **iter;
-	uint64_t addr;
+	uint64_t addr, end_addr = 0;
 	char *end;
-	int len;
 
-	addr = strtoll(value, &end, 0);
+	addr = strtoull(value, &end, 0);
+	if (*end == '-') {
+		end_addr = strtoull(end + 1, &end, 0);
+	}
 	if (*end != ':') {
 		log_crit("Keyword '%s' requires the argument in the form "
-				"<addr>:<path>. Got '%s'", keyword->keyword, value);
+				"<addr>[-<end>]:<path>. Got '%s'", keyword->keyword, value);
 		return -1;
 	}
 
-	len = strlen_chomp(end + 1);
-	multi_map = malloc(len + sizeof *multi_map + 1);
-	if (!multi_map) {
+	if (!conf_mapping_add(addr, end_addr, end + 1, strlen_chomp(end + 1))) {
 		log_crit("Allocation failed while processing '%s'", keyword->keyword);
 		return -1;
 	}
 
-	multi_map->next = NULL;
-	strncpy(multi_map->file, end + 1, len);
-	multi_map->file[len] = 0;
-	multi_map->addr = addr;
-
-	// Keep order for dumping
-	for (iter = keyword->storage; *iter; iter = &(*iter)->next);
-	*iter = multi_map;
-
 	return 0;
 }
 
@@ -300,8 +439,25 @@ static const struct parse_keywords_s keywords[] = {
 	{ "info_mkdir",  &conf.info.mkdir,  parse_enum, parse_enum_bool },
 	{ "info_notify", &conf.info.notify, parse_string_multi, NULL, 1 },
 	{ "info_output", &conf.info.output, parse_string },
+	{ "info_compress", &conf.info.compress, parse_compress },
+	{ "info_format", &conf.info_format, parse_enum, parse_enum_info_format },
 
 	{ "backtrace_max_depth", &conf.backtrace_max_depth, parse_int },
+	{ "backtrace_group", &conf.backtrace_group, parse_enum, parse_enum_bool },
+	{ "backtrace_group_registers", &conf.backtrace_group_registers, parse_enum, parse_enum_bool },
+	{ "unwind_threads", &conf.unwind_threads, parse_int },
+	{ "symbolize", &conf.symbolize, parse_enum, parse_enum_symbolize },
+	{ "symbolize_demangle", &conf.symbolize_demangle, parse_enum, parse_enum_bool },
+	{ "debug_dir", &conf.debug_dir, parse_string },
+	{ "storm_table", &conf.storm.table, parse_string },
+	{ "storm_frames", &conf.storm.frames, parse_int },
+	{ "storm_burst", &conf.storm.burst, parse_int },
+	{ "storm_interval", &conf.storm.interval, parse_int },
+	{ "reprocess_jobs", &conf.reprocess_jobs, parse_int },
+	{ "daemon_socket", &conf.daemon_socket, parse_string },
+	{ "cache_path", &conf.cache.path, parse_string },
+	{ "cache_size", &conf.cache.size, parse_llong },
+	{ "cache_max_age", &conf.cache.max_age, parse_int },
 	
 	// Core stream options
 	{ "core_exists",     &conf.core.exists, parse_enum, parse_enum_exists },
@@ -311,6 +467,16 @@ static const struct parse_keywords_s keywords[] = {
 	{ "core_notify",     &conf.core.notify, parse_string_multi, NULL, 1 },
 	{ "core_output",     &conf.core.output, parse_string },
 	{ "core_buffer_size",&conf.core_buffer_size, parse_int },
+	{ "core_stack_window", &conf.core_stack_window, parse_int },
+	{ "core_compress",   &conf.core.compress, parse_compress },
+	{ "core_compress_threads", &conf.core.compress.threads, parse_int },
+	{ "core_compress_chunk_size", &conf.core.compress.chunk_size, parse_int },
+	{ "core_compress_chunks", &conf.core.compress.chunks, parse_int },
+	{ "core_compress_cpus", &conf.core.compress.cpus, parse_string },
+	{ "core_sparse",     &conf.core.sparse, parse_enum, parse_enum_bool },
+	{ "core_splice",     &conf.core_splice, parse_enum, parse_enum_bool },
+	{ "core_pipe_size",  &conf.core_pipe_size, parse_int },
+	{ "core_spill_size", &conf.core_spill_size, parse_int },
 
 	{ "info_core_notify",&conf.info_core_notify, parse_string_multi, NULL, 1 },
 
@@ -327,6 +493,8 @@ static const struct parse_keywords_s keywords[] = {
 	{ "proc_path", &conf.proc.path, parse_string },
 	{ "proc_exe", &conf.proc.exe, parse_string },
 	{ "proc_maps", &conf.proc.maps, parse_mapping_multi, NULL, 1 },
+	{ "proc_threads", &conf.proc.threads, parse_int },
+	{ "mappings_source", &conf.proc.mappings_source, parse_enum, parse_enum_mappings_source },
 
 	// /proc dumping options
 	{ "proc_dump_root", &conf.proc_dump.root, parse_string_multi, NULL, 1 },
@@ -449,6 +617,27 @@ static void log_int(const struct parse_keywords_s *keyword)
 	log_dbg("%s = %d", keyword->keyword, *(int*)keyword->storage);
 }
 
+static void log_llong(const struct parse_keywords_s *keyword)
+{
+	log_dbg("%s = %lld", keyword->keyword, *(long long*)keyword->storage);
+}
+
+static void log_compress(const struct parse_keywords_s *keyword)
+{
+	const struct conf_compress_s *compress = keyword->storage;
+	const struct parse_enum_s *parse_enum;
+
+	for (parse_enum = parse_enum_compress; parse_enum->name; parse_enum++) {
+		if (parse_enum->value == compress->type) {
+			log_dbg("%s = %s:%d", keyword->keyword, parse_enum->name,
+					compress->level);
+			return;
+		}
+	}
+
+	log_dbg("%s = UNKNOWN_VALUE_%d", keyword->keyword, compress->type);
+}
+
 static void log_mapping_multi(const struct parse_keywords_s *keyword)
 {
 	const struct conf_multi_mapping_s *map = *(struct conf_multi_mapping_s**)keyword->storage;
@@ -456,7 +645,12 @@ static void log_mapping_multi(const struct parse_keywords_s *keyword)
 	if (!map) {
 		log_dbg("%s = ~", keyword->keyword);	
 	} else for (; map; map = map->next) {
-		log_dbg("%s = %#" PRIx64 ":%s", keyword->keyword, map->addr, map->file);
+		if (map->end) {
+			log_dbg("%s = %#" PRIx64 "-%#" PRIx64 ":%s", keyword->keyword,
+					map->addr, map->end, map->file);
+		} else {
+			log_dbg("%s = %#" PRIx64 ":%s", keyword->keyword, map->addr, map->file);
+		}
 	}
 }
 
@@ -468,9 +662,11 @@ void log_conf(void)
 	} dumpers[] = {
 		{ parse_enum, log_enum },
 		{ parse_int, log_int },
+		{ parse_llong, log_llong },
 		{ parse_string, log_string },
 		{ parse_string_multi, log_string_multi },
 		{ parse_mapping_multi, log_mapping_multi },
+		{ parse_compress, log_compress },
 	};
 	int i, j;
 
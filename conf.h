@@ -22,6 +22,7 @@
 #ifndef CONF_H
 #define CONF_H
 
+#include <sys/types.h>
 #include <stdint.h>
 #include <time.h>
 
@@ -38,6 +39,49 @@ enum conf_exists_e {
 	CONF_EXISTS_SEQUENCE,
 };
 
+/** Built-in compression algorithms. */
+enum conf_compress_e {
+	CONF_COMPRESS_NONE = 0,
+	CONF_COMPRESS_ZSTD,
+	CONF_COMPRESS_LZ4,
+};
+
+/** Formats of the info stream. */
+enum conf_info_format_e {
+	CONF_INFO_FORMAT_YAML = 0,
+	CONF_INFO_FORMAT_CBOR,
+};
+
+/** When function names of backtraces are looked up. */
+enum conf_symbolize_e {
+	CONF_SYMBOLIZE_LIVE = 0,
+	CONF_SYMBOLIZE_DEFERRED,
+};
+
+/** Where mappings and the executable of the process are obtained from. */
+enum conf_mappings_source_e {
+	CONF_MAPPINGS_SOURCE_AUTO = 0,
+	CONF_MAPPINGS_SOURCE_CORE,
+	CONF_MAPPINGS_SOURCE_PROC,
+};
+
+/** Built-in compression configuration. */
+struct conf_compress_s {
+	/** Compression algorithm. */
+	enum conf_compress_e type;
+	/** Compression level, 0 selects the algorithm default. */
+	int level;
+	/** Number of compression threads, 0 compresses in the caller, -1
+	 *  starts a thread per CPU. */
+	int threads;
+	/** Size of chunks compressed in parallel. */
+	int chunk_size;
+	/** Maximum number of chunks in memory, 0 for twice the threads. */
+	int chunks;
+	/** CPUs the compression threads are bound to. */
+	const char *cpus;
+};
+
 struct conf_multi_str_s;
 
 /** Represents one string of multi-value string configuration option. */
@@ -56,6 +100,8 @@ struct conf_multi_mapping_s {
 	struct conf_multi_mapping_s *next;
 	/** Mapping address. */
 	uint64_t addr;
+	/** End of the mapping, 0 if it isn't known. */
+	uint64_t end;
 	/** Mapped image. */
 	char file[];
 };
@@ -74,6 +120,10 @@ struct conf_output_s {
 	struct conf_multi_str_s *filter;
 	/** Programs executed after the output is completed. */
 	struct conf_multi_str_s *notify;
+	/** Skip zero pages and preallocate the output. */
+	int sparse;
+	/** Compress the stream before passing it to filters. */
+	struct conf_compress_s compress;
 };
 
 /** Program configuration structure. Populated by command line arguments
@@ -82,16 +132,62 @@ struct conf_output_s {
 struct conf_s {
 	/** Info output. YAML formated process details are send there */
 	struct conf_output_s info;
+	/** Encoding of the info stream. */
+	enum conf_info_format_e info_format;
 	/** Core output. Core is copied here. */
 	struct conf_output_s core;
 	/** Buffer for backwards seeks, unwinder argument. */
 	int core_buffer_size;
+	/** Size of the stack captured above the stack pointer of each thread. */
+	int core_stack_window;
+	/** Move the core using splice() and tee() if stdin is a pipe. */
+	int core_splice;
+	/** Requested size of pipes the core is passing trough. */
+	int core_pipe_size;
+	/** Maximum size of the core buffered for a slow unwinder, -1 unlimited. */
+	int core_spill_size;
 	/** Core file if stdin is not used */
 	const char *core_path;
 	/** Notify with both info and core streams as arguments */
 	struct conf_multi_str_s *info_core_notify;
 	/** Maximum backtrace depth */
 	int backtrace_max_depth;
+	/** Dump each distinct stack once with the list of its threads. */
+	int backtrace_group;
+	/** Dump registers of each thread even if stacks are grouped. */
+	int backtrace_group_registers;
+	/** Number of threads unwinding the core, 0 for each CPU. */
+	int unwind_threads;
+	/** Look up function names while the core is processed or later. */
+	enum conf_symbolize_e symbolize;
+	/** Demangle C++ function names. */
+	int symbolize_demangle;
+	/** Directory with separate debug files or NULL for the default. */
+	const char *debug_dir;
+	/** Socket of the daemon cores are passed to, NULL if it isn't used. */
+	const char *daemon_socket;
+	/** Suppression of cores of repeated crashes. */
+	struct {
+		/** Table of recent crashes or NULL if cores aren't suppressed. */
+		const char *table;
+		/** Number of frames of the crashing thread in the signature. */
+		int frames;
+		/** Number of cores written before they are suppressed. */
+		int burst;
+		/** Seconds after which another core may be written, 0 never. */
+		int interval;
+	} storm;
+	/** Number of cores reprocessed in parallel, 0 for each CPU. */
+	int reprocess_jobs;
+	/** Cache of data derived from images of the crashed process. */
+	struct {
+		/** Cache directory or NULL if the cache is disabled. */
+		const char *path;
+		/** Maximum size of the cache, -1 unlimited. */
+		long long size;
+		/** Files not used for this number of seconds are removed, 0 never. */
+		int max_age;
+	} cache;
 	/** Logging configuration. */
 	struct {
 		/** Log level threshold for info output. */
@@ -111,6 +207,10 @@ struct conf_s {
 		const char *exe;
 		/** Mappings (/proc/<PID>/maps). */
 		struct conf_multi_mapping_s *maps;
+		/** Number of threads reading tasks, 0 for each CPU. */
+		int threads;
+		/** Source of the exe path and mappings. */
+		enum conf_mappings_source_e mappings_source;
 	} proc;
 	/** /proc dumping configuration. */
 	struct {
@@ -136,12 +236,27 @@ struct run_multi_filter_s {
 	int pid;
 };
 
+struct info_out_s;
+
 /** Run time output data. */
 struct run_output_s {
-	FILE *output;
+	/** Writer of the info stream. */
+	struct info_out_s *output;
 	int output_fd;
 	const char *output_filename;
 	struct run_multi_filter_s *filter;
+	/** Zero pages are skipped, output_fd is a seekable file. */
+	int sparse;
+	/** Number of bytes written to the stream. */
+	off_t offset;
+	/** Length of the skipped zero pages not seeked over yet. */
+	off_t hole;
+	/** Number of bytes preallocated for the output. */
+	off_t prealloc;
+	/** Built-in compressor or NULL. */
+	struct compress_s *compress;
+	/** The rest of the stream is discarded and the output is removed. */
+	int suppressed;
 };
 
 /** Runtime structure. Contains global runtime data. */
@@ -152,6 +267,24 @@ struct run_s {
 	int proc_fd;
 	/** PID of the crashed process. */
 	int pid;
+	/** pidfd of the crashed process or -1. */
+	int pidfd;
+	/** Maximum number of bytes read from stdin, but not yet passed to the unwinder. */
+	unsigned long long unwind_lag_peak;
+	/** Unwind tables found in the cache and built. */
+	unsigned long long unwind_cache_hits, unwind_cache_misses;
+	/** Symbol tables found in the cache and built. */
+	unsigned long long symbol_cache_hits, symbol_cache_misses;
+	/** Signature of the crash and its accounting in the storm table. */
+	struct {
+		unsigned long long signature;
+		/** The signature is known, the core is suppressed. */
+		int known, suppressed;
+		/** Cores suppressed since the last written one. */
+		unsigned long long count;
+		/** Error accessing the storm table. */
+		int error;
+	} storm;
 	struct timespec start_tp;
 	struct tm start_tm;
 };
@@ -161,6 +294,9 @@ extern struct run_s run;
 
 int parse_line(char *line);
 
+struct conf_multi_mapping_s *conf_mapping_add(uint64_t addr, uint64_t end,
+		const char *file, size_t len);
+
 int parse_file(const char *path);
 
 #define foreach_safe(first, iter, tmp) for (((iter) = (first)) ? ((tmp) = (iter)->next) : 0 ; (iter) && ((tmp) = (iter)->next, 1); (iter) = (tmp))
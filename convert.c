@@ -0,0 +1,644 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+
+#include "convert.h"
+#include "cbor.h"
+#include "conf.h"
+#include "info.h"
+#include "log.h"
+
+/** Maximum number of thread IDs of a grouped stack. */
+#define CONVERT_MAX_TIDS 65536
+
+/** Read an unsigned integer.
+ *  @return 0 on success, -1 if the item is something else */
+static int read_uint(struct cbor_reader_s *r, uint64_t *value)
+{
+	struct cbor_item_s item;
+
+	if (cbor_read(r, &item)) {
+		return -1;
+	}
+	if (item.major != CBOR_UINT) {
+		cbor_skip(r, &item);
+		return -1;
+	}
+	*value = item.arg;
+	return 0;
+}
+
+/** Read a signed integer.
+ *  @return 0 on success, -1 if the item is something else */
+static int read_int(struct cbor_reader_s *r, int64_t *value)
+{
+	struct cbor_item_s item;
+
+	if (cbor_read(r, &item)) {
+		return -1;
+	}
+	if (item.major != CBOR_UINT && item.major != CBOR_NINT) {
+		cbor_skip(r, &item);
+		return -1;
+	}
+	*value = item.major == CBOR_UINT ? (int64_t)item.arg : -1 - (int64_t)item.arg;
+	return 0;
+}
+
+/** Read a string, the caller frees it.
+ *  @return The string or NULL if the item is something else */
+static char *read_text(struct cbor_reader_s *r)
+{
+	struct cbor_item_s item;
+
+	if (cbor_read(r, &item)) {
+		return NULL;
+	}
+	return cbor_text(r, &item);
+}
+
+/** Read a time in seconds. */
+static int read_time(struct cbor_reader_s *r, struct timeval *tv)
+{
+	struct cbor_item_s item;
+	long long usec;
+
+	if (cbor_read(r, &item)) {
+		return -1;
+	}
+	if (item.major == CBOR_SIMPLE && item.is_real) {
+		usec = llround(item.real * 1e6);
+	} else if (item.major == CBOR_UINT) {
+		usec = item.arg * 1000000;
+	} else {
+		cbor_skip(r, &item);
+		return -1;
+	}
+
+	tv->tv_sec = usec / 1000000;
+	tv->tv_usec = usec % 1000000;
+	return 0;
+}
+
+/** Read the head of a map or an array, null is an empty section.
+ *  @return 1 if the container starts, 0 for null, -1 for something else */
+static int read_container(struct cbor_reader_s *r, enum cbor_major_e major, uint64_t *left)
+{
+	struct cbor_item_s item;
+
+	if (cbor_read(r, &item)) {
+		return -1;
+	}
+	if (item.major == CBOR_SIMPLE && item.arg == CBOR_NULL) {
+		return 0;
+	}
+	if (item.major != major) {
+		cbor_skip(r, &item);
+		return -1;
+	}
+	*left = item.arg;
+	return 1;
+}
+
+/** Skip a value of an unknown key. */
+static void skip(struct cbor_reader_s *r)
+{
+	struct cbor_item_s item;
+
+	if (!cbor_read(r, &item)) {
+		cbor_skip(r, &item);
+	}
+}
+
+/** Names which aren't plain identifiers are quoted. */
+static int needs_quote(const char *name)
+{
+	for (; *name; name++) {
+		if (!isalnum((unsigned char)*name) && !strchr("_.$@", *name)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void convert_frame(struct cbor_reader_s *r, int depth, struct info_out_s *out)
+{
+	struct info_frame_s f = { .module = -1, .exception = -1, .signal = -1 };
+	uint64_t left, value;
+	int64_t signed_value;
+	char *key, *name = NULL, *file = NULL;
+	int exception = 0;
+
+	if (read_container(r, CBOR_MAP, &left) <= 0) {
+		return;
+	}
+
+	while (cbor_next(r, &left) && (key = read_text(r))) {
+		if (!strcmp(key, "a")) {
+			f.ip_known = !read_uint(r, &value);
+			f.ip = f.ip_known ? value : 0;
+		} else if (!strcmp(key, "m") && !read_int(r, &signed_value)) {
+			f.module = signed_value;
+		} else if (!strcmp(key, "s")) {
+			name = read_text(r);
+		} else if (!strcmp(key, "o") && !read_uint(r, &value)) {
+			f.off = value;
+		} else if (!strcmp(key, "l") && !read_uint(r, &value)) {
+			f.len = value;
+		} else if (!strcmp(key, "e") && !read_int(r, &signed_value)) {
+			f.exception = signed_value;
+			exception = 1;
+		} else if (!strcmp(key, "S") && !read_int(r, &signed_value)) {
+			f.signal = signed_value;
+		} else if (!strcmp(key, "f")) {
+			file = read_text(r);
+		} else if (key[0] && !key[1] && strchr("amolesS", key[0])) {
+			// Mistyped value, it's already skipped
+		} else {
+			skip(r);
+		}
+		free(key);
+	}
+
+	// Frames written for deferred symbolization have no exception flag
+	f.deferred = !exception;
+	f.name = name;
+	f.quote = name && needs_quote(name);
+	f.file = file;
+	info_yaml.frame(out, depth, &f);
+
+	free(name);
+	free(file);
+}
+
+static void convert_backtrace(struct cbor_reader_s *r, struct info_out_s *out)
+{
+	uint64_t left;
+	int depth;
+
+	if (read_container(r, CBOR_ARRAY, &left) <= 0) {
+		return;
+	}
+
+	info_yaml.backtrace_begin(out);
+	for (depth = 0; cbor_next(r, &left); depth++) {
+		convert_frame(r, depth, out);
+	}
+	info_yaml.backtrace_end(out);
+}
+
+static void convert_proc_dump(struct cbor_reader_s *r, int indent, struct info_out_s *out)
+{
+	struct cbor_item_s item;
+	uint64_t left;
+	char *name, *content;
+	int rtn;
+
+	rtn = read_container(r, CBOR_MAP, &left);
+	if (rtn <= 0) {
+		if (!rtn) {
+			info_yaml.proc_dump_begin(out, indent, "");
+		}
+		return;
+	}
+
+	info_yaml.proc_dump_begin(out, indent, NULL);
+	while (cbor_next(r, &left) && (name = read_text(r))) {
+		if (cbor_read(r, &item)) {
+			free(name);
+			break;
+		}
+		if (item.major == CBOR_TEXT && item.arg != CBOR_INDEFINITE) {
+			info_yaml.proc_file(out, indent, name, item.data, item.arg, 0);
+		} else {
+			// Content of older streams is chunked by lines
+			content = cbor_text(r, &item);
+			if (content) {
+				info_yaml.proc_file(out, indent, name, content,
+						strlen(content), 0);
+			}
+			free(content);
+		}
+		free(name);
+	}
+	info_yaml.proc_dump_end(out);
+}
+
+static void convert_registers(struct cbor_reader_s *r, struct info_out_s *out)
+{
+	uint64_t left, value;
+	int i;
+
+	if (read_container(r, CBOR_ARRAY, &left) <= 0) {
+		return;
+	}
+
+	info_yaml.registers_begin(out);
+	for (i = 0; cbor_next(r, &left); i++) {
+		if (!read_uint(r, &value)) {
+			info_yaml.reg(out, i, value);
+		}
+	}
+	info_yaml.registers_end(out);
+}
+
+static void convert_thread(struct cbor_reader_s *r, struct info_out_s *out)
+{
+	struct timeval tv;
+	uint64_t left, value;
+	int64_t tid;
+	char *key;
+
+	if (read_container(r, CBOR_MAP, &left) <= 0) {
+		return;
+	}
+
+	while (cbor_next(r, &left) && (key = read_text(r))) {
+		if (!strcmp(key, "tid")) {
+			if (!read_int(r, &tid)) {
+				info_yaml.thread_begin(out, tid);
+			}
+		} else if (!strcmp(key, "proc_dump")) {
+			convert_proc_dump(r, 4, out);
+		} else if (!strcmp(key, "user_time") || !strcmp(key, "system_time")) {
+			if (!read_time(r, &tv)) {
+				info_yaml.thread_time(out, key, &tv);
+			}
+		} else if (!strcmp(key, "registers")) {
+			convert_registers(r, out);
+		} else if (!strcmp(key, "stack")) {
+			if (!read_uint(r, &value)) {
+				info_yaml.stack_ref(out, value);
+			}
+		} else if (!strcmp(key, "backtrace")) {
+			convert_backtrace(r, out);
+		} else {
+			skip(r);
+		}
+		free(key);
+	}
+	info_yaml.thread_end(out);
+}
+
+static void convert_threads(struct cbor_reader_s *r, struct info_out_s *out)
+{
+	uint64_t left;
+	int rtn;
+
+	rtn = read_container(r, CBOR_ARRAY, &left);
+	if (rtn <= 0) {
+		if (!rtn) {
+			info_yaml.threads_begin(out, "");
+		}
+		return;
+	}
+
+	info_yaml.threads_begin(out, NULL);
+	while (cbor_next(r, &left)) {
+		convert_thread(r, out);
+	}
+	info_yaml.threads_end(out);
+}
+
+static void convert_stack(struct cbor_reader_s *r, struct info_out_s *out)
+{
+	uint64_t left, tids_left, id = 0;
+	int *tids = NULL, count = 0, begun = 0;
+	int64_t tid;
+	char *key;
+
+	if (read_container(r, CBOR_MAP, &left) <= 0) {
+		return;
+	}
+
+	while (cbor_next(r, &left) && (key = read_text(r))) {
+		if (!strcmp(key, "id")) {
+			read_uint(r, &id);
+		} else if (!strcmp(key, "tids")) {
+			if (read_container(r, CBOR_ARRAY, &tids_left) > 0) {
+				while (cbor_next(r, &tids_left)) {
+					if (read_int(r, &tid) || count >= CONVERT_MAX_TIDS) {
+						continue;
+					}
+					if (!(count & (count - 1))) {
+						int *tmp = realloc(tids, (count ? count * 2 : 1) * sizeof *tids);
+						if (!tmp) {
+							continue;
+						}
+						tids = tmp;
+					}
+					tids[count++] = tid;
+				}
+			}
+		} else if (!strcmp(key, "backtrace")) {
+			if (!begun++) {
+				info_yaml.stack_begin(out, id, tids, count);
+			}
+			convert_backtrace(r, out);
+		} else {
+			skip(r);
+		}
+		free(key);
+	}
+
+	if (!begun) {
+		info_yaml.stack_begin(out, id, tids, count);
+	}
+	info_yaml.stack_end(out);
+	free(tids);
+}
+
+static void convert_stacks(struct cbor_reader_s *r, struct info_out_s *out)
+{
+	uint64_t left;
+
+	if (read_container(r, CBOR_ARRAY, &left) <= 0) {
+		return;
+	}
+
+	info_yaml.stacks_begin(out);
+	while (cbor_next(r, &left)) {
+		convert_stack(r, out);
+	}
+	info_yaml.stacks_end(out);
+}
+
+static void convert_mappings(struct cbor_reader_s *r, struct info_out_s *out)
+{
+	struct cbor_item_s item;
+	uint64_t left, entry_left, addr;
+	char *key, *file, *build_id;
+	int rtn;
+
+	rtn = read_container(r, CBOR_MAP, &left);
+	if (rtn <= 0) {
+		if (!rtn) {
+			info_yaml.mappings_begin(out, 0);
+		}
+		return;
+	}
+
+	info_yaml.mappings_begin(out, 1);
+	while (cbor_next(r, &left) && !read_uint(r, &addr) && !cbor_read(r, &item)) {
+		if (item.major == CBOR_TEXT) {
+			file = cbor_text(r, &item);
+			if (file) {
+				info_yaml.mapping(out, addr, file, NULL);
+			}
+			free(file);
+			continue;
+		} else if (item.major != CBOR_MAP) {
+			cbor_skip(r, &item);
+			continue;
+		}
+
+		file = build_id = NULL;
+		entry_left = item.arg;
+		while (cbor_next(r, &entry_left) && (key = read_text(r))) {
+			if (!strcmp(key, "f")) {
+				file = read_text(r);
+			} else if (!strcmp(key, "b")) {
+				build_id = read_text(r);
+			} else {
+				skip(r);
+			}
+			free(key);
+		}
+		if (file) {
+			info_yaml.mapping(out, addr, file, build_id ?: "");
+		}
+		free(file);
+		free(build_id);
+	}
+	info_yaml.mappings_end(out);
+}
+
+static void convert_pair(struct cbor_reader_s *r, const char *key, struct info_out_s *out)
+{
+	uint64_t left, value[2] = { 0, 0 };
+	char *name[2] = { NULL, NULL };
+	int i;
+
+	if (read_container(r, CBOR_MAP, &left) <= 0) {
+		return;
+	}
+
+	for (i = 0; cbor_next(r, &left); i++) {
+		char *tmp = read_text(r);
+		if (i < 2) {
+			name[i] = tmp;
+			read_uint(r, &value[i]);
+		} else {
+			free(tmp);
+			skip(r);
+		}
+	}
+
+	if (name[0] && name[1]) {
+		info_yaml.pair(out, key, name[0], value[0], name[1], value[1]);
+	}
+	free(name[0]);
+	free(name[1]);
+}
+
+static void convert_log(struct info_out_s *out, const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	info_yaml.log(out, "", format, ap);
+	va_end(ap);
+}
+
+/** Convert one document of the info stream.
+ *  @return 0 on success, -1 if the document is malformed */
+static int convert_document(struct cbor_reader_s *r, struct info_out_s *out)
+{
+	struct cbor_item_s item;
+	struct timeval tv;
+	uint64_t left, value;
+	char *key, *text;
+	int i;
+
+	if (cbor_read(r, &item)) {
+		return -1;
+	}
+	if (item.major == CBOR_TAG && item.arg == CBOR_TAG_SELF && cbor_read(r, &item)) {
+		return -1;
+	}
+	if (item.major != CBOR_MAP) {
+		return -1;
+	}
+
+	left = item.arg;
+	while (cbor_next(r, &left) && (key = read_text(r))) {
+		if (!strcmp(key, "datetime")) {
+			text = NULL;
+			if (!cbor_read(r, &item) && (item.major != CBOR_TAG || !cbor_read(r, &item))) {
+				text = cbor_text(r, &item);
+			}
+			info_yaml.begin(out, text ?: "~");
+			free(text);
+		} else if (!strcmp(key, "exe")) {
+			text = read_text(r);
+			info_yaml.exe(out, text);
+			free(text);
+		} else if (!strcmp(key, "cmdline")) {
+			info_yaml.cmdline_begin(out);
+			if (read_container(r, CBOR_ARRAY, &value) > 0) {
+				for (i = 0; cbor_next(r, &value); i++) {
+					text = read_text(r);
+					info_yaml.cmdline_arg(out, i, text ?: "");
+					free(text);
+				}
+			}
+			info_yaml.cmdline_end(out);
+		} else if (!strcmp(key, "executable_mappings")) {
+			convert_mappings(r, out);
+		} else if (!strcmp(key, "proc_dump")) {
+			convert_proc_dump(r, 0, out);
+		} else if (!strcmp(key, "threads")) {
+			convert_threads(r, out);
+		} else if (!strcmp(key, "stacks")) {
+			convert_stacks(r, out);
+		} else if (!strcmp(key, "crash_signature")) {
+			if (!read_uint(r, &value)) {
+				info_yaml.signature(out, key, value);
+			}
+		} else if (!strcmp(key, "crash_storm") || !strcmp(key, "unwind_cache")
+		           || !strcmp(key, "symbol_cache")) {
+			convert_pair(r, key, out);
+		} else if (!strcmp(key, "processing_time")) {
+			if (!read_time(r, &tv)) {
+				info_yaml.end(out, &tv);
+			}
+		} else if (!strcmp(key, "log")) {
+			if (read_container(r, CBOR_ARRAY, &value) > 0) {
+				while (cbor_next(r, &value)) {
+					text = read_text(r);
+					if (text) {
+						convert_log(out, "%s", text);
+					}
+					free(text);
+				}
+			}
+		} else if (!cbor_read(r, &item)) {
+			// Counters, e.g. unwinder_lag_peak
+			if (item.major == CBOR_UINT) {
+				info_yaml.counter(out, key, item.arg);
+			} else {
+				cbor_skip(r, &item);
+			}
+		}
+		free(key);
+	}
+
+	return r->error ? -1 : 0;
+}
+
+/** Convert a CBOR info stream file to YAML.
+ *  @return 0 on success, -1 on error */
+static int convert_file(const char *path, struct info_out_s *out)
+{
+	struct cbor_reader_s r = {};
+	struct stat st;
+	void *data;
+	int fd, rtn = 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		log_err("Can't open '%s': %s", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		log_err("Can't stat '%s': %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		log_err("Can't map '%s': %s", path, strerror(errno));
+		return -1;
+	}
+
+	// Appended streams are a sequence of documents
+	r.p = data;
+	r.end = r.p + st.st_size;
+	while (r.p < r.end) {
+		if (convert_document(&r, out)) {
+			log_err("Malformed CBOR info stream '%s' at offset %ld", path,
+					(long)(r.p - (const unsigned char *)data));
+			rtn = -1;
+			break;
+		}
+	}
+
+	munmap(data, st.st_size);
+	return rtn;
+}
+
+/** Convert info streams written in the CBOR format to YAML, which is written
+ *  to the standard output.
+ *  @param[in] count - number of files
+ *  @param[in] paths - the files
+ *  @return 0 on success, -1 if any of files can't be converted */
+int convert_yaml(int count, char *paths[])
+{
+	struct run_output_s stream = { .output_fd = STDOUT_FILENO };
+	struct info_out_s *out;
+	int i, rtn = 0;
+
+	out = info_out_open(&stream);
+	if (!out) {
+		log_err("Can't allocate memory for the output");
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (convert_file(paths[i], out)) {
+			rtn = -1;
+		}
+	}
+
+	if (info_out_close(out)) {
+		log_err("Can't write the output: %s", strerror(errno));
+		rtn = -1;
+	}
+
+	return rtn;
+}
@@ -0,0 +1,665 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#define _GNU_SOURCE
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include <linux/fs.h>
+
+#include "capture.h"
+#include "evloop.h"
+#include "stream.h"
+#include "copy.h"
+#include "conf.h"
+#include "log.h"
+
+/** Size of the ring buffer between stdin and the consumers of the core. */
+#define COPY_RING_SIZE (1024*1024)
+
+/** Consumer of the core. */
+struct copy_sink_s {
+	/** Watch of the consumer descriptor. */
+	struct evloop_watch_s watch;
+	/** Core output or NULL if data are written to fd. */
+	struct run_output_s *output;
+	/** Unwinder pipe. */
+	int fd;
+	/** The consumer accepts data. */
+	bool open;
+	/** Stream offset of the next byte the consumer needs. */
+	unsigned long long pos;
+};
+
+/** Core copying state. */
+struct copy_s {
+	struct evloop_s *loop;
+	/** Watch of stdin. */
+	struct evloop_watch_s input;
+	/** Core output and unwinder pipe. */
+	struct copy_sink_s core, info;
+	/** Ring buffer, data between the slowest consumer and rd are valid. */
+	char *ring;
+	size_t size;
+	/** Number of bytes read from stdin. */
+	unsigned long long rd;
+	/** Number of bytes moved by splice(). */
+	unsigned long long spliced;
+	/** Bytes already teed to the unwinder, but not yet spliced. */
+	size_t pending;
+	/** Memfd holding the core the unwinder didn't get yet and which was
+	 *  dropped from the ring, -1 if it wasn't needed yet. */
+	int spill_fd;
+	/** Stream offsets of the beginning and the end of the spilled data. */
+	unsigned long long spill_base, spill_end;
+	/** Total number of spilled bytes and the peak unwinder lag. */
+	unsigned long long spilled, lag;
+	/** Regions of the core captured for the unwinder or NULL. */
+	struct capture_s *capture;
+	/** Splice may be used, data are being spliced, stdin reached EOF. */
+	bool splice_ok, splice, eof;
+	/** Start of the copying and the time stdin reached EOF. */
+	struct timespec start, end;
+	/** Name of the in-kernel file copying method or NULL if not used. */
+	const char *file_mode;
+};
+
+/** Enlarge the pipe buffer, so a single splice() or tee() moves more data */
+static void grow_pipe(int fd)
+{
+	struct stat st;
+
+	if (conf.core_pipe_size <= 0 || fstat(fd, &st) || !S_ISFIFO(st.st_mode)) {
+		return;
+	}
+
+	if (fcntl(fd, F_SETPIPE_SZ, conf.core_pipe_size) < 0) {
+		log_dbg("Can't resize pipe %d to %d bytes: %s",
+				fd, conf.core_pipe_size, strerror(errno));
+	}
+}
+
+/** Return the oldest stream offset the consumer still needs from the ring. */
+static unsigned long long sink_pos(const struct copy_s *c, const struct copy_sink_s *s)
+{
+	unsigned long long pos = s->pos;
+
+	if (s == &c->info && pos < c->spill_end) {
+		pos = c->spill_end;
+	}
+
+	return s->open && pos < c->rd ? pos : c->rd;
+}
+
+/** Return number of bytes in the ring still needed by a consumer. */
+static size_t ring_used(const struct copy_s *c)
+{
+	unsigned long long core = sink_pos(c, &c->core), info = sink_pos(c, &c->info);
+
+	return c->rd - (core < info ? core : info);
+}
+
+/** Stop feeding the consumer. */
+static void sink_close(struct copy_s *c, struct copy_sink_s *s, int err)
+{
+	if (s == &c->info) {
+		log_warn("Unwinder stopped reading the core");
+	} else {
+		log_warn("Can't write the core: %s", strerror(err));
+	}
+
+	evloop_del(c->loop, &s->watch);
+	s->open = false;
+}
+
+/** Move data, which are needed only by the unwinder, from the full ring to
+ *  the spill memfd, so reading of stdin can continue.
+ *  @return Number of bytes released from the ring */
+static size_t copy_spill(struct copy_s *c)
+{
+	unsigned long long from = sink_pos(c, &c->info), to = sink_pos(c, &c->core);
+	size_t off, len;
+	ssize_t rtn;
+
+	if (!c->info.open || from >= to || !conf.core_spill_size) {
+		return 0;
+	}
+
+	if (c->spill_fd < 0) {
+		c->spill_fd = memfd_create("crashinfo-unwind", MFD_CLOEXEC);
+		if (c->spill_fd < 0) {
+			log_warn("Can't create spill memfd, the unwinder slows down"
+					" the core copying: %s", strerror(errno));
+			conf.core_spill_size = 0;
+			return 0;
+		}
+	}
+
+	if (c->spill_end == c->spill_base) {
+		c->spill_base = c->spill_end = from;
+	}
+
+	if (conf.core_spill_size > 0 && to - c->spill_base > conf.core_spill_size) {
+		to = c->spill_base + conf.core_spill_size;
+		if (from >= to) {
+			return 0;
+		}
+	}
+
+	while (from < to) {
+		off = from % c->size;
+		len = to - from;
+		if (len > c->size - off) {
+			len = c->size - off;
+		}
+
+		rtn = pwrite(c->spill_fd, c->ring + off, len, from - c->spill_base);
+		if (rtn < 0 && errno == EINTR) {
+			continue;
+		} else if (rtn <= 0) {
+			log_warn("Can't spill the core for the unwinder: %s",
+					rtn < 0 ? strerror(errno) : "No space");
+			conf.core_spill_size = 0;
+			break;
+		}
+		from += rtn;
+	}
+
+	len = from - c->spill_end;
+	c->spill_end = from;
+	c->spilled += len;
+
+	return len;
+}
+
+/** Pass spilled data to the unwinder, release the memfd when it's empty.
+ *  @return 0 if all spilled data were passed */
+static int spill_flush(struct copy_s *c, struct copy_sink_s *s)
+{
+	off_t off;
+	ssize_t rtn;
+
+	while (s->pos < c->spill_end) {
+		off = s->pos - c->spill_base;
+		rtn = sendfile(s->fd, c->spill_fd, &off, c->spill_end - s->pos);
+		if (rtn > 0) {
+			s->pos += rtn;
+		} else if (rtn < 0 && errno == EINTR) {
+			continue;
+		} else if (rtn < 0 && errno == EAGAIN) {
+			evloop_set(c->loop, &s->watch, EPOLLOUT);
+			return -1;
+		} else {
+			sink_close(c, s, rtn < 0 ? errno : EPIPE);
+			return -1;
+		}
+	}
+
+	if (c->spill_end != c->spill_base) {
+		c->spill_base = c->spill_end;
+		if (ftruncate(c->spill_fd, 0)) {
+			log_dbg("Can't release spilled data: %s", strerror(errno));
+		}
+	}
+
+	return 0;
+}
+
+/** Write data from the ring to the consumer until it would block. */
+static void sink_flush(struct copy_s *c, struct copy_sink_s *s)
+{
+	size_t off, len;
+	ssize_t rtn;
+
+	if (!s->open || s->watch.cb == NULL) {
+		return;
+	} else if (s == &c->info && spill_flush(c, s)) {
+		return;
+	}
+
+	while (s->pos < c->rd) {
+		off = s->pos % c->size;
+		len = c->rd - s->pos;
+		if (len > c->size - off) {
+			len = c->size - off;
+		}
+
+		if (s->output) {
+			rtn = stream_write(s->output, c->ring + off, len);
+		} else {
+			rtn = write(s->fd, c->ring + off, len);
+		}
+
+		if (rtn > 0) {
+			s->pos += rtn;
+		} else if (rtn < 0 && errno == EINTR) {
+			continue;
+		} else if (rtn < 0 && errno == EAGAIN) {
+			evloop_set(c->loop, &s->watch, EPOLLOUT);
+			return;
+		} else {
+			sink_close(c, s, rtn < 0 ? errno : EPIPE);
+			return;
+		}
+	}
+
+	evloop_set(c->loop, &s->watch, 0);
+}
+
+/** Check the copying progress, enable stdin if there is a free space in the
+ *  ring and stop the loop when everything was copied. */
+static void copy_update(struct copy_s *c)
+{
+	if (c->info.open && c->info.pos < c->rd && c->rd - c->info.pos > c->lag) {
+		c->lag = c->rd - c->info.pos;
+		__atomic_store_n(&run.unwind_lag_peak, c->lag, __ATOMIC_RELAXED);
+	}
+
+	if (!c->core.output) {
+		// Only the unwinder is fed before copy_start()
+		return;
+	} else if (!c->eof) {
+		if (c->splice_ok && !c->splice && !ring_used(c)
+		    && (!c->info.open || c->info.pos == c->rd)
+		    && (!c->capture || capture_skip(c->capture, c->rd))) {
+			log_dbg("Splicing the core from offset %llu", c->rd);
+			c->splice = true;
+		}
+		if (c->splice) {
+			if (!c->core.watch.events) {
+				evloop_set(c->loop, &c->input, EPOLLIN);
+			}
+		} else {
+			if (ring_used(c) == c->size) {
+				copy_spill(c);
+			}
+			evloop_set(c->loop, &c->input, ring_used(c) < c->size ? EPOLLIN : 0);
+		}
+		return;
+	}
+
+	if (!c->end.tv_sec && !c->end.tv_nsec) {
+		clock_gettime(CLOCK_MONOTONIC, &c->end);
+		if (c->capture) {
+			capture_finish(c->capture);
+		}
+	}
+
+	if ((c->core.open && c->core.pos < c->rd) || (c->info.open && c->info.pos < c->rd)) {
+		return;
+	}
+
+	evloop_del(c->loop, &c->input);
+	evloop_del(c->loop, &c->core.watch);
+	evloop_del(c->loop, &c->info.watch);
+	evloop_stop(c->loop);
+}
+
+/** Stop splicing, data already teed to the unwinder are skipped for it. */
+static void copy_unsplice(struct copy_s *c, const char *why)
+{
+	log_dbg("Can't splice the core: %s, reading it at offset %llu", why, c->rd);
+	c->splice_ok = c->splice = false;
+	c->pending = 0;
+	evloop_set(c->loop, &c->core.watch, 0);
+	copy_update(c);
+}
+
+static void copy_read(struct copy_s *c);
+
+/** Move the core from stdin to the core output and duplicate it to the
+ *  unwinder pipe without copying it to the user space. If the unwinder doesn't
+ *  keep up, the core is copied through the ring buffer until it catches up. */
+static void copy_splice(struct copy_s *c)
+{
+	size_t len = conf.core_pipe_size > 0 ? conf.core_pipe_size : 64*1024;
+	unsigned long long skip;
+	ssize_t rtn;
+
+	if (!c->core.open) {
+		copy_unsplice(c, "core output closed");
+		return;
+	} else if (__atomic_load_n(&c->core.output->suppressed, __ATOMIC_RELAXED)) {
+		copy_unsplice(c, "core output suppressed");
+		return;
+	}
+
+	// Captured regions must pass trough the ring
+	if (c->capture && !c->pending) {
+		skip = capture_skip(c->capture, c->rd);
+		if (!skip) {
+			c->splice = false;
+			copy_read(c);
+			return;
+		} else if (skip < len) {
+			len = skip;
+		}
+	}
+
+	if (!c->pending && c->info.open) {
+		rtn = tee(0, c->info.fd, len, SPLICE_F_NONBLOCK);
+		if (rtn < 0) {
+			if (errno == EINTR) {
+				return;
+			} else if (errno == EPIPE) {
+				sink_close(c, &c->info, errno);
+				return;
+			} else if (errno == EAGAIN) {
+				// The unwinder pipe is full, copy_update() splices
+				// again once the unwinder drains the ring
+				log_dbg("Unwinder is busy, reading the core at offset %llu", c->rd);
+				c->splice = false;
+				copy_read(c);
+				return;
+			}
+			copy_unsplice(c, strerror(errno));
+			return;
+		} else if (rtn == 0) {
+			c->eof = true;
+			copy_update(c);
+			return;
+		}
+		c->pending = rtn;
+		c->info.pos += rtn;
+	}
+
+	rtn = splice(0, NULL, c->core.output->output_fd, NULL, c->pending ?: len,
+			SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+	if (rtn < 0) {
+		if (errno == EINTR) {
+			return;
+		} else if (errno == EAGAIN) {
+			// Wait until the core output accepts more data
+			if (!c->core.watch.always) {
+				evloop_set(c->loop, &c->input, 0);
+				evloop_set(c->loop, &c->core.watch, EPOLLOUT);
+			}
+			return;
+		}
+		copy_unsplice(c, strerror(errno));
+		return;
+	} else if (rtn == 0) {
+		c->eof = true;
+		copy_update(c);
+		return;
+	}
+
+	c->rd += rtn;
+	c->core.pos += rtn;
+	c->core.output->offset += rtn;
+	c->spliced += rtn;
+	c->pending -= c->pending ? rtn : 0;
+}
+
+/** Read the core from stdin to the ring and pass it to consumers. */
+static void copy_read(struct copy_s *c)
+{
+	size_t used = ring_used(c), off = c->rd % c->size, len;
+	ssize_t rtn;
+
+	len = c->size - used;
+	if (len > c->size - off) {
+		len = c->size - off;
+	}
+
+	if (len) {
+		rtn = read(0, c->ring + off, len);
+		if (rtn > 0) {
+			if (c->capture) {
+				capture_data(c->capture, c->rd, c->ring + off, rtn);
+			}
+			c->rd += rtn;
+		} else if (rtn == 0) {
+			c->eof = true;
+		} else if (errno != EINTR && errno != EAGAIN) {
+			log_crit("Can't read the core: %s", strerror(errno));
+			c->eof = true;
+		}
+	}
+
+	sink_flush(c, &c->core);
+	sink_flush(c, &c->info);
+	copy_update(c);
+}
+
+/** Stdin is readable. */
+static void input_cb(struct evloop_s *loop, struct evloop_watch_s *w, unsigned events)
+{
+	struct copy_s *c = w->arg;
+
+	if (c->splice) {
+		copy_splice(c);
+	} else {
+		copy_read(c);
+	}
+}
+
+/** Consumer accepts more data. */
+static void sink_cb(struct evloop_s *loop, struct evloop_watch_s *w, unsigned events)
+{
+	struct copy_s *c = w->arg;
+	struct copy_sink_s *s = w == &c->core.watch ? &c->core : &c->info;
+
+	if (c->splice && s == &c->core) {
+		evloop_set(loop, w, 0);
+	} else {
+		sink_flush(c, s);
+	}
+	copy_update(c);
+}
+
+/** Create the copying state. The head of the core, which was already read,
+ *  is kept until both consumers get it.
+ *  @param[in] loop - event loop running the copying
+ *  @param[in] head - beginning of the core
+ *  @param[in] len - length of the head
+ *  @return The state or NULL on error */
+struct copy_s *copy_open(struct evloop_s *loop, const void *head, size_t len)
+{
+	struct copy_s *c;
+
+	c = calloc(1, sizeof *c);
+	if (!c) {
+		goto err0;
+	}
+
+	c->size = len > COPY_RING_SIZE ? len : COPY_RING_SIZE;
+	c->ring = malloc(c->size);
+	if (!c->ring) {
+		goto err1;
+	}
+
+	memcpy(c->ring, head, len);
+	c->rd = len;
+	c->loop = loop;
+	c->core.open = true;
+	c->info.fd = -1;
+	c->spill_fd = -1;
+
+	return c;
+
+err1:	free(c);
+err0:	log_crit("Can't allocate memory for the core copying");
+	return NULL;
+}
+
+/** Start feeding the unwinder pipe. The pipe must be in the non-blocking mode.
+ *  @return 0 on success */
+int copy_feed(struct copy_s *c, int infofd)
+{
+	if (evloop_add(c->loop, &c->info.watch, infofd, 0, sink_cb, c)) {
+		return -1;
+	}
+
+	c->info.fd = infofd;
+	c->info.open = true;
+	sink_flush(c, &c->info);
+
+	return 0;
+}
+
+/** Capture core regions needed by the unwinder while copying. Must be called
+ *  before copy_start().
+ *  @param[in] cap - planned regions */
+void copy_capture(struct copy_s *c, struct capture_s *cap)
+{
+	c->capture = cap;
+	capture_data(cap, 0, c->ring, c->rd);
+}
+
+/**
+ * Copy a core file to an empty regular file output inside the kernel. The
+ * whole file is reflinked if the file system supports it, otherwise it's
+ * copied by copy_file_range(), which may still share extents or offload
+ * the copy to the storage. The head already read to the ring is copied
+ * again, as both descriptors are accessed by offsets.
+ * @return 0 if the core was copied, -1 if the ring must be used for the rest
+ */
+static int copy_file(struct copy_s *c, struct run_output_s *core)
+{
+	loff_t in = 0, out = 0;
+	struct stat ist, ost;
+	ssize_t rtn;
+
+	if (fstat(0, &ist) || !S_ISREG(ist.st_mode) || c->info.open || c->capture
+	    || core->filter || core->sparse || core->compress
+	    || (fcntl(core->output_fd, F_GETFL) & O_APPEND)
+	    || fstat(core->output_fd, &ost) || !S_ISREG(ost.st_mode) || ost.st_size
+	    || lseek(core->output_fd, 0, SEEK_CUR)) {
+		return -1;
+	}
+
+	if (!ioctl(core->output_fd, FICLONE, 0)) {
+		c->file_mode = "reflink";
+		c->rd = ist.st_size;
+		goto done;
+	}
+	log_dbg("Can't reflink the core: %s", strerror(errno));
+
+	while ((rtn = copy_file_range(0, &in, core->output_fd, &out, SSIZE_MAX, 0)) > 0) {
+		c->file_mode = "copy_file_range";
+	}
+	if (rtn < 0) {
+		log_dbg("Can't copy_file_range() the core: %s", strerror(errno));
+		c->file_mode = NULL;
+		if (out) {
+			/* Continue by the ring from the last copied byte */
+			if (lseek(0, in, SEEK_SET) < 0
+			    || lseek(core->output_fd, out, SEEK_SET) < 0) {
+				log_err("Can't seek the core: %s", strerror(errno));
+				return -1;
+			}
+			c->rd = c->core.pos = core->offset = out;
+		}
+		return -1;
+	}
+	c->rd = out;
+
+done:
+	c->core.pos = core->offset = c->rd;
+	c->eof = true;
+	clock_gettime(CLOCK_MONOTONIC, &c->end);
+	evloop_stop(c->loop);
+	return 0;
+}
+
+/** Start copying the core from stdin to the core output. The copying runs
+ *  in the event loop, which is stopped when it's finished.
+ *  @param[in] core - opened and prepared core output
+ *  @return 0 on success */
+int copy_start(struct copy_s *c, struct run_output_s *core)
+{
+	struct stat st;
+
+	clock_gettime(CLOCK_MONOTONIC, &c->start);
+
+	if (conf.core_splice && !copy_file(c, core)) {
+		c->core.output = core;
+		return 0;
+	}
+
+	if (evloop_add(c->loop, &c->input, 0, 0, input_cb, c)
+	    || evloop_add(c->loop, &c->core.watch, stream_pollable(core), 0, sink_cb, c)) {
+		evloop_del(c->loop, &c->input);
+		return -1;
+	}
+	c->core.output = core;
+
+	if (conf.core_splice && !core->sparse && !core->compress
+	    && !fstat(0, &st) && S_ISFIFO(st.st_mode)) {
+		grow_pipe(0);
+		grow_pipe(core->output_fd);
+		if (c->info.open) {
+			grow_pipe(c->info.fd);
+		}
+		c->splice_ok = true;
+	}
+
+	sink_flush(c, &c->core);
+	sink_flush(c, &c->info);
+	copy_update(c);
+
+	return 0;
+}
+
+/** Log statistics and release the copying state. */
+void copy_close(struct copy_s *c)
+{
+	unsigned long long rate;
+	const char *mode;
+	double secs;
+
+	if (!c) {
+		return;
+	} else if (!c->end.tv_sec && !c->end.tv_nsec) {
+		clock_gettime(CLOCK_MONOTONIC, &c->end);
+	}
+
+	secs = (c->end.tv_sec - c->start.tv_sec) + (c->end.tv_nsec - c->start.tv_nsec) / 1e9;
+	rate = secs > 0 ? c->rd / secs : 0;
+	mode = c->file_mode ? c->file_mode : !c->spliced ? "read"
+		: c->splice ? "splice" : "splice and read";
+	if (c->core.output) {
+		log_info("Core copied using %s: %llu bytes in %.3f s (%llu B/s)",
+				mode, c->rd, secs, rate);
+	}
+	if (c->info.fd >= 0) {
+		log_info("Unwinder peak lag %llu bytes, %llu bytes spilled",
+				c->lag, c->spilled);
+	}
+
+	if (c->spill_fd >= 0) {
+		close(c->spill_fd);
+	}
+	free(c->ring);
+	free(c);
+}
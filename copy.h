@@ -0,0 +1,42 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifndef COPY_H
+#define COPY_H
+
+#include <sys/types.h>
+
+struct evloop_s;
+struct run_output_s;
+struct capture_s;
+struct copy_s;
+
+struct copy_s *copy_open(struct evloop_s *loop, const void *head, size_t len);
+
+int copy_feed(struct copy_s *c, int infofd);
+
+void copy_capture(struct copy_s *c, struct capture_s *cap);
+
+int copy_start(struct copy_s *c, struct run_output_s *core);
+
+void copy_close(struct copy_s *c);
+
+#endif // COPY_H
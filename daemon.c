@@ -0,0 +1,290 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "daemon.h"
+#include "conf.h"
+#include "log.h"
+
+/** Time the client waits for the daemon to take the core, in ms. */
+#define DAEMON_ACK_TIMEOUT 1000
+
+/** Time the daemon waits for the core from an accepted client, in ms. Cores
+ *  are received by the accepting loop, a silent client must not stall it for
+ *  longer than clients wait for the acknowledgement. */
+#define DAEMON_RECV_TIMEOUT 200
+
+/** Maximum number of connections waiting to be accepted. */
+#define DAEMON_BACKLOG 64
+
+/** Request sent with the core descriptor. */
+struct daemon_msg_s {
+	/** PID of the crashed process or -1 if it isn't known. */
+	int pid;
+};
+
+/** Fill the socket address from the configuration.
+ *  @return 0 on success, -1 if the path is too long */
+static int daemon_addr(struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof *addr);
+	addr->sun_family = AF_UNIX;
+	if (strlen(conf.daemon_socket) >= sizeof addr->sun_path) {
+		log_err("Socket path '%s' is too long", conf.daemon_socket);
+		return -1;
+	}
+	strcpy(addr->sun_path, conf.daemon_socket);
+
+	return 0;
+}
+
+/** Pass the core on the standard input, the pidfd and the PID to the daemon.
+ *  @return 0 if the daemon took the core, -1 if it must be processed here */
+int daemon_handoff(void)
+{
+	const struct timeval tv = {
+		.tv_sec = DAEMON_ACK_TIMEOUT / 1000,
+		.tv_usec = DAEMON_ACK_TIMEOUT % 1000 * 1000,
+	};
+	struct daemon_msg_s msg = { .pid = run.pid };
+	struct iovec iov = { .iov_base = &msg, .iov_len = sizeof msg };
+	const int fds[2] = { STDIN_FILENO, run.pidfd };
+	const int nfds = run.pidfd >= 0 ? 2 : 1;
+	union {
+		char buf[CMSG_SPACE(sizeof fds)];
+		struct cmsghdr align;
+	} control;
+	struct msghdr mh = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = CMSG_SPACE(nfds * sizeof(int)),
+	};
+	struct sockaddr_un addr;
+	struct cmsghdr *cmsg;
+	char ack;
+	int fd;
+
+	if (daemon_addr(&addr)) {
+		goto err0;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		log_err("Can't create a socket: %s", strerror(errno));
+		goto err0;
+	}
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof addr)) {
+		log_info("Daemon is not running on '%s': %s", addr.sun_path, strerror(errno));
+		goto err1;
+	}
+
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+
+	if (sendmsg(fd, &mh, MSG_NOSIGNAL) != sizeof msg) {
+		log_err("Can't pass the core to the daemon: %s", strerror(errno));
+		goto err1;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+	if (recv(fd, &ack, sizeof ack, 0) != sizeof ack) {
+		log_err("Daemon didn't take the core: %s", errno ? strerror(errno) : "Closed");
+		goto err1;
+	}
+
+	close(fd);
+	return 0;
+
+err1:	close(fd);
+err0:	return -1;
+}
+
+/** Receive a core descriptor, an optional pidfd and the PID from a client.
+ *  @param[in] fd - the connection
+ *  @param[out] core - the core descriptor
+ *  @param[out] pidfd - the pidfd or -1
+ *  @param[out] pid - the PID
+ *  @return 0 on success, -1 on error */
+static int daemon_recv(int fd, int *core, int *pidfd, int *pid)
+{
+	const struct timeval tv = {
+		.tv_sec = DAEMON_RECV_TIMEOUT / 1000,
+		.tv_usec = DAEMON_RECV_TIMEOUT % 1000 * 1000,
+	};
+	struct daemon_msg_s msg;
+	struct iovec iov = { .iov_base = &msg, .iov_len = sizeof msg };
+	union {
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr mh = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof control.buf,
+	};
+	struct cmsghdr *cmsg;
+	struct ucred cred;
+	socklen_t len = sizeof cred;
+	ssize_t rtn;
+
+	// Only the same user and root may let the daemon read their cores
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)
+	    || (cred.uid != 0 && cred.uid != getuid())) {
+		log_warn("Rejecting a core from an unauthorized client");
+		return -1;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+	rtn = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+	if (rtn != sizeof msg) {
+		log_err("Can't receive the core: %s", rtn < 0 ? strerror(errno) : "Closed");
+		return -1;
+	}
+
+	cmsg = CMSG_FIRSTHDR(&mh);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+	    || (cmsg->cmsg_len != CMSG_LEN(sizeof(int))
+	        && cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int)))) {
+		log_err("Client didn't pass the core");
+		return -1;
+	}
+
+	memcpy(core, CMSG_DATA(cmsg), sizeof *core);
+	*pidfd = -1;
+	if (cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int))) {
+		memcpy(pidfd, CMSG_DATA(cmsg) + sizeof(int), sizeof *pidfd);
+	}
+	*pid = msg.pid;
+
+	return 0;
+}
+
+/** Serve clients passing cores. Each core is processed by a child process
+ *  forked from the daemon, so the configuration is parsed only once and
+ *  libraries are already loaded and initialized.
+ *  @return 1 in a child, which should process the core on its standard
+ *  input, -1 on error */
+int daemon_serve(void)
+{
+	struct sockaddr_un addr;
+	int sfd, fd, core, pidfd, pid;
+	mode_t mask;
+	pid_t child;
+
+	if (!conf.daemon_socket) {
+		log_crit("Option daemon_socket must be set in the daemon mode");
+		goto err0;
+	}
+
+	if (daemon_addr(&addr)) {
+		goto err0;
+	}
+
+	sfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sfd < 0) {
+		log_crit("Can't create a socket: %s", strerror(errno));
+		goto err0;
+	}
+
+	// Remove the socket of a previous instance
+	unlink(addr.sun_path);
+	mask = umask(0077);
+	if (bind(sfd, (struct sockaddr *)&addr, sizeof addr)) {
+		umask(mask);
+		log_crit("Can't bind '%s': %s", addr.sun_path, strerror(errno));
+		goto err1;
+	}
+	umask(mask);
+
+	if (listen(sfd, DAEMON_BACKLOG)) {
+		log_crit("Can't listen on '%s': %s", addr.sun_path, strerror(errno));
+		goto err2;
+	}
+
+	// Children are reaped automatically
+	signal(SIGCHLD, SIG_IGN);
+	log_info("Waiting for cores on '%s'", addr.sun_path);
+
+	for (;;) {
+		fd = accept4(sfd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno != EINTR && errno != ECONNABORTED) {
+				log_err("Can't accept a connection: %s", strerror(errno));
+			}
+			continue;
+		}
+
+		if (daemon_recv(fd, &core, &pidfd, &pid)) {
+			close(fd);
+			continue;
+		}
+
+		child = fork();
+		if (child == 0) {
+			signal(SIGCHLD, SIG_DFL);
+			close(sfd);
+			if (dup2(core, STDIN_FILENO) < 0) {
+				log_crit("Can't use the core: %s", strerror(errno));
+				_exit(exitcode);
+			}
+			close(core);
+			// The client waits until the child owns the core
+			if (send(fd, "", 1, MSG_NOSIGNAL) != 1) {
+				log_warn("Can't acknowledge the core: %s", strerror(errno));
+			}
+			close(fd);
+			run.pid = pid;
+			run.pidfd = pidfd;
+			exitcode = 0;
+			return 1;
+		} else if (child < 0) {
+			log_err("Can't create a process for the core: %s", strerror(errno));
+		}
+
+		close(core);
+		if (pidfd >= 0) {
+			close(pidfd);
+		}
+		close(fd);
+	}
+
+err2:	unlink(addr.sun_path);
+err1:	close(sfd);
+err0:	return -1;
+}
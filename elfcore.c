@@ -0,0 +1,545 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+#include <elf.h>
+
+#include "elfcore.h"
+#include "log.h"
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#define ELFDATA_NATIVE ELFDATA2LSB
+#else
+#define ELFDATA_NATIVE ELFDATA2MSB
+#endif
+
+/** Convert a program header to the class independent form. */
+#define ELF_PHDR_COPY(dst, src) do { \
+	(dst)->type = (src)->p_type;         \
+	(dst)->flags = (src)->p_flags;       \
+	(dst)->offset = (src)->p_offset;     \
+	(dst)->vaddr = (src)->p_vaddr;       \
+	(dst)->filesz = (src)->p_filesz;     \
+	(dst)->memsz = (src)->p_memsz;       \
+} while (0)
+
+/** Read program headers of a core file.
+ *  @param[in] buf - beginning of the core file
+ *  @param[in] len - number of bytes available in the buffer
+ *  @param[out] phdrs - allocated array of program headers, must be freed
+ *  @return Number of program headers or -1 if the buffer doesn't contain
+ *          a native core file header followed by all program headers. */
+int elf_core_phdrs(const void *buf, size_t len, struct elf_phdr_s **phdrs)
+{
+	const unsigned char *ident = buf;
+	unsigned phnum, phentsize, type;
+	uint64_t phoff;
+	int i;
+
+	*phdrs = NULL;
+
+	if (len < EI_NIDENT || memcmp(ident, ELFMAG, SELFMAG)
+	    || ident[EI_DATA] != ELFDATA_NATIVE) {
+		return -1;
+	}
+
+	if (ident[EI_CLASS] == ELFCLASS64 && len >= sizeof(Elf64_Ehdr)) {
+		const Elf64_Ehdr *ehdr = buf;
+		type = ehdr->e_type;
+		phoff = ehdr->e_phoff;
+		phnum = ehdr->e_phnum;
+		phentsize = ehdr->e_phentsize == sizeof(Elf64_Phdr) ? sizeof(Elf64_Phdr) : 0;
+	} else if (ident[EI_CLASS] == ELFCLASS32 && len >= sizeof(Elf32_Ehdr)) {
+		const Elf32_Ehdr *ehdr = buf;
+		type = ehdr->e_type;
+		phoff = ehdr->e_phoff;
+		phnum = ehdr->e_phnum;
+		phentsize = ehdr->e_phentsize == sizeof(Elf32_Phdr) ? sizeof(Elf32_Phdr) : 0;
+	} else {
+		return -1;
+	}
+
+	if (type != ET_CORE || !phentsize) {
+		return -1;
+	}
+
+	// With PN_XNUM the number is stored in a section header at the core end
+	if (phnum == PN_XNUM || phoff > len || phnum * phentsize > len - phoff) {
+		log_dbg("Core program headers are not in the first %zu bytes", len);
+		return -1;
+	}
+
+	*phdrs = calloc(phnum ?: 1, sizeof **phdrs);
+	if (!*phdrs) {
+		log_err("Can't allocate memory for program headers");
+		return -1;
+	}
+
+	for (i = 0; i < phnum; i++) {
+		const char *src = (const char *)buf + phoff + i * phentsize;
+
+		if (phentsize == sizeof(Elf64_Phdr)) {
+			Elf64_Phdr phdr;
+			memcpy(&phdr, src, sizeof phdr);
+			ELF_PHDR_COPY(&(*phdrs)[i], &phdr);
+		} else {
+			Elf32_Phdr phdr;
+			memcpy(&phdr, src, sizeof phdr);
+			ELF_PHDR_COPY(&(*phdrs)[i], &phdr);
+		}
+	}
+
+	return phnum;
+}
+
+/** Iterate over notes of a core file.
+ *  @param[in] buf - beginning of the core file
+ *  @param[in] len - number of bytes available in the buffer
+ *  @param[in] cb - function called for each note
+ *  @param[in] arg - cb argument
+ *  @return 0 if all notes were passed to cb, 1 if cb stopped the iteration or
+ *          -1 if notes are not in the buffer or they are malformed. */
+int elf_core_notes(const void *buf, size_t len, elf_note_cb_t cb, void *arg)
+{
+	struct elf_phdr_s *phdrs;
+	struct elf_note_s note;
+	int i, num, rtn = 0;
+
+	num = elf_core_phdrs(buf, len, &phdrs);
+	if (num < 0) {
+		return -1;
+	}
+	note.elf64 = ((const unsigned char *)buf)[EI_CLASS] == ELFCLASS64;
+
+	for (i = 0; i < num && rtn == 0; i++) {
+		const char *p, *end;
+
+		if (phdrs[i].type != PT_NOTE) {
+			continue;
+		}
+
+		if (phdrs[i].offset > len || phdrs[i].filesz > len - phdrs[i].offset) {
+			log_dbg("Core notes are not in the first %zu bytes", len);
+			rtn = -1;
+			break;
+		}
+
+		p = (const char *)buf + phdrs[i].offset;
+		end = p + phdrs[i].filesz;
+		while (p + sizeof(Elf64_Nhdr) <= end) {
+			Elf64_Nhdr nhdr; // Same layout as Elf32_Nhdr
+
+			memcpy(&nhdr, p, sizeof nhdr);
+			p += sizeof nhdr;
+			// Core notes are 4 bytes aligned in both classes
+			if (nhdr.n_namesz > end - p
+			    || (nhdr.n_namesz + 3) / 4 * 4 + (uint64_t)nhdr.n_descsz > end - p) {
+				log_notice("Malformed core note");
+				rtn = -1;
+				break;
+			}
+
+			note.type = nhdr.n_type;
+			note.name = p;
+			note.namesz = nhdr.n_namesz;
+			p += (nhdr.n_namesz + 3) / 4 * 4;
+			note.desc = p;
+			note.descsz = nhdr.n_descsz;
+			p += (nhdr.n_descsz + 3) / 4 * 4;
+
+			if (cb(&note, arg)) {
+				rtn = 1;
+				break;
+			}
+		}
+	}
+	free(phdrs);
+
+	return rtn;
+}
+
+/** State of elf_core_pids(). */
+struct core_pids_s {
+	int *pids;
+	int count;
+	int max;
+};
+
+/** Collect PIDs from NT_PRSTATUS notes. Helper for elf_core_pids(). */
+static int core_pids_cb(const struct elf_note_s *note, void *arg)
+{
+	// Offset of pr_pid in struct elf_prstatus: pr_info (3 ints), pr_cursig,
+	// padding, pr_sigpend and pr_sighold (longs of the core class)
+	const uint32_t pid_off = note->elf64 ? 32 : 24;
+	struct core_pids_s *s = arg;
+	int32_t pid;
+
+	if (note->type != NT_PRSTATUS || note->descsz < pid_off + sizeof pid) {
+		return 0;
+	}
+
+	memcpy(&pid, (const char *)note->desc + pid_off, sizeof pid);
+	s->pids[s->count++] = pid;
+
+	return s->count == s->max;
+}
+
+/** Get PIDs of threads stored in the core.
+ *  @param[in] buf - beginning of the core file
+ *  @param[in] len - number of bytes available in the buffer
+ *  @param[out] pids - PIDs of threads
+ *  @param[in] max - size of the pids array
+ *  @return Number of stored PIDs or -1 if notes are not in the buffer. */
+int elf_core_pids(const void *buf, size_t len, int *pids, int max)
+{
+	struct core_pids_s s = { pids, 0, max };
+
+	if (max <= 0 || elf_core_notes(buf, len, core_pids_cb, &s) < 0) {
+		return -1;
+	}
+
+	return s.count;
+}
+
+/** Indexes of the stack pointer and the instruction pointer in pr_reg. */
+#if defined(__x86_64__)
+#define PRSTATUS_SP 19
+#define PRSTATUS_IP 16
+#elif defined(__i386__)
+#define PRSTATUS_SP 15
+#define PRSTATUS_IP 12
+#elif defined(__aarch64__)
+#define PRSTATUS_SP 31
+#define PRSTATUS_IP 32
+#elif defined(__arm__)
+#define PRSTATUS_SP 13
+#define PRSTATUS_IP 15
+#endif
+
+/** State of elf_core_threads(). */
+struct core_threads_s {
+	struct elf_thread_s *threads;
+	int count;
+	int max;
+};
+
+/** Collect registers from NT_PRSTATUS notes. Helper for elf_core_threads(). */
+static int core_threads_cb(const struct elf_note_s *note, void *arg)
+{
+#ifdef PRSTATUS_SP
+	// In struct elf_prstatus pr_pid is followed by 3 other pid_t fields and
+	// 4 struct timevals of the core class, then pr_reg starts
+	const uint32_t pid_off = note->elf64 ? 32 : 24;
+	const uint32_t reg_off = note->elf64 ? 112 : 72;
+	const uint32_t reg_size = note->elf64 ? 8 : 4;
+	const uint32_t reg_max = PRSTATUS_SP > PRSTATUS_IP ? PRSTATUS_SP : PRSTATUS_IP;
+	struct core_threads_s *s = arg;
+	struct elf_thread_s *t;
+	uint64_t sp = 0, ip = 0;
+	int32_t pid;
+
+	if (note->type != NT_PRSTATUS
+	    || note->elf64 != (sizeof(long) == 8)
+	    || note->descsz < reg_off + (reg_max + 1) * reg_size) {
+		return 0;
+	}
+
+	memcpy(&pid, (const char *)note->desc + pid_off, sizeof pid);
+	memcpy(&sp, (const char *)note->desc + reg_off + PRSTATUS_SP * reg_size, reg_size);
+	memcpy(&ip, (const char *)note->desc + reg_off + PRSTATUS_IP * reg_size, reg_size);
+
+	t = &s->threads[s->count++];
+	t->pid = pid;
+	t->sp = sp;
+	t->ip = ip;
+
+	return s->count == s->max;
+#else
+	return 1;
+#endif
+}
+
+/** Get stack and instruction pointers of threads stored in the core. Only
+ *  cores of the native architecture are supported.
+ *  @param[in] buf - beginning of the core file
+ *  @param[in] len - number of bytes available in the buffer
+ *  @param[out] threads - thread registers
+ *  @param[in] max - size of the threads array
+ *  @return Number of stored threads or -1 if notes are not in the buffer or
+ *          the architecture is not supported. */
+int elf_core_threads(const void *buf, size_t len, struct elf_thread_s *threads, int max)
+{
+	struct core_threads_s s = { threads, 0, max };
+
+#ifndef PRSTATUS_SP
+	return -1;
+#endif
+
+	if (max <= 0 || elf_core_notes(buf, len, core_threads_cb, &s) < 0) {
+		return -1;
+	}
+
+	return s.count;
+}
+
+/** Read a word of the core class from a note descriptor. */
+static uint64_t note_word(const struct elf_note_s *note, uint32_t i)
+{
+	uint64_t w64;
+	uint32_t w32;
+
+	if (note->elf64) {
+		memcpy(&w64, (const char *)note->desc + i * sizeof w64, sizeof w64);
+		return w64;
+	}
+	memcpy(&w32, (const char *)note->desc + i * sizeof w32, sizeof w32);
+	return w32;
+}
+
+/** Check a note is a CORE note of the given type. */
+static int note_is(const struct elf_note_s *note, uint32_t type)
+{
+	return note->type == type && note->namesz == sizeof "CORE"
+		&& !memcmp(note->name, "CORE", sizeof "CORE");
+}
+
+/** State of elf_core_files(). */
+struct core_files_s {
+	struct elf_file_s *files;
+	int count;
+};
+
+/** Parse the NT_FILE note. Helper for elf_core_files(). */
+static int core_files_cb(const struct elf_note_s *note, void *arg)
+{
+	const uint32_t word = note->elf64 ? 8 : 4;
+	struct core_files_s *s = arg;
+	const char *name, *end;
+	uint64_t count, page;
+	uint32_t i;
+
+	if (!note_is(note, NT_FILE)) {
+		return 0;
+	}
+
+	// Number of files and the page size, followed by start, end and file
+	// offset in pages of each mapping, then names terminated by zeros
+	if (note->descsz < 2 * word) {
+		goto malformed;
+	}
+	count = note_word(note, 0);
+	page = note_word(note, 1);
+	if (count > (note->descsz - 2 * word) / (3 * word)) {
+		goto malformed;
+	}
+
+	s->files = calloc(count ?: 1, sizeof *s->files);
+	if (!s->files) {
+		log_err("Can't allocate memory for %llu core files", (unsigned long long)count);
+		s->count = -1;
+		return 1;
+	}
+
+	name = (const char *)note->desc + (2 + 3 * count) * word;
+	end = (const char *)note->desc + note->descsz;
+	for (i = 0; i < count; i++) {
+		struct elf_file_s *f = &s->files[i];
+
+		f->start = note_word(note, 2 + 3 * i);
+		f->end = note_word(note, 3 + 3 * i);
+		f->offset = note_word(note, 4 + 3 * i) * page;
+		f->name = name;
+		name = memchr(name, 0, end - name);
+		if (!name) {
+			free(s->files);
+			s->files = NULL;
+			goto malformed;
+		}
+		name++;
+	}
+	s->count = count;
+
+	return 1;
+
+malformed:
+	log_notice("Malformed NT_FILE core note");
+	s->count = -1;
+	return 1;
+}
+
+/** Get file backed mappings of the process from the NT_FILE note. Mappings
+ *  are executable if their load segment is.
+ *  @param[in] buf - beginning of the core file
+ *  @param[in] len - number of bytes available in the buffer
+ *  @param[out] files - allocated array of mappings, must be freed
+ *  @return Number of mappings or -1 if notes are not in the buffer or they
+ *          don't contain a valid NT_FILE note. */
+int elf_core_files(const void *buf, size_t len, struct elf_file_s **files)
+{
+	struct core_files_s s = { NULL, -1 };
+	struct elf_phdr_s *phdrs;
+	int i, j, num;
+
+	*files = NULL;
+	if (elf_core_notes(buf, len, core_files_cb, &s) < 0 || s.count < 0) {
+		return -1;
+	}
+
+	// Both load segments and files are sorted by address
+	num = elf_core_phdrs(buf, len, &phdrs);
+	for (i = j = 0; i < s.count && j < num; ) {
+		if (phdrs[j].type != PT_LOAD || phdrs[j].vaddr < s.files[i].start) {
+			j++;
+		} else {
+			s.files[i].exec = phdrs[j].vaddr == s.files[i].start
+				&& (phdrs[j].flags & PF_X);
+			i++;
+		}
+	}
+	free(phdrs);
+
+	*files = s.files;
+	return s.count;
+}
+
+/** State of elf_core_auxv(). */
+struct core_auxv_s {
+	uint64_t type;
+	uint64_t *value;
+	int found;
+};
+
+/** Look up an entry of the NT_AUXV note. Helper for elf_core_auxv(). */
+static int core_auxv_cb(const struct elf_note_s *note, void *arg)
+{
+	const uint32_t word = note->elf64 ? 8 : 4;
+	struct core_auxv_s *s = arg;
+	uint32_t i;
+
+	if (!note_is(note, NT_AUXV)) {
+		return 0;
+	}
+
+	for (i = 0; i + 1 < note->descsz / word; i += 2) {
+		uint64_t type = note_word(note, i);
+
+		if (type == AT_NULL) {
+			break;
+		} else if (type == s->type) {
+			*s->value = note_word(note, i + 1);
+			s->found = 1;
+			break;
+		}
+	}
+
+	return 1;
+}
+
+/** Get a value of the auxiliary vector from the NT_AUXV note.
+ *  @param[in] buf - beginning of the core file
+ *  @param[in] len - number of bytes available in the buffer
+ *  @param[in] type - entry type (AT_*)
+ *  @param[out] value - the entry value
+ *  @return 0 on success, -1 if the entry is not found */
+int elf_core_auxv(const void *buf, size_t len, uint64_t type, uint64_t *value)
+{
+	struct core_auxv_s s = { type, value, 0 };
+
+	if (elf_core_notes(buf, len, core_auxv_cb, &s) < 0 || !s.found) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Get the offset of the end of program headers in a core file.
+ *  @param[in] buf - beginning of the core file
+ *  @param[in] len - number of bytes available in the buffer
+ *  @return Offset of the first byte after program headers or -1 if the
+ *          buffer doesn't contain a native core file header */
+long long elf_core_phdrs_end(const void *buf, size_t len)
+{
+	const unsigned char *ident = buf;
+
+	if (len < EI_NIDENT || memcmp(ident, ELFMAG, SELFMAG)
+	    || ident[EI_DATA] != ELFDATA_NATIVE) {
+		return -1;
+	}
+
+	if (ident[EI_CLASS] == ELFCLASS64 && len >= sizeof(Elf64_Ehdr)) {
+		const Elf64_Ehdr *ehdr = buf;
+		if (ehdr->e_type == ET_CORE && ehdr->e_phnum != PN_XNUM) {
+			return ehdr->e_phoff + (long long)ehdr->e_phnum * ehdr->e_phentsize;
+		}
+	} else if (ident[EI_CLASS] == ELFCLASS32 && len >= sizeof(Elf32_Ehdr)) {
+		const Elf32_Ehdr *ehdr = buf;
+		if (ehdr->e_type == ET_CORE && ehdr->e_phnum != PN_XNUM) {
+			return ehdr->e_phoff + (long long)ehdr->e_phnum * ehdr->e_phentsize;
+		}
+	}
+
+	return -1;
+}
+
+/** Get the offset of the end of notes in a core file.
+ *  @param[in] buf - beginning of the core file
+ *  @param[in] len - number of bytes available in the buffer
+ *  @return Offset of the first byte after all notes or -1 if it can't be
+ *          determined from the buffer */
+long long elf_core_notes_end(const void *buf, size_t len)
+{
+	struct elf_phdr_s *phdrs;
+	long long end = -1;
+	int i, num;
+
+	num = elf_core_phdrs(buf, len, &phdrs);
+	for (i = 0; i < num; i++) {
+		if (phdrs[i].type == PT_NOTE && (long long)(phdrs[i].offset + phdrs[i].filesz) > end) {
+			end = phdrs[i].offset + phdrs[i].filesz;
+		}
+	}
+	free(phdrs);
+
+	return end;
+}
+
+/** Get the expected size of a core file from its program headers.
+ *  @param[in] buf - beginning of the core file
+ *  @param[in] len - number of bytes available in the buffer
+ *  @return The core size or -1 if it can't be determined */
+long long elf_core_size(const void *buf, size_t len)
+{
+	struct elf_phdr_s *phdrs;
+	long long size = -1;
+	int i, num;
+
+	num = elf_core_phdrs(buf, len, &phdrs);
+	for (i = 0; i < num; i++) {
+		if ((long long)(phdrs[i].offset + phdrs[i].filesz) > size) {
+			size = phdrs[i].offset + phdrs[i].filesz;
+		}
+	}
+	free(phdrs);
+
+	return size;
+}
@@ -0,0 +1,105 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifndef ELFCORE_H
+#define ELFCORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Program header, independent of the ELF class. */
+struct elf_phdr_s {
+	/** Segment type (PT_*). */
+	uint32_t type;
+	/** Segment flags (PF_*). */
+	uint32_t flags;
+	/** Offset of the segment in the file. */
+	uint64_t offset;
+	/** Virtual address of the segment. */
+	uint64_t vaddr;
+	/** Size of the segment in the file. */
+	uint64_t filesz;
+	/** Size of the segment in the memory. */
+	uint64_t memsz;
+};
+
+/** Note, independent of the ELF class. */
+struct elf_note_s {
+	/** Note type (NT_*). */
+	uint32_t type;
+	/** Note name (e.g. CORE), not necessarily terminated. */
+	const char *name;
+	/** Length of the name. */
+	uint32_t namesz;
+	/** Note descriptor. */
+	const void *desc;
+	/** Length of the descriptor. */
+	uint32_t descsz;
+	/** Non-zero for 64-bit cores. */
+	int elf64;
+};
+
+/** Registers of a thread needed to locate its stack. */
+struct elf_thread_s {
+	/** PID of the thread. */
+	int pid;
+	/** Stack pointer. */
+	uint64_t sp;
+	/** Instruction pointer. */
+	uint64_t ip;
+};
+
+/** File backed mapping of a core (NT_FILE). */
+struct elf_file_s {
+	/** Start address of the mapping. */
+	uint64_t start;
+	/** End address of the mapping. */
+	uint64_t end;
+	/** Offset of the mapping in the file. */
+	uint64_t offset;
+	/** File name, points to the core buffer. */
+	const char *name;
+	/** Non-zero if the mapping is executable. */
+	int exec;
+};
+
+/** Function called for each note, returns non-zero to stop the iteration. */
+typedef int (*elf_note_cb_t)(const struct elf_note_s *note, void *arg);
+
+int elf_core_phdrs(const void *buf, size_t len, struct elf_phdr_s **phdrs);
+
+int elf_core_notes(const void *buf, size_t len, elf_note_cb_t cb, void *arg);
+
+int elf_core_pids(const void *buf, size_t len, int *pids, int max);
+
+int elf_core_threads(const void *buf, size_t len, struct elf_thread_s *threads, int max);
+
+int elf_core_files(const void *buf, size_t len, struct elf_file_s **files);
+
+int elf_core_auxv(const void *buf, size_t len, uint64_t type, uint64_t *value);
+
+long long elf_core_phdrs_end(const void *buf, size_t len);
+
+long long elf_core_notes_end(const void *buf, size_t len);
+
+long long elf_core_size(const void *buf, size_t len);
+
+#endif // ELFCORE_H
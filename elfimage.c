@@ -0,0 +1,264 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <elf.h>
+
+#include "elfimage.h"
+#include "log.h"
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#define ELFDATA_NATIVE ELFDATA2LSB
+#else
+#define ELFDATA_NATIVE ELFDATA2MSB
+#endif
+
+/** Convert a section header to the class independent form. */
+#define ELF_SHDR_COPY(dst, src) do { \
+	(dst)->type = (src)->sh_type;        \
+	(dst)->link = (src)->sh_link;        \
+	(dst)->addr = (src)->sh_addr;        \
+	(dst)->offset = (src)->sh_offset;    \
+	(dst)->size = (src)->sh_size;        \
+	(dst)->entsize = (src)->sh_entsize;  \
+} while (0)
+
+/** Read a field of the ELF header of the image class. */
+#define EHDR(img, field) ((img)->elf64 \
+	? ((const Elf64_Ehdr *)(img)->map)->field \
+	: ((const Elf32_Ehdr *)(img)->map)->field)
+
+/** Map an executable or a shared library of the native class to the memory.
+ *  @param[in] path - image file name
+ *  @param[out] img - mapped image, must be closed by elf_image_close()
+ *  @return 0 on success, -1 if the file isn't a native ELF image */
+int elf_image_open(const char *path, struct elf_image_s *img)
+{
+	const unsigned char *ident;
+	struct stat st;
+	void *map;
+	int fd;
+
+	img->map = NULL;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		log_dbg("Can't open '%s': %s", path, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) || st.st_size < EI_NIDENT) {
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		log_dbg("Can't map '%s': %s", path, strerror(errno));
+		return -1;
+	}
+
+	ident = map;
+	if (memcmp(ident, ELFMAG, SELFMAG) || ident[EI_DATA] != ELFDATA_NATIVE
+	    || ident[EI_CLASS] != (sizeof(void *) == 8 ? ELFCLASS64 : ELFCLASS32)
+	    || st.st_size < (sizeof(void *) == 8 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr))) {
+		log_dbg("'%s' isn't a native ELF image", path);
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	img->map = map;
+	img->size = st.st_size;
+	img->elf64 = ident[EI_CLASS] == ELFCLASS64;
+
+	return 0;
+}
+
+/** Unmap the image. */
+void elf_image_close(struct elf_image_s *img)
+{
+	if (img->map) {
+		munmap((void *)img->map, img->size);
+		img->map = NULL;
+	}
+}
+
+/** Read a section header.
+ *  @param[in] img - mapped image
+ *  @param[in] idx - index of the section
+ *  @param[out] shdr - the section header
+ *  @return 0 on success, -1 if there is no such section in the file */
+int elf_image_shdr(const struct elf_image_s *img, unsigned idx, struct elf_shdr_s *shdr)
+{
+	uint64_t shoff = EHDR(img, e_shoff);
+	unsigned shentsize = EHDR(img, e_shentsize);
+	const char *src;
+
+	if (!img->map || idx >= EHDR(img, e_shnum)
+	    || shentsize != (img->elf64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr))
+	    || shoff > img->size || (idx + 1) * (uint64_t)shentsize > img->size - shoff) {
+		return -1;
+	}
+	src = (const char *)img->map + shoff + idx * shentsize;
+
+	if (img->elf64) {
+		Elf64_Shdr sh;
+		memcpy(&sh, src, sizeof sh);
+		ELF_SHDR_COPY(shdr, &sh);
+	} else {
+		Elf32_Shdr sh;
+		memcpy(&sh, src, sizeof sh);
+		ELF_SHDR_COPY(shdr, &sh);
+	}
+
+	if (shdr->type != SHT_NOBITS
+	    && (shdr->offset > img->size || shdr->size > img->size - shdr->offset)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Find a section by its name.
+ *  @return Index of the section or -1 if it isn't found */
+int elf_image_section(const struct elf_image_s *img, const char *name, struct elf_shdr_s *shdr)
+{
+	struct elf_shdr_s strtab;
+	unsigned i, num;
+	uint32_t sh_name;
+
+	if (!img->map || elf_image_shdr(img, EHDR(img, e_shstrndx), &strtab)) {
+		return -1;
+	}
+
+	num = EHDR(img, e_shnum);
+	for (i = 1; i < num; i++) {
+		const char *src;
+
+		if (elf_image_shdr(img, i, shdr)) {
+			return -1;
+		}
+
+		// sh_name is the first member in both classes
+		src = (const char *)img->map + EHDR(img, e_shoff) + i * EHDR(img, e_shentsize);
+		memcpy(&sh_name, src, sizeof sh_name);
+		if (sh_name < strtab.size
+		    && !strncmp((const char *)img->map + strtab.offset + sh_name,
+				name, strtab.size - sh_name)) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/** Find the executable segment of the image.
+ *  @param[out] vaddr - link time address of the segment
+ *  @param[out] memsz - size of the segment in the memory
+ *  @return 0 on success, -1 if there is no executable segment */
+int elf_image_text(const struct elf_image_s *img, uint64_t *vaddr, uint64_t *memsz)
+{
+	uint64_t phoff = EHDR(img, e_phoff);
+	unsigned i, phnum = EHDR(img, e_phnum);
+
+	if (!img->map || phoff > img->size
+	    || phnum * (uint64_t)EHDR(img, e_phentsize) > img->size - phoff
+	    || EHDR(img, e_phentsize) != (img->elf64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr))) {
+		return -1;
+	}
+
+	for (i = 0; i < phnum; i++) {
+		const char *src = (const char *)img->map + phoff + i * EHDR(img, e_phentsize);
+		uint32_t type, flags;
+
+		if (img->elf64) {
+			Elf64_Phdr ph;
+			memcpy(&ph, src, sizeof ph);
+			type = ph.p_type, flags = ph.p_flags;
+			*vaddr = ph.p_vaddr, *memsz = ph.p_memsz;
+		} else {
+			Elf32_Phdr ph;
+			memcpy(&ph, src, sizeof ph);
+			type = ph.p_type, flags = ph.p_flags;
+			*vaddr = ph.p_vaddr, *memsz = ph.p_memsz;
+		}
+
+		if (type == PT_LOAD && (flags & PF_X)) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/** Get the GNU build-id of the image.
+ *  @param[out] hex - build-id as a hexadecimal string
+ *  @param[in] len - size of the hex buffer
+ *  @return 0 on success, -1 if the image has no build-id */
+int elf_image_build_id(const struct elf_image_s *img, char *hex, size_t len)
+{
+	struct elf_shdr_s shdr;
+	unsigned i, num;
+
+	num = img->map ? EHDR(img, e_shnum) : 0;
+	for (i = 1; i < num; i++) {
+		const char *p, *end;
+
+		if (elf_image_shdr(img, i, &shdr) || shdr.type != SHT_NOTE) {
+			continue;
+		}
+
+		p = (const char *)img->map + shdr.offset;
+		end = p + shdr.size;
+		while (p + sizeof(Elf64_Nhdr) <= end) {
+			Elf64_Nhdr nhdr; // Same layout as Elf32_Nhdr
+			const unsigned char *desc;
+			unsigned j;
+
+			memcpy(&nhdr, p, sizeof nhdr);
+			p += sizeof nhdr;
+			if (nhdr.n_namesz > end - p
+			    || (nhdr.n_namesz + 3) / 4 * 4 + (uint64_t)nhdr.n_descsz > end - p) {
+				break;
+			}
+			desc = (const unsigned char *)p + (nhdr.n_namesz + 3) / 4 * 4;
+			if (nhdr.n_type == NT_GNU_BUILD_ID && nhdr.n_namesz == sizeof "GNU"
+			    && !memcmp(p, "GNU", sizeof "GNU")
+			    && nhdr.n_descsz && nhdr.n_descsz * 2 < len) {
+				for (j = 0; j < nhdr.n_descsz; j++) {
+					sprintf(hex + 2 * j, "%02x", desc[j]);
+				}
+				return 0;
+			}
+			p = (const char *)desc + (nhdr.n_descsz + 3) / 4 * 4;
+		}
+	}
+
+	return -1;
+}
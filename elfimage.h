@@ -0,0 +1,66 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifndef ELFIMAGE_H
+#define ELFIMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Executable or shared library mapped to the memory. */
+struct elf_image_s {
+	/** Mapped file or NULL if the image couldn't be opened. */
+	const void *map;
+	/** Size of the file. */
+	size_t size;
+	/** Non-zero for 64-bit images. */
+	int elf64;
+};
+
+/** Section header, independent of the ELF class. */
+struct elf_shdr_s {
+	/** Section type (SHT_*). */
+	uint32_t type;
+	/** Index of the linked section. */
+	uint32_t link;
+	/** Virtual address of the section. */
+	uint64_t addr;
+	/** Offset of the section in the file. */
+	uint64_t offset;
+	/** Size of the section in the file. */
+	uint64_t size;
+	/** Size of a table entry. */
+	uint64_t entsize;
+};
+
+int elf_image_open(const char *path, struct elf_image_s *img);
+
+void elf_image_close(struct elf_image_s *img);
+
+int elf_image_shdr(const struct elf_image_s *img, unsigned idx, struct elf_shdr_s *shdr);
+
+int elf_image_section(const struct elf_image_s *img, const char *name, struct elf_shdr_s *shdr);
+
+int elf_image_text(const struct elf_image_s *img, uint64_t *vaddr, uint64_t *memsz);
+
+int elf_image_build_id(const struct elf_image_s *img, char *hex, size_t len);
+
+#endif // ELFIMAGE_H
@@ -0,0 +1,288 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#define _GNU_SOURCE
+#include <sys/signalfd.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+
+#include "evloop.h"
+#include "conf.h"
+#include "log.h"
+
+/** Watched child process. */
+struct evloop_child_s {
+	struct evloop_child_s *next;
+	pid_t pid;
+	evloop_child_cb_t cb;
+	void *arg;
+};
+
+/** Reap terminated children and call their callbacks. */
+static void evloop_reap(struct evloop_s *l, struct evloop_watch_s *w, unsigned events)
+{
+	struct evloop_child_s **prev, *child;
+	struct signalfd_siginfo si;
+	int status;
+
+	while (read(l->sigfd, &si, sizeof si) == sizeof si);
+
+	for (prev = &l->children; (child = *prev);) {
+		if (waitpid(child->pid, &status, WNOHANG) == child->pid) {
+			*prev = child->next;
+			child->cb(child->pid, status, child->arg);
+			free(child);
+		} else {
+			prev = &child->next;
+		}
+	}
+}
+
+/** Initialize the event loop. SIGCHLD is blocked in the calling thread, so
+ *  this must be called before other threads are created.
+ *  @return 0 on success */
+int evloop_init(struct evloop_s *l)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &l->sigwatch };
+	sigset_t set;
+
+	memset(l, 0, sizeof *l);
+
+	l->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (l->epfd < 0) {
+		log_crit("Can't create epoll descriptor: %s", strerror(errno));
+		goto err0;
+	}
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	l->sigfd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (l->sigfd < 0) {
+		log_crit("Can't create signal descriptor: %s", strerror(errno));
+		goto err1;
+	}
+
+	l->sigwatch.fd = l->sigfd;
+	l->sigwatch.events = EPOLLIN;
+	l->sigwatch.cb = evloop_reap;
+	if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->sigfd, &ev)) {
+		log_crit("Can't watch signal descriptor: %s", strerror(errno));
+		goto err2;
+	}
+
+	return 0;
+
+err2:	close(l->sigfd);
+err1:	close(l->epfd);
+err0:	l->epfd = l->sigfd = -1;
+	return -1;
+}
+
+/** Release the event loop resources, watched children are not waited for. */
+void evloop_destroy(struct evloop_s *l)
+{
+	struct evloop_child_s *child;
+
+	while ((child = l->children)) {
+		l->children = child->next;
+		free(child);
+	}
+
+	if (l->epfd >= 0) {
+		close(l->epfd);
+		close(l->sigfd);
+		l->epfd = l->sigfd = -1;
+	}
+}
+
+/** Watch a file descriptor. Descriptors, which can't be polled (regular
+ *  files) or -1, are considered always ready when the watch is enabled.
+ *  @param[in] w - watch, must stay valid until evloop_del() is called
+ *  @param[in] fd - watched descriptor or -1
+ *  @param[in] events - requested events, 0 to add a disabled watch
+ *  @return 0 on success */
+int evloop_add(struct evloop_s *l, struct evloop_watch_s *w, int fd,
+		unsigned events, evloop_cb_t cb, void *arg)
+{
+	struct epoll_event ev = { .events = events, .data.ptr = w };
+
+	w->fd = fd;
+	w->events = events;
+	w->always = false;
+	w->cb = cb;
+	w->arg = arg;
+
+	if (fd < 0 || epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		if (fd >= 0 && errno != EPERM) {
+			log_err("Can't watch descriptor %d: %s", fd, strerror(errno));
+			return -1;
+		}
+		w->always = true;
+		w->next = l->always;
+		l->always = w;
+	}
+
+	if (events) {
+		l->active++;
+	}
+
+	return 0;
+}
+
+/** Change events requested by the watch.
+ *  @param[in] events - requested events, 0 disables the watch
+ *  @return 0 on success */
+int evloop_set(struct evloop_s *l, struct evloop_watch_s *w, unsigned events)
+{
+	struct epoll_event ev = { .events = events, .data.ptr = w };
+
+	if (w->events == events) {
+		return 0;
+	}
+
+	if (!w->always && epoll_ctl(l->epfd, EPOLL_CTL_MOD, w->fd, &ev)) {
+		log_err("Can't modify watch of descriptor %d: %s", w->fd, strerror(errno));
+		return -1;
+	}
+
+	l->active += !w->events - !events;
+	w->events = events;
+
+	return 0;
+}
+
+/** Stop watching the descriptor. The watch may be removed from its own or
+ *  other callback, its memory can't be released before the callback returns. */
+void evloop_del(struct evloop_s *l, struct evloop_watch_s *w)
+{
+	struct evloop_watch_s **prev;
+
+	if (w->always) {
+		// Keep w->next, the loop may still iterate over it
+		for (prev = &l->always; *prev; prev = &(*prev)->next) {
+			if (*prev == w) {
+				*prev = w->next;
+				break;
+			}
+		}
+		w->always = false;
+	} else if (w->fd >= 0) {
+		epoll_ctl(l->epfd, EPOLL_CTL_DEL, w->fd, NULL);
+	}
+
+	if (w->events) {
+		l->active--;
+		w->events = 0;
+	}
+	w->fd = -1;
+}
+
+/** Call the callback when the child terminates. The loop runs until all
+ *  watched children terminate.
+ *  @return 0 on success */
+int evloop_child(struct evloop_s *l, pid_t pid, evloop_child_cb_t cb, void *arg)
+{
+	struct evloop_child_s *child;
+	int status;
+
+	// SIGCHLD may have been consumed before the child was added
+	if (waitpid(pid, &status, WNOHANG) == pid) {
+		cb(pid, status, arg);
+		return 0;
+	}
+
+	child = malloc(sizeof *child);
+	if (!child) {
+		log_err("Can't allocate memory for child %d", pid);
+		return -1;
+	}
+
+	child->pid = pid;
+	child->cb = cb;
+	child->arg = arg;
+	child->next = l->children;
+	l->children = child;
+
+	return 0;
+}
+
+/** Return from evloop_run() after the current callback finishes. */
+void evloop_stop(struct evloop_s *l)
+{
+	l->stop = true;
+}
+
+/** Run the loop until evloop_stop() is called or there are no enabled
+ *  watches and no watched children.
+ *  @param[in] timeout - maximal time in ms without any event, -1 for infinity
+ *  @return 0 when stopped, 1 on timeout, -1 on error */
+int evloop_run(struct evloop_s *l, int timeout)
+{
+	struct epoll_event ev[16];
+	struct evloop_watch_s *w, *next;
+	bool ready;
+	int i, n;
+
+	while (!l->stop && (l->active || l->children)) {
+		for (ready = false, w = l->always; w && !ready; w = w->next) {
+			ready = w->events != 0;
+		}
+
+		n = epoll_wait(l->epfd, ev, ARRAY_SIZE(ev), ready ? 0 : timeout);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			log_err("Waiting for events failed: %s", strerror(errno));
+			return -1;
+		} else if (n == 0 && !ready) {
+			return 1;
+		}
+
+		for (i = 0; i < n && !l->stop; i++) {
+			w = ev[i].data.ptr;
+			if (w->events) {
+				w->cb(l, w, ev[i].events);
+			}
+		}
+
+		for (w = l->always; w && !l->stop; w = next) {
+			next = w->next;
+			if (w->events) {
+				w->cb(l, w, w->events);
+			}
+		}
+	}
+
+	l->stop = false;
+	return 0;
+}
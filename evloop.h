@@ -0,0 +1,97 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <stdbool.h>
+
+struct evloop_s;
+struct evloop_watch_s;
+
+/** Called when the watched descriptor is ready.
+ *  @param[in] loop - the event loop
+ *  @param[in] w - the watch
+ *  @param[in] events - ready events (EPOLLIN, EPOLLOUT, EPOLLERR, EPOLLHUP) */
+typedef void (*evloop_cb_t)(struct evloop_s *loop, struct evloop_watch_s *w,
+		unsigned events);
+
+/** Called when a watched child terminates.
+ *  @param[in] pid - PID of the child
+ *  @param[in] status - status returned by waitpid()
+ *  @param[in] arg - argument given to evloop_child() */
+typedef void (*evloop_child_cb_t)(pid_t pid, int status, void *arg);
+
+/** Watched file descriptor, the memory is owned by the caller. */
+struct evloop_watch_s {
+	/** Watched descriptor, -1 or not pollable means always ready. */
+	int fd;
+	/** Requested events, 0 if the watch is disabled. */
+	unsigned events;
+	/** The descriptor can't be polled, it's ready when enabled. */
+	bool always;
+	/** Callback and its argument. */
+	evloop_cb_t cb;
+	void *arg;
+	/** Next always ready watch. */
+	struct evloop_watch_s *next;
+};
+
+struct evloop_child_s;
+
+/** Event loop state. */
+struct evloop_s {
+	/** Epoll descriptor. */
+	int epfd;
+	/** Signal descriptor receiving SIGCHLD. */
+	int sigfd;
+	/** Number of enabled watches. */
+	int active;
+	/** Set by evloop_stop(). */
+	bool stop;
+	/** Watches, which can't be polled. */
+	struct evloop_watch_s *always;
+	/** Watched children. */
+	struct evloop_child_s *children;
+	/** Watch of sigfd. */
+	struct evloop_watch_s sigwatch;
+};
+
+int evloop_init(struct evloop_s *l);
+
+void evloop_destroy(struct evloop_s *l);
+
+int evloop_add(struct evloop_s *l, struct evloop_watch_s *w, int fd,
+		unsigned events, evloop_cb_t cb, void *arg);
+
+int evloop_set(struct evloop_s *l, struct evloop_watch_s *w, unsigned events);
+
+void evloop_del(struct evloop_s *l, struct evloop_watch_s *w);
+
+int evloop_child(struct evloop_s *l, pid_t pid, evloop_child_cb_t cb, void *arg);
+
+void evloop_stop(struct evloop_s *l);
+
+int evloop_run(struct evloop_s *l, int timeout);
+
+#endif // EVLOOP_H
@@ -19,17 +19,20 @@
  *
  */
 
-#define _ATFILE_SOURCE
+#define _GNU_SOURCE
 #include <inttypes.h>
+#include <endian.h>
 #include <limits.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <stdio.h>
-#include <ctype.h>
 #include <errno.h>
 #include <time.h>
 
+#include "module.h"
+#include "stream.h"
 #include "util.h"
 #include "info.h"
 #include "conf.h"
@@ -37,191 +40,542 @@
 #include "log.h"
 #include "unw.h"
 
-const char SP[24] = "                       ";
+const struct info_enc_s *const info_encoders[] = {
+	[CONF_INFO_FORMAT_YAML] = &info_yaml,
+	[CONF_INFO_FORMAT_CBOR] = &info_cbor,
+};
+
+/** Size of the buffer of the info stream, memory buffers start smaller. */
+#define INFO_OUT_BUFSIZE (64*1024)
+#define INFO_OUT_MINSIZE 4096
+
+/** Vector of bytes scanned for characters escaped in YAML strings, it's
+ *  as wide as the widest vector registers available. */
+#ifdef __AVX2__
+#define YAML_VEC_SIZE 32
+#else
+#define YAML_VEC_SIZE 16
+#endif
+typedef signed char yaml_vec_t __attribute__((vector_size(YAML_VEC_SIZE)));
+typedef unsigned long long yaml_mask_t __attribute__((vector_size(YAML_VEC_SIZE)));
+
+/** Escape sequences of YAML strings, 0 for bytes written as they are. */
+static const char yaml_escape[256] = {
+	[0x00 ... 0x1f] = 'x', [0x7f ... 0xff] = 'x',
+	['\n'] = 'n', ['\t'] = 't', ['\r'] = 'r', ['"'] = '"', ['\\'] = '\\',
+};
+
+/** Pairs of decimal digits. */
+static const char dec_pairs[201] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/** Initialize a writer.
+ *  @param[out] out - the writer
+ *  @param[in] stream - stream the data are written to or NULL to keep
+ *             them in out->buf, which is then owned by the caller */
+void info_out_init(struct info_out_s *out, struct run_output_s *stream)
+{
+	out->buf = NULL;
+	out->len = out->size = 0;
+	out->stream = stream;
+	out->error = 0;
+	out->bol = 1;
+	out->pending = 0;
+	pthread_mutex_init(&out->lock, NULL);
+	out->comments = NULL;
+	out->comments_len = 0;
+}
+
+/** Open a writer of a stream prepared by stream_prepare().
+ *  @return The writer or NULL on error */
+struct info_out_s *info_out_open(struct run_output_s *stream)
+{
+	struct info_out_s *out;
+
+	out = malloc(sizeof *out);
+	if (!out) {
+		return NULL;
+	}
+
+	info_out_init(out, stream);
+	out->buf = malloc(INFO_OUT_BUFSIZE);
+	if (!out->buf) {
+		free(out);
+		return NULL;
+	}
+	out->size = INFO_OUT_BUFSIZE;
+
+	return out;
+}
+
+/** Write the buffer to the stream.
+ *  @return 0 on success, -1 if any write has failed, see out->error. */
+int info_out_flush(struct info_out_s *out)
+{
+	ssize_t rtn;
+
+	if (out->stream && out->len) {
+		out->bol = out->buf[out->len - 1] == '\n';
+		rtn = stream_write(out->stream, out->buf, out->len);
+		if (rtn != out->len && !out->error) {
+			out->error = rtn < 0 ? errno : EIO;
+		}
+		out->len = 0;
+	}
+
+	return out->error ? -1 : 0;
+}
+
+/** Write comments logged by other threads. */
+static void info_out_drain(struct info_out_s *out)
+{
+	char *comments;
+	size_t len;
+
+	pthread_mutex_lock(&out->lock);
+	comments = out->comments;
+	len = out->comments_len;
+	out->comments = NULL;
+	out->comments_len = 0;
+	__atomic_store_n(&out->pending, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&out->lock);
+
+	info_out_write(out, comments, len);
+	free(comments);
+}
+
+/** Write pending comments, flush and free the writer of a stream.
+ *  @return 0 on success, -1 if any write has failed, errno is set. */
+int info_out_close(struct info_out_s *out)
+{
+	int rtn, err;
+
+	if (out->pending) {
+		info_out_drain(out);
+	}
+	rtn = info_out_flush(out);
+	err = out->error;
+
+	pthread_mutex_destroy(&out->lock);
+	free(out->comments);
+	free(out->buf);
+	free(out);
 
-typedef char yaml_esc_buf_t[6];
+	if (rtn) {
+		errno = err;
+	}
+	return rtn;
+}
 
-static const char *yaml_esc(char c, yaml_esc_buf_t *buf)
+/** Append data, which don't fit into the buffer or follow pending comments. */
+void info_out_slow(struct info_out_s *out, const void *data, size_t len)
 {
-	switch (c) {
-		case '\n': return "\\n";
-		case '\t': return "\\t";
-		case '\r': return "\\r";
-		case '\\': return "\\\\";
-		case '"': return "\\\"";
+	ssize_t rtn;
+	size_t size;
+	char *buf;
+
+	if (out->pending && (out->len ? out->buf[out->len - 1] == '\n' : out->bol)) {
+		info_out_drain(out);
 	}
 
-	if (isprint(c)) {
-		(*buf)[0] = c; (*buf)[1] = '\0';
+	if (out->size - out->len >= len) {
+		// Fits, the slow path was taken for the comments
+	} else if (out->stream) {
+		info_out_flush(out);
+		if (len > out->size) {
+			rtn = stream_write(out->stream, data, len);
+			if (rtn != len && !out->error) {
+				out->error = rtn < 0 ? errno : EIO;
+			}
+			out->bol = ((const char *)data)[len - 1] == '\n';
+			return;
+		}
 	} else {
-		sprintf(*buf, "\\x%02x", c);
+		size = out->size ?: INFO_OUT_MINSIZE;
+		while (size - out->len < len) {
+			size *= 2;
+		}
+		buf = realloc(out->buf, size);
+		if (!buf) {
+			out->error = ENOMEM;
+			return;
+		}
+		out->buf = buf;
+		out->size = size;
 	}
 
-	return *buf;
+	memcpy(out->buf + out->len, data, len);
+	out->len += len;
 }
 
-int fputy(const char *s, FILE *stream)
+/** Add a comment from any thread, it's written at the beginning of the next
+ *  line of the stream to not break the line being written.
+ *  @param[in] s - complete lines of the comment */
+void info_out_comment(struct info_out_s *out, const char *s, size_t len)
 {
-	yaml_esc_buf_t buf;
+	char *comments;
+
+	pthread_mutex_lock(&out->lock);
+	comments = realloc(out->comments, out->comments_len + len);
+	if (comments) {
+		memcpy(comments + out->comments_len, s, len);
+		out->comments = comments;
+		out->comments_len += len;
+		__atomic_store_n(&out->pending, 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&out->lock);
+}
 
-	if (EOF == fputc('"', stream)) {
-		return EOF;
+/** Length of the prefix of a string, which doesn't need escaping. The bulk
+ *  is checked a vector at a time, the tail and the hit byte by byte. */
+static size_t yaml_plain(const char *s, size_t len)
+{
+	yaml_mask_t mask;
+	unsigned long long any;
+	yaml_vec_t v;
+	size_t i, j;
+
+	for (i = 0; i + sizeof v <= len; i += sizeof v) {
+		memcpy(&v, s + i, sizeof v);
+		// Bytes above 0x7f are negative and escaped with control characters
+		v = (v < (yaml_vec_t){} + ' ') | (v == (yaml_vec_t){} + 0x7f)
+			| (v == (yaml_vec_t){} + '"') | (v == (yaml_vec_t){} + '\\');
+		memcpy(&mask, &v, sizeof mask);
+		for (any = 0, j = 0; j < sizeof mask / sizeof mask[0]; j++) {
+			any |= mask[j];
+		}
+		if (any) {
+			break;
+		}
 	}
 
-	for (; *s; s++) {
-		if (EOF == fputs(yaml_esc(*s, &buf), stream)) {
-			return EOF;
+	for (; i < len && !yaml_escape[(unsigned char)s[i]]; i++);
+
+	return i;
+}
+
+/** Write a double quoted YAML string. */
+void info_out_yaml(struct info_out_s *out, const char *s)
+{
+	size_t len = strlen(s), plain;
+	unsigned char c;
+	char esc[4];
+
+	info_out_putc(out, '"');
+	while (len) {
+		plain = yaml_plain(s, len);
+		info_out_write(out, s, plain);
+		if (plain == len) {
+			break;
 		}
+
+		c = s[plain];
+		esc[0] = '\\';
+		esc[1] = yaml_escape[c];
+		if (esc[1] == 'x') {
+			esc[2] = "0123456789abcdef"[c >> 4];
+			esc[3] = "0123456789abcdef"[c & 15];
+			info_out_write(out, esc, 4);
+		} else {
+			info_out_write(out, esc, 2);
+		}
+		s += plain + 1;
+		len -= plain + 1;
 	}
+	info_out_putc(out, '"');
+}
 
-	if (EOF == fputc('"', stream)) {
-		return EOF;
+/** Hexadecimal digit of a nibble, without branching. */
+static inline char hex_digit(unsigned nibble)
+{
+	return '0' + nibble + ((9 - nibble) >> 8 & ('a' - '0' - 10));
+}
+
+/** Spread nibbles of a 32-bit value to bytes and convert them to
+ *  hexadecimal digits, all 8 at once, in the order they are written. */
+static inline uint64_t hex_digits8(uint32_t value)
+{
+	uint64_t x = value;
+
+	x = (x | x << 16) & 0x0000ffff0000ffffULL;
+	x = (x | x << 8) & 0x00ff00ff00ff00ffULL;
+	x = (x | x << 4) & 0x0f0f0f0f0f0f0f0fULL;
+	x = htobe64(x);
+
+	// Bytes above 9 get the offset of 'a'
+	return x + 0x3030303030303030ULL
+		+ ((x + 0x0606060606060606ULL) >> 4 & 0x0101010101010101ULL)
+		* ('a' - '0' - 10);
+}
+
+/** Write 16 hexadecimal digits of the value, as "%016lx" does. */
+void info_out_hex16(struct info_out_s *out, uint64_t value)
+{
+	uint64_t buf[2];
+
+	buf[0] = hex_digits8(value >> 32);
+	buf[1] = hex_digits8(value);
+	info_out_write(out, buf, sizeof buf);
+}
+
+/** Write the value right aligned to the width, as "%#<width>lx" does. */
+void info_out_hex_alt(struct info_out_s *out, uint64_t value, int width)
+{
+	char buf[18], *p = buf + sizeof buf;
+	int len;
+
+	if (!value) {
+		*--p = '0';
+	} else {
+		for (; value; value >>= 4) {
+			*--p = hex_digit(value & 15);
+		}
+		*--p = 'x';
+		*--p = '0';
 	}
 
-	return 0;
+	len = buf + sizeof buf - p;
+	if (len < width) {
+		info_out_puts(out, spaces(width - len));
+	}
+	info_out_write(out, p, len);
+}
+
+/** Format decimal digits at the end of the buffer, return the first one. */
+static char *dec_format(char *end, unsigned long long value)
+{
+	while (value >= 100) {
+		end -= 2;
+		memcpy(end, &dec_pairs[value % 100 * 2], 2);
+		value /= 100;
+	}
+	if (value >= 10) {
+		end -= 2;
+		memcpy(end, &dec_pairs[value * 2], 2);
+	} else {
+		*--end = '0' + value;
+	}
+
+	return end;
 }
 
-#if 0
-static int fputy_readlinkat(int dirfd, const char *name, FILE *stream)
+/** Write a decimal number, as "%llu" does. */
+void info_out_uint(struct info_out_s *out, unsigned long long value)
 {
-	char buf[PATH_MAX + 1];
-	int c;
+	char buf[20], *p;
+
+	p = dec_format(buf + sizeof buf, value);
+	info_out_write(out, p, buf + sizeof buf - p);
+}
 
-	c = readlinkat(dirfd, name, buf, sizeof buf - 1);
-	if (c >= 0) {
-		buf[c] = 0;
+/** Write a signed decimal number, as "%lld" does. */
+void info_out_int(struct info_out_s *out, long long value)
+{
+	char buf[21], *p;
+
+	if (value < 0) {
+		p = dec_format(buf + sizeof buf, -(unsigned long long)value);
+		*--p = '-';
 	} else {
-		snprintf(buf, sizeof buf, "ERROR_%d", errno);
+		p = dec_format(buf + sizeof buf, value);
 	}
+	info_out_write(out, p, buf + sizeof buf - p);
+}
 
-	return fputy(buf, stream);
+/** Write seconds with microseconds, as "%ld.%06ld" does. */
+void info_out_usec(struct info_out_s *out, long sec, long usec)
+{
+	char buf[7];
+
+	info_out_int(out, sec);
+	buf[0] = '.';
+	memcpy(&buf[1], &dec_pairs[usec / 10000 % 100 * 2], 2);
+	memcpy(&buf[3], &dec_pairs[usec / 100 % 100 * 2], 2);
+	memcpy(&buf[5], &dec_pairs[usec % 100 * 2], 2);
+	info_out_write(out, buf, sizeof buf);
 }
-#endif
 
-static int proc_dump(int dir, const struct conf_multi_str_s *files, int indent)
+/** Read a /proc file, which is not in the snapshot.
+ *  @return 0 on success or errno */
+static int proc_read(int tid, const char *name, char **data, size_t *len)
 {
-	fputs(spaces(indent), run.info.output);
+	char path[PATH_MAX];
+	int fd, err = 0;
 
+	if (tid) {
+		snprintf(path, sizeof path, "task/%d/%s", tid, name);
+	} else {
+		snprintf(path, sizeof path, "%s", name);
+	}
+
+	fd = openat(run.proc_fd, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || NULL == (*data = read_all(fd, len))) {
+		err = errno;
+	}
+	if (fd >= 0) close(fd);
+
+	return err;
+}
+
+/** Get a /proc file from the snapshot or read it, if it's not there.
+ *  @param[out] live - the content, if it was read, must be freed
+ *  @return 0 on success or errno */
+static int proc_get(int tid, const char *name, const char **data, size_t *len, char **live)
+{
+	int err;
+
+	*live = NULL;
+	err = proc_snapshot_get(tid, name, data, len);
+	if (err < 0) {
+		err = proc_read(tid, name, live, len);
+		*data = *live;
+	}
+
+	return err;
+}
+
+static int proc_dump(int tid, const struct conf_multi_str_s *files, int indent)
+{
 	if (!files) {
-		fputs("proc_dump: ~\n", run.info.output);
+		info_enc->proc_dump_begin(run.info.output, indent, "");
 		return 0;
 	}
 
 	if (conf.proc.ignore) {
-		fputs("proc_dump: ~ # proc_ignore = 1\n", run.info.output);
+		info_enc->proc_dump_begin(run.info.output, indent, "proc_ignore = 1");
 		return 0;
 	}
 
-	fputs("proc_dump:\n", run.info.output);
+	info_enc->proc_dump_begin(run.info.output, indent, NULL);
 	do {
-		char buf[4096];
-		FILE *pf;
-		int fd;
+		const char *data;
+		char *live;
+		size_t len;
+		int err;
 
-		fputs(spaces(indent + 2), run.info.output);
-		fputy(files->str, run.info.output);
-
-		fd = openat(dir, files->str, O_RDONLY | O_CLOEXEC);
-		if (fd < 0 || NULL == (pf = fdopen(fd, "r"))) {
-			int err = errno;
+		err = proc_get(tid, files->str, &data, &len, &live);
+		if (err) {
 			log_err("Can't open proc file '%s': %s", files->str, strerror(err));
-			fprintf(run.info.output, ": ~ # Can't open: %s\n", strerror(err));
-			if (fd >= 0) close(fd);
+			info_enc->proc_file(run.info.output, indent, files->str, NULL, 0, err);
 			continue;
 		}
 
-		fputs(": |\n", run.info.output);
-		while (fgets(buf, sizeof buf, pf)) {
-			buf[strlen_chomp(buf)] = 0;
-			fputs(spaces(indent + 4), run.info.output);
-			fputs(buf, run.info.output);
-			fputc('\n', run.info.output);
-		}
-		fclose(pf);
+		info_enc->proc_file(run.info.output, indent, files->str, data, len, 0);
+		free(live);
 	} while (NULL != (files = files->next));
+	info_enc->proc_dump_end(run.info.output);
 
 	return 0;
 }
 
 static void task_dumper(int tid)
 {
-	int taskfd;
 	char path[32];
 
-	fprintf(run.info.output, "  - tid: %d # -------------------------"
-				"-------------------------\n", tid);
+	info_enc->thread_begin(run.info.output, tid);
 
+	// Tasks started after the snapshot are read directly
 	snprintf(path, sizeof path, "task/%d", tid);
-	taskfd = openat(run.proc_fd, path, O_RDONLY | O_DIRECTORY);
-	if (taskfd >= 0) {
-		proc_dump(taskfd, conf.proc_dump.task, 4);
-		close(taskfd);
-	} else {
+	if (proc_snapshot_get(tid, NULL, NULL, NULL)
+	    && faccessat(run.proc_fd, path, F_OK, 0)) {
 		log_err("Can't open '%s/%s': %s", conf.proc.path, path, strerror(errno));
+		return;
 	}
+
+	proc_dump(tid, conf.proc_dump.task, 4);
 }
 
 int info_dump(void)
 {
 	struct timespec end_tp;
-	yaml_esc_buf_t buf;
+	struct timeval tv;
 	char datetime[24];
-	FILE *p;
+	const char *data, *arg;
+	char *live;
+	size_t len;
+	int i;
 
 	// datetime: 2001-12-15T02:59:43Z
-	fputs("---\ndatetime: ", run.info.output);
-	strftime(datetime, sizeof datetime, "%Y-%m-%dT%H:%M:%SZ\n", &run.start_tm);
-	fputs(datetime, run.info.output);
+	strftime(datetime, sizeof datetime, "%Y-%m-%dT%H:%M:%SZ", &run.start_tm);
+	info_enc->begin(run.info.output, datetime);
 
 	// exe: "/usr/bin/vi"
-	fputs("exe: ", run.info.output);
-	fputy(conf.proc.exe, run.info.output);
-	fputc('\n', run.info.output);
+	info_enc->exe(run.info.output, conf.proc.exe);
 
 	// cmdline: [ "vi", "/etc/passwd" ]
 	// cmdline can have arguments members separated by spaces or zeroes
-	fputs("cmdline: [ ", run.info.output);
-	p = open_proc("cmdline");
-	if (p) {
-		int c = fgetc(p);
-		if (c != EOF) {
-			fputc('"', run.info.output);
-			do {
-				if (c != 0) {
-					fputs(yaml_esc(c, &buf), run.info.output);
-				} else {
-					c = fgetc(p);
-					if (c != EOF) {
-						fputs("\", \"", run.info.output);
-						ungetc(c, p);
-					}
-				}
-			} while (EOF != (c = fgetc(p)));
-			fputc('"', run.info.output);
+	info_enc->cmdline_begin(run.info.output);
+	if (!proc_get(0, "cmdline", &data, &len, &live)) {
+		for (i = 0, arg = data; arg < data + len; i++) {
+			info_enc->cmdline_arg(run.info.output, i, arg);
+			arg += strlen(arg) + 1;
 		}
-		fclose(p);
+		free(live);
 	}
-	fputs(" ]\n", run.info.output);
+	info_enc->cmdline_end(run.info.output);
 
 	// mappings:
 	if (!conf.proc.maps) {
-		fputs("executable_mappings: ~\n", run.info.output);
+		info_enc->mappings_begin(run.info.output, 0);
+	} else if (conf.symbolize == CONF_SYMBOLIZE_DEFERRED && !module_init()) {
+		// Modules are referenced by their index in backtraces
+		info_enc->mappings_begin(run.info.output, 1);
+		for (i = 0; i < module_count; i++) {
+			info_enc->mapping(run.info.output, modules[i].start,
+					modules[i].file, modules[i].build_id);
+		}
+		info_enc->mappings_end(run.info.output);
 	} else {
 		const struct conf_multi_mapping_s *map;
-		fputs("executable_mappings:\n", run.info.output);
+		info_enc->mappings_begin(run.info.output, 1);
 		for (map = conf.proc.maps; map; map = map->next) {
-			fprintf(run.info.output, "  0x%016" PRIx64 ": ", map->addr);
-			fputy(map->file, run.info.output);
-			fputc('\n', run.info.output);
+			info_enc->mapping(run.info.output, map->addr, map->file, NULL);
 		}
+		info_enc->mappings_end(run.info.output);
 	}
 
 
 	// proc_dump:
-	proc_dump(run.proc_fd, conf.proc_dump.root, 0);
+	proc_dump(0, conf.proc_dump.root, 0);
 
 	// dump information from the unwinder
 	unw_dump(task_dumper);
+	proc_snapshot_free();
+
+#ifdef CRASHINFO_WITH_LIBUNWIND
+	// unwinder_lag_peak: 1048576
+	info_enc->counter(run.info.output, "unwinder_lag_peak",
+			__atomic_load_n(&run.unwind_lag_peak, __ATOMIC_RELAXED));
+
+	// crash_signature: 0x9ae16a3b2f90404f
+	// crash_storm: { suppressed: 1, count: 12 }
+	if (run.storm.known) {
+		info_enc->signature(run.info.output, "crash_signature", run.storm.signature);
+	}
+	if (run.storm.known && conf.storm.table) {
+		if (run.storm.error) {
+			log_err("Can't account the crash in '%s': %s", conf.storm.table,
+					strerror(run.storm.error));
+		} else if (run.storm.suppressed) {
+			log_notice("Crash storm, the core output is suppressed");
+		}
+		info_enc->pair(run.info.output, "crash_storm", "suppressed",
+				run.storm.suppressed, "count", run.storm.count);
+	}
+
+	// unwind_cache: { hits: 3, misses: 1 }
+	// symbol_cache: { hits: 3, misses: 1 }
+	if (conf.cache.path) {
+		info_enc->pair(run.info.output, "unwind_cache", "hits",
+				run.unwind_cache_hits, "misses", run.unwind_cache_misses);
+		info_enc->pair(run.info.output, "symbol_cache", "hits",
+				run.symbol_cache_hits, "misses", run.symbol_cache_misses);
+	}
+#endif // CRASHINFO_WITH_LIBUNWIND
 	
 	// processing_time: 12.123456
 	clock_gettime(CLOCK_REALTIME, &end_tp);
@@ -231,13 +585,16 @@ int info_dump(void)
 		end_tp.tv_sec -= 1;
 	}
 	end_tp.tv_nsec -= run.start_tp.tv_nsec;
-	fprintf(run.info.output, "processing_time: %d.%06ld\n", (int)end_tp.tv_sec, end_tp.tv_nsec/1000);
+	tv.tv_sec = end_tp.tv_sec;
+	tv.tv_usec = end_tp.tv_nsec / 1000;
+	info_enc->end(run.info.output, &tv);
 
-	if (0 != fflush(run.info.output) || ferror(run.info.output)) {
-		if (errno == EPIPE) {
+	if (0 != info_out_flush(run.info.output)) {
+		if (run.info.output->error == EPIPE) {
 			log_warn("Info stream truncated");
 		} else {
-			log_err("Failed flushing the info stream: %s", strerror(errno));
+			log_err("Failed flushing the info stream: %s",
+					strerror(run.info.output->error));
 		}
 	}
 	if (0 != fsync(run.info.output_fd) && errno != EROFS && errno != EINVAL) {
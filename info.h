@@ -22,12 +22,171 @@
 #ifndef INFO_H
 #define INFO_H
 
+#include <sys/time.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+
 extern const char SP[24];
 
 #define spaces(length) ((length) >= sizeof SP ? SP : (length) < 0 ? "" : &SP[sizeof SP - (length) - 1])
 
-int info_dump(void);
+struct run_output_s;
+
+/** Buffered writer of the info stream. Writers without a stream keep
+ *  everything in a growing buffer, e.g. blocks rendered by workers. */
+struct info_out_s {
+	char *buf;
+	size_t len, size;
+	/** Stream the buffer is flushed to or NULL. */
+	struct run_output_s *stream;
+	/** Error of the first failed write, 0 if none. */
+	int error;
+	/** The flushed part of the stream ends with a complete line. */
+	int bol;
+	/** Comments logged by other threads are waiting for a line start. */
+	int pending;
+	pthread_mutex_t lock;
+	char *comments;
+	size_t comments_len;
+};
+
+void info_out_init(struct info_out_s *out, struct run_output_s *stream);
+
+struct info_out_s *info_out_open(struct run_output_s *stream);
+
+int info_out_flush(struct info_out_s *out);
+
+int info_out_close(struct info_out_s *out);
+
+void info_out_slow(struct info_out_s *out, const void *data, size_t len);
+
+void info_out_comment(struct info_out_s *out, const char *s, size_t len);
+
+void info_out_vprintf(struct info_out_s *out, const char *format, va_list ap);
+
+void info_out_printf(struct info_out_s *out, const char *format, ...)
+		__attribute__ ((format (printf, 2, 3)));
+
+void info_out_yaml(struct info_out_s *out, const char *s);
+
+void info_out_hex16(struct info_out_s *out, uint64_t value);
 
-int fputy(const char *s, FILE *stream);
+void info_out_hex_alt(struct info_out_s *out, uint64_t value, int width);
+
+void info_out_uint(struct info_out_s *out, unsigned long long value);
+
+void info_out_int(struct info_out_s *out, long long value);
+
+void info_out_usec(struct info_out_s *out, long sec, long usec);
+
+/** Append data to the info stream. */
+static inline void info_out_write(struct info_out_s *out, const void *data, size_t len)
+{
+	if (__builtin_expect(out->size - out->len < len
+			|| __atomic_load_n(&out->pending, __ATOMIC_RELAXED), 0)) {
+		info_out_slow(out, data, len);
+		return;
+	}
+	memcpy(out->buf + out->len, data, len);
+	out->len += len;
+}
+
+static inline void info_out_putc(struct info_out_s *out, char c)
+{
+	if (__builtin_expect(out->len == out->size
+			|| __atomic_load_n(&out->pending, __ATOMIC_RELAXED), 0)) {
+		info_out_slow(out, &c, 1);
+		return;
+	}
+	out->buf[out->len++] = c;
+}
+
+static inline void info_out_puts(struct info_out_s *out, const char *s)
+{
+	info_out_write(out, s, strlen(s));
+}
+
+/** Frame of a backtrace. */
+struct info_frame_s {
+	/** Instruction pointer, valid if ip_known is set. */
+	uint64_t ip;
+	int ip_known;
+	/** Only ip, module and signal are valid, names are looked up later. */
+	int deferred;
+	/** Index of the module in executable_mappings or -1, deferred only. */
+	int module;
+	/** Function name or NULL, the offset in it and its length. */
+	const char *name;
+	uint64_t off, len;
+	/** The name isn't a plain identifier and must be quoted. */
+	int quote;
+	/** Exception handler and signal frame flags, -1 if not known. */
+	int exception, signal;
+	/** Image backing the frame or NULL. */
+	const char *file;
+};
+
+/** Encoder of the info stream. Sections are written in the order of calls,
+ *  "none" arguments are NULL to start a section, otherwise the section is
+ *  empty and the string is a comment (an empty string for no comment). */
+struct info_enc_s {
+	/** Start the document, datetime is in the ISO 8601 format. */
+	void (*begin)(struct info_out_s *out, const char *datetime);
+	/** Executable path or NULL if it isn't known. */
+	void (*exe)(struct info_out_s *out, const char *exe);
+	void (*cmdline_begin)(struct info_out_s *out);
+	void (*cmdline_arg)(struct info_out_s *out, int index, const char *arg);
+	void (*cmdline_end)(struct info_out_s *out);
+	/** Start executable mappings, end is called only if they are known. */
+	void (*mappings_begin)(struct info_out_s *out, int known);
+	/** Mapping of an image, build_id is NULL if it isn't written at all
+	 *  and an empty string if it isn't known. */
+	void (*mapping)(struct info_out_s *out, uint64_t addr, const char *file, const char *build_id);
+	void (*mappings_end)(struct info_out_s *out);
+	void (*proc_dump_begin)(struct info_out_s *out, int indent, const char *none);
+	/** Content of a /proc file, data is NULL if it can't be read. */
+	void (*proc_file)(struct info_out_s *out, int indent, const char *name,
+			const char *data, size_t len, int err);
+	void (*proc_dump_end)(struct info_out_s *out);
+	void (*threads_begin)(struct info_out_s *out, const char *none);
+	void (*thread_begin)(struct info_out_s *out, int tid);
+	void (*thread_time)(struct info_out_s *out, const char *key, const struct timeval *tv);
+	void (*registers_begin)(struct info_out_s *out);
+	void (*reg)(struct info_out_s *out, int index, uint64_t value);
+	void (*registers_end)(struct info_out_s *out);
+	/** Reference to the grouped stack of the thread. */
+	void (*stack_ref)(struct info_out_s *out, uint64_t id);
+	void (*backtrace_begin)(struct info_out_s *out);
+	void (*frame)(struct info_out_s *out, int depth, const struct info_frame_s *frame);
+	void (*backtrace_end)(struct info_out_s *out);
+	void (*thread_end)(struct info_out_s *out);
+	void (*threads_end)(struct info_out_s *out);
+	void (*stacks_begin)(struct info_out_s *out);
+	/** Start a grouped stack, its backtrace follows. */
+	void (*stack_begin)(struct info_out_s *out, uint64_t id, const int *tids, int count);
+	void (*stack_end)(struct info_out_s *out);
+	void (*stacks_end)(struct info_out_s *out);
+	/** Counter, signature and pair of counters of the processing. */
+	void (*counter)(struct info_out_s *out, const char *key, unsigned long long value);
+	void (*signature)(struct info_out_s *out, const char *key, unsigned long long value);
+	void (*pair)(struct info_out_s *out, const char *key, const char *key1,
+			unsigned long long value1, const char *key2, unsigned long long value2);
+	/** End the document with the processing time. */
+	void (*end)(struct info_out_s *out, const struct timeval *processing_time);
+	/** Message logged to the info stream. */
+	void (*log)(struct info_out_s *out, const char *prefix, const char *format, va_list ap);
+};
+
+/** Encoders indexed by conf_info_format_e. */
+extern const struct info_enc_s *const info_encoders[];
+
+extern const struct info_enc_s info_yaml, info_cbor;
+
+/** Encoder of the info stream selected by the configuration. */
+#define info_enc (info_encoders[conf.info_format])
+
+int info_dump(void);
 
 #endif // INFO_H
@@ -22,6 +22,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+#include "info.h"
 #include "log.h"
 #include "conf.h"
 
@@ -83,13 +84,8 @@ void logmsg(int priority, const char *format, ...)
 			return;
 		}
 
-		flockfile(run.info.output);
-		fputs("# ", run.info.output);
-		fputs(prefix, run.info.output);
 	        va_start(ap, format);
-	        vfprintf(run.info.output, format, ap);
+		info_enc->log(run.info.output, prefix, format, ap);
 	        va_end(ap);
-	        fputs("\n", run.info.output);
-		funlockfile(run.info.output);
 	}
 }
@@ -21,7 +21,9 @@
 
 #define _GNU_SOURCE
 #include <sys/resource.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -35,10 +37,20 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <getopt.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
 
+#include "symbolize.h"
+#include "convert.h"
+#include "reprocess.h"
+#include "daemon.h"
+#include "capture.h"
+#include "elfcore.h"
+#include "evloop.h"
+#include "stream.h"
+#include "copy.h"
 #include "util.h"
 #include "info.h"
 #include "conf.h"
@@ -46,10 +58,20 @@
 #include "log.h"
 #include "unw.h"
 
-#define OUT_BUFSIZE (64*1024)
+#define CORE_HEAD_MAX (64*1024*1024)
+#define PID_TIMEOUT 500
 #define ESC '@'
 #define ACCESS_ONCE(x) (*(volatile typeof(x) *)&(x))
 
+/** Event loop copying the core and reaping children */
+static struct evloop_s loop;
+
+/** Signalled by the info dumper thread when the PID is known */
+static int pid_efd = -1;
+
+/** Prevent dumping until the output is opened */
+static int gate_efd = -1;
+
 /** Exit the program */
 static void handler(int sig)
 {
@@ -137,6 +159,7 @@ static int spawn_proc(const char *cmd, int infd, int outfd,
 	} else if (pid == 0) {
 		char *exe = strdup(cmd);
 		char *argv[32];
+		sigset_t mask;
 		int i;
 
 		if (!exe) exe = (char*)cmd;
@@ -149,18 +172,23 @@ static int spawn_proc(const char *cmd, int infd, int outfd,
 		argv[0] = strtok(exe, delim);
 		for (i = 1; i < ARRAY_SIZE(argv) - 1; i++) {
 			argv[i] = strtok(NULL, delim);
+			if (!argv[i]) {
+				break;
+			}
 			// execvp must behave as if the const char *const[]
 			// argument is used, but the prototype differs due to
 			// historical reasons
-			if (arg1 && strcmp(argv[i], "@1")) {
+			if (arg1 && !strcmp(argv[i], "@1")) {
 				argv[i] = (char*)arg1;
-			} else if (arg2 && strcmp(argv[i], "@2")) {
+			} else if (arg2 && !strcmp(argv[i], "@2")) {
 				argv[i] = (char*)arg2;
 			}
 		}
 		argv[i] = NULL;
 
 		signal(SIGPIPE, SIG_DFL);
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
 
 		execvp(argv[0], argv);
 		log_crit("Starting executable '%s' failed: %s", exe, strerror(errno));
@@ -170,10 +198,53 @@ static int spawn_proc(const char *cmd, int infd, int outfd,
 	return pid;
 }
 
-/** Close output */
+/** Log the exit status of a filter. Called by the event loop, which is
+ *  stopped when the last filter of a closed output is reaped. */
+static void filter_reaped(pid_t pid, int status, void *arg)
+{
+	struct run_output_s *r = arg;
+	struct run_multi_filter_s **prev, *iter;
+
+	for (prev = &r->filter; (iter = *prev); prev = &iter->next) {
+		if (iter->pid == pid) {
+			*prev = iter->next;
+			break;
+		}
+	}
+	if (!iter) {
+		return;
+	}
+
+	if (WIFEXITED(status)) {
+		if (WEXITSTATUS(status) == 0) {
+			log_dbg("Filter '%s' ended successfully", iter->filter);
+		} else {
+			log_err("Filter '%s' failed with return code %d",
+					iter->filter, WEXITSTATUS(status));
+		}
+	} else if (WIFSIGNALED(status)) {
+		if (WTERMSIG(status) == SIGPIPE) {
+			log_warn("Filter '%s' was terminated by SIGPIPE."
+					" Stream may be truncated.",
+					iter->filter);
+		} else {
+			log_err("Filter '%s' was terminated by signal %d",
+					iter->filter, WTERMSIG(status));
+		}
+	} else {
+		assert(0);
+	}
+
+	free(iter);
+
+	if (!r->filter && r->output_fd < 0) {
+		evloop_stop(&loop);
+	}
+}
+
+/** Close output, wait until its filters exit and start notify commands. */
 static void close_output(const struct conf_output_s *c, struct run_output_s *r)
 {
-	struct run_multi_filter_s *iter, *tmp;
 	struct conf_multi_str_s *str;
 
 	if (r->output_fd < 0) {
@@ -181,44 +252,25 @@ static void close_output(const struct conf_output_s *c, struct run_output_s *r)
 	}
 
 	if (r->output) {
-		fflush(r->output);
-		fsync(r->output_fd);
-		fclose(r->output);
+		info_out_close(r->output);
 		r->output = NULL;
-	} else {
-		fsync(r->output_fd);
-		close(r->output_fd);
 	}
+	stream_finish(r);
+	fsync(r->output_fd);
+	close(r->output_fd);
 	r->output_fd = -1;
 
-	foreach_safe (r->filter, iter, tmp) {
-		int status, pid;
+	// Notify commands must see the output after filters wrote all of it
+	if (r->filter) {
+		evloop_run(&loop, -1);
+	}
 
-		pid = waitpid(iter->pid, &status, 0);
-		if (pid != iter->pid) {
-			log_crit("Waiting for filter '%s' failed: %s",
-					iter->filter, strerror(errno));
-		} else if (WIFEXITED(status)) {
-			if (WEXITSTATUS(status) == 0) {
-				log_dbg("Filter '%s' ended successfully", iter->filter);
-			} else {
-				log_err("Filter '%s' failed with return code %d",
-						iter->filter, WEXITSTATUS(status));
-			}
-		} else if (WIFSIGNALED(status)) {
-			if (WTERMSIG(status) == SIGPIPE) {
-				log_warn("Filter '%s' was terminated by SIGPIPE."
-						" Stream may be truncated.",
-						iter->filter);
-			} else {
-				log_err("Filter '%s' was terminated by signal %d",
-						iter->filter, WTERMSIG(status));
-			}
-		} else {
-			assert(0);
+	if (r->suppressed && r->output_filename) {
+		if (unlink(r->output_filename)) {
+			log_err("Can't remove suppressed output '%s': %s",
+					r->output_filename, strerror(errno));
 		}
-
-		free(iter);
+		r->output_filename = NULL;
 	}
 
 	if (r->output_filename) for (str = c->notify; str; str = str->next) {
@@ -227,25 +279,31 @@ static void close_output(const struct conf_output_s *c, struct run_output_s *r)
 	}
 }
 
-/** Prevent dumping until the output is opened */
-static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+/** Core input of the unwinder */
+struct unw_input_s {
+	/** Unwinder pipe or, if capture is used, the core head */
+	int fd;
+	/** Core regions captured for the unwinder or NULL */
+	struct capture_s *capture;
+};
 
 /** Info dumper thread */
 static void *info_dump_thread(void *arg)
 {
-	int inputfd = *(int *)arg;
+	const struct unw_input_s *input = arg;
+	eventfd_t gate;
 	int pid, rtn;
 
-	pid = unw_prepare(inputfd);
+	pid = unw_prepare(input->fd, input->capture);
 	if (run.pid == -1) {
 		ACCESS_ONCE(run.pid) = pid < 0 ? -2 : pid;
 	}
+	eventfd_write(pid_efd, 1);
 
-	pthread_mutex_lock(&dump_lock);
-	pthread_mutex_unlock(&dump_lock);
+	while (eventfd_read(gate_efd, &gate) && errno == EINTR);
 
 	rtn = info_dump();
-	close(inputfd);
+	close(input->fd);
 
 	return (void*)(long)rtn;
 }
@@ -254,7 +312,7 @@ static void *info_dump_thread(void *arg)
 static int open_output(const struct conf_output_s *c, struct run_output_s *r)
 {
 	const struct conf_multi_str_s *filter;
-	struct run_multi_filter_s **prev_f;
+	struct run_multi_filter_s **prev_f, *f;
 	char path[PATH_MAX], buf[32];
 	int i, j, seq_len, flags, fd;
 	int mkdir = c->mkdir;
@@ -296,6 +354,15 @@ restart:
 				}
 				memcpy(&path[j], buf, strlen(buf));
 				break;
+			case 'c': // core filename
+				p = conf.core_path ? strrchr(conf.core_path, '/') : NULL;
+				p = p ? p + 1 : conf.core_path ? conf.core_path : "stdin";
+				j -= strlen(p) - 1;
+				if (j < --i) {
+					goto too_long;
+				}
+				memcpy(&path[j], p, strlen(p));
+				break;
 			case 'Q': // Counter mark
 				j -= seq_len - 1;
 				if (j < --i) {
@@ -437,6 +504,10 @@ opened:	r->filter = NULL;
 		}
 	}
 
+	for (f = r->filter; f; f = f->next) {
+		evloop_child(&loop, f->pid, filter_reaped, r);
+	}
+
 	return 0;
 
 too_long:
@@ -469,58 +540,147 @@ static inline int unblockfd(int fd)
 	return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1 ? -1 : 0;
 }
 
-static inline int blockfd(int fd)
+/** The info dumper thread determined the PID. Called by the event loop. */
+static void pid_known(struct evloop_s *l, struct evloop_watch_s *w, unsigned events)
 {
-	int flags = fcntl(fd, F_GETFL, 0);
-	return fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == -1 ? -1 : 0;
+	eventfd_t value;
+
+	eventfd_read(w->fd, &value);
+	evloop_stop(l);
 }
 
-static inline ssize_t safe_read(int fd, void *buf, size_t count)
+/** Read more of the core head.
+ *  @param[in/out] head - the head, it's replaced by an allocated one
+ *  @param[in/out] len - number of bytes in the head
+ *  @param[in] size - size of the initial head buffer, which isn't allocated
+ *  @param[in] end - requested head size
+ *  @return 0 if the head was read up to end, -1 otherwise */
+static int extend_core_head(char **head, ssize_t *len, size_t size, long long end)
 {
-	ssize_t size = 0, rtn;
+	ssize_t rtn;
+	char *tmp;
+
+	if (end > CORE_HEAD_MAX) {
+		return -1;
+	}
 
-repeat: rtn = read(fd, (char*)buf + size, count - size);
+	tmp = *len > (ssize_t)size ? realloc(*head, end) : malloc(end);
+	if (!tmp) {
+		log_warn("Can't allocate %lld bytes for core notes", end);
+		return -1;
+	}
+
+	if (*len <= (ssize_t)size) {
+		memcpy(tmp, *head, *len);
+	}
+	*head = tmp;
+
+	rtn = safe_read(0, tmp + *len, end - *len);
 	if (rtn > 0) {
-		size += rtn;
-		if (size < count) {
-			goto repeat;
-		}
-	} else if (rtn < 0) {
-		if (errno == EINTR) {
-			goto repeat;
-		} else if (size == 0) {
-			return rtn;
-		}
+		*len += rtn;
 	}
-	return size;
+
+	return *len < end ? -1 : 0;
 }
 
-static inline ssize_t safe_write(int fd, const void *buf, size_t count)
+/** Read the beginning of the core including all its notes.
+ *  @param[in/out] head - buffer of the given size, it's replaced by an
+ *                        allocated one if notes don't fit in it
+ *  @param[in] size - size of the head buffer
+ *  @return Number of read bytes or -1 on error */
+static ssize_t read_core_head(char **head, size_t size)
 {
-	ssize_t size = 0, rtn;
+	long long end;
+	ssize_t len;
 
-repeat: rtn = write(fd, (const char*)buf + size, count - size);
-	if (rtn > 0) {
-		size += rtn;
-		if (size < count) {
-			goto repeat;
-		}
-	} else if (rtn < 0) {
-		if (errno == EINTR) {
-			goto repeat;
-		} else if (size == 0) {
-			return rtn;
+	len = safe_read(0, *head, size);
+	if (len < (ssize_t)size) {
+		return len;
+	}
+
+	// Program headers of processes with many mappings don't fit in the
+	// buffer, they are read first to find the end of notes
+	while ((end = elf_core_notes_end(*head, len)) < 0
+	       && (end = elf_core_phdrs_end(*head, len)) > len) {
+		if (extend_core_head(head, &len, size, end)) {
+			return len;
 		}
 	}
-	return size;
+
+	if (end > len) {
+		extend_core_head(head, &len, size, end);
+	}
+
+	return len;
 }
 
+#ifdef CRASHINFO_WITH_LIBUNWIND
+/** Store the head of the core to an anonymous file, the unwinder reads
+ *  headers and notes from it.
+ *  @return File descriptor or -1 on error */
+static int core_head_file(const char *head, size_t len)
+{
+	int fd;
+
+	fd = memfd_create("crashinfo-core-head", MFD_CLOEXEC);
+	if (fd < 0) {
+		log_err("Can't create core head file: %s", strerror(errno));
+		return -1;
+	}
+
+	if (safe_write(fd, head, len) != len) {
+		log_err("Can't write core head file: %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+#endif // CRASHINFO_WITH_LIBUNWIND
+
+/** Get PID of the crashed process from NT_PRSTATUS notes of the core.
+ *  @return PID or -1 if it's not available */
+static int core_pid(const char *head, size_t len)
+{
+	int pids[4096], count, pid;
+
+	count = elf_core_pids(head, len, pids, ARRAY_SIZE(pids));
+	if (count <= 0) {
+		return -1;
+	}
+
+	pid = proc_guess_pid(pids, count);
+	log_dbg("Core notes returned PID: %d", pid);
+	return pid;
+}
+
+/** Long forms of command line options. */
+static const struct option long_options[] = {
+	{ "symbolize", no_argument, NULL, 'S' },
+	{ "yaml", no_argument, NULL, 'Y' },
+	{ "reprocess", required_argument, NULL, 'R' },
+	{ "daemon", no_argument, NULL, 'D' },
+	{ "help", no_argument, NULL, 'h' },
+	{}
+};
+
 int main(int argc, char *argv[])
 {
 	static char buf[32*1024];
 	struct conf_multi_str_s *str;
-	int buf_read = 0, buf_write = 0;
+	int buf_read = 0;
+	char *head;
 	int info_pipe[2] = { -1, -1 };
+	struct unw_input_s unw_input = { -1, NULL };
+	struct evloop_watch_s pid_watch;
+	struct copy_s *copy;
+	bool core_file;
+	bool symbolize_only = false;
+	bool convert_only = false;
+	const char *reprocess_dir = NULL;
+	bool daemon_mode = false;
+	int proc_pidfd = -1;
+	struct stat st;
 	pthread_t tid;
 	int c, rtn;
 	char *end;
@@ -529,14 +689,11 @@ int main(int argc, char *argv[])
 
 	openlog("crash-info", LOG_PID | LOG_NDELAY, LOG_DAEMON);
 
-	clock_gettime(CLOCK_REALTIME, &run.start_tp);
-	gmtime_r(&run.start_tp.tv_sec, &run.start_tm);
-
 	// Ignore pipe signal, which arrives when a filter terminates before
 	// processing the whole stream
 	signal(SIGPIPE, SIG_IGN);
 
-	while (-1 != (c = getopt(argc, argv, "c:o:P:h"))) {
+	while (-1 != (c = getopt_long(argc, argv, "c:o:P:F:SYR:Dh", long_options, NULL))) {
 		switch (c) {
 			case 'c':
 				if (parse_file(optarg)) {
@@ -558,8 +715,32 @@ int main(int argc, char *argv[])
 					return exitcode;
 				}
 				break;
+			case 'F':
+				run.pidfd = strtol(optarg, &end, 10);
+				if (*end != '\0' || run.pidfd < 0) {
+					log_crit("Invalid pidfd specified on the command line: %s", optarg);
+					return exitcode;
+				}
+				break;
+			case 'S':
+				symbolize_only = true;
+				break;
+			case 'Y':
+				convert_only = true;
+				break;
+			case 'R':
+				reprocess_dir = optarg;
+				break;
+			case 'D':
+				daemon_mode = true;
+				break;
 			case 'h':
-				printf("Usage: %s [-h] [-P PID] [-c config_file] [-o option=value]\n", argv[0]);
+				printf("Usage: %s [-h] [-P PID] [-F pidfd] [-c config_file] [-o option=value]\n"
+				       "       %s [-c config_file] [-o option=value] -S info_file...\n"
+				       "       %s [-c config_file] [-o option=value] -Y info_file...\n"
+				       "       %s [-c config_file] [-o option=value] -R core_dir\n"
+				       "       %s [-c config_file] [-o option=value] -D\n",
+				       argv[0], argv[0], argv[0], argv[0], argv[0]);
 				return 0;
 			case '?':
 				fprintf(stderr, "Unknown option, use %s -h for help\n", argv[0]);
@@ -567,6 +748,62 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (symbolize_only) {
+		symbolize(argc - optind, argv + optind);
+		return exitcode;
+	}
+
+	if (convert_only) {
+		convert_yaml(argc - optind, argv + optind);
+		return exitcode;
+	}
+
+	// Each core of the directory is processed by a child returning here
+	if (reprocess_dir && reprocess(reprocess_dir) <= 0) {
+		return exitcode;
+	}
+
+	// Each core passed to the daemon is processed by a child returning here
+	if (daemon_mode && daemon_serve() <= 0) {
+		return exitcode;
+	}
+
+	// The process of a pidfd is known, its PID isn't guessed
+	if (run.pidfd >= 0) {
+		fcntl(run.pidfd, F_SETFD, FD_CLOEXEC);
+		rtn = proc_pidfd_pid(run.pidfd);
+		if (rtn < 0) {
+			close(run.pidfd);
+			run.pidfd = -1;
+		} else {
+			if (run.pid != -1 && run.pid != rtn) {
+				log_warn("PID %d differs from PID %d of the pidfd", run.pid, rtn);
+			}
+			run.pid = rtn;
+		}
+	}
+
+	// Let the daemon process the core, if it's running
+	if (!daemon_mode && !reprocess_dir && conf.daemon_socket && !conf.core_path
+	    && !daemon_handoff()) {
+		return exitcode;
+	}
+
+	// Must be done before any thread is created
+	if (evloop_init(&loop)) {
+		return exitcode;
+	}
+
+	pid_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	gate_efd = eventfd(0, EFD_CLOEXEC);
+	if (pid_efd < 0 || gate_efd < 0) {
+		log_crit("Can't create event descriptor: %s", strerror(errno));
+		return exitcode;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &run.start_tp);
+	gmtime_r(&run.start_tp.tv_sec, &run.start_tm);
+
 	log_dbg("Configuration before reading /proc/<PID>:");
 	log_conf();
 
@@ -579,51 +816,78 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	core_file = !fstat(0, &st) && S_ISREG(st.st_mode);
+
+	// Read the beginning of the core, PID is usually found in its notes
+	head = buf;
+	buf_read = read_core_head(&head, sizeof buf);
+	if (buf_read <= 0) {
+		log_crit("Can't read the core: %s", buf_read ? strerror(errno) : "Empty");
+	} else if (run.pid == -1) {
+		ACCESS_ONCE(run.pid) = core_pid(head, buf_read);
+	}
+
 	// Create info dump thread (may be needed to obtain PID)
-	pthread_mutex_lock(&dump_lock);
-	if (pipe2(info_pipe, O_CLOEXEC) || unblockfd(info_pipe[1])) {
-		log_crit("Can't create info pipe: %s", strerror(errno));
-	} else {
-		int err = pthread_create(&tid, NULL, info_dump_thread, &info_pipe[0]);
+	copy = copy_open(&loop, head, buf_read > 0 ? buf_read : 0);
+	if (!copy) {
+		goto err0;
+	}
+#ifdef CRASHINFO_WITH_LIBUNWIND
+	if (core_file) {
+		// The unwinder reads the mapped core file directly
+		unw_input.capture = capture_map(0);
+		if (unw_input.capture) {
+			unw_input.fd = fcntl(0, F_DUPFD_CLOEXEC, 0);
+			if (unw_input.fd < 0) {
+				capture_free(unw_input.capture);
+				unw_input.capture = NULL;
+			}
+		}
+	} else if (buf_read > 0 && conf.core_stack_window > 0) {
+		// Capture only core regions the unwinder needs, if the core can be parsed
+		unw_input.capture = capture_plan(head, buf_read, conf.core_stack_window);
+		if (unw_input.capture) {
+			unw_input.fd = core_head_file(head, buf_read);
+			if (unw_input.fd < 0) {
+				capture_free(unw_input.capture);
+				unw_input.capture = NULL;
+			} else {
+				copy_capture(copy, unw_input.capture);
+			}
+		}
+	}
+#endif // CRASHINFO_WITH_LIBUNWIND
+	if (unw_input.fd < 0) {
+		if (pipe2(info_pipe, O_CLOEXEC) || unblockfd(info_pipe[1])) {
+			log_crit("Can't create info pipe: %s", strerror(errno));
+		} else {
+			unw_input.fd = info_pipe[0];
+		}
+	}
+	if (unw_input.fd >= 0) {
+		int err = pthread_create(&tid, NULL, info_dump_thread, &unw_input);
 		if (err) {
 			log_crit("Failed to create dumping thread: %s", strerror(err));
 			tid = -1;
-		} else {
-			int tries;
-			buf_read = safe_read(0, buf, sizeof buf);
-			buf_write = 0;
-			if (buf_read <= 0) {
-				log_crit("Can't read the core: %s", strerror(err));
-			} else for (tries = buf_write = 0; tries < 50;) {
-				// We do not know how much data we must feed the unwinder to get
-				// the PID. We will feed it until one of the following occurs:
-				//  - We get the PID (victory)
-				//  - We run out of the buffer
-				//  - Feeding fails with an error other than EAGAIN
-				//  - We reach maximum number of attempts
-				rtn = safe_write(info_pipe[1], buf + buf_write, buf_read - buf_write);
-				if (rtn > 0) {
-					buf_write += rtn;
-					tries = 0;
-				}
+		} else if (info_pipe[1] >= 0) {
+#ifdef CRASHINFO_WITH_LIBUNWIND
+			copy_feed(copy, info_pipe[1]);
+#else
+			close(info_pipe[1]);
+			info_pipe[1] = -1;
+#endif // CRASHINFO_WITH_LIBUNWIND
+		}
+	}
 
-				if (ACCESS_ONCE(run.pid) != -1) {
-					break;
-				}
-				
-				if (rtn < 0) {
-					if (errno != EAGAIN) break;
-
-					// We are not able to distinguish the case when the unwinder
-					// is just too busy from the case where it wants to read more
-					// data than we have, so we will just give it some time.
-					// We could address this by tuning RT priorities, but we prefer
-					// not to disturb RT tasks for now.
-					// Maybe, this could be made configurable.
-					usleep(10000);
-					tries++;
-				}
-			}
+	if (buf_read > 0 && run.pid == -1 && info_pipe[1] >= 0) {
+		// The PID wasn't found in notes of the head, which is all the
+		// unwinder gets before copy_start(). Give the unwinder
+		// PID_TIMEOUT ms to find the PID in the head by its own parser,
+		// it blocks if it needs more of the core, so waiting longer
+		// wouldn't help.
+		if (!evloop_add(&loop, &pid_watch, pid_efd, EPOLLIN, pid_known, NULL)) {
+			evloop_run(&loop, PID_TIMEOUT);
+			evloop_del(&loop, &pid_watch);
 		}
 	}
 
@@ -633,65 +897,81 @@ int main(int argc, char *argv[])
 			static char proc_path[16];
 			snprintf(proc_path, sizeof proc_path, "/proc/%d/", run.pid);
 			conf.proc.path = proc_path;
+			proc_pidfd = run.pidfd;
 		}
 
 		if (conf.proc.path) {
 			run.proc_fd = open(conf.proc.path, O_RDONLY | O_CLOEXEC | O_DIRECTORY);
+			// The PID wasn't reused, if the process still exists
+			if (run.proc_fd >= 0 && proc_pidfd >= 0 && proc_pidfd_check(proc_pidfd)) {
+				close(run.proc_fd);
+				run.proc_fd = -1;
+				errno = ESRCH;
+			}
 			if (run.proc_fd < 0) {
 				log_err("Can't open proc directory '%s': %s",
 						conf.proc.path, strerror(errno));
-			} else if (read_proc_info()) {
-				log_err("Failed to read /proc info");
-			} else {	
-				log_dbg("Configuration after reading %s:", conf.proc.path);
-				log_conf();
+			} else {
+				// Files dumped to the info are read while the core is drained
+				proc_snapshot_start();
+				if (read_proc_info()) {
+					log_err("Failed to read /proc info");
+				} else {
+					log_dbg("Configuration after reading %s:", conf.proc.path);
+					log_conf();
+				}
 			}
 		} else {
 			log_err("Can't determine /proc path");
 		}
 	}
 
+	// Paths in core notes are in the mount namespace of the process, so
+	// they are used in the auto mode only when /proc doesn't give them
+	if (buf_read > 0 && (conf.proc.mappings_source == CONF_MAPPINGS_SOURCE_CORE
+	    || (conf.proc.mappings_source == CONF_MAPPINGS_SOURCE_AUTO
+	    && (run.proc_fd < 0 || !conf.proc.exe || !conf.proc.maps)))
+	    && read_core_info(head, buf_read)) {
+		if (conf.proc.mappings_source == CONF_MAPPINGS_SOURCE_CORE) {
+			log_err("Failed to read mappings from core notes");
+		}
+	}
+
 	// Open info outputs
 	open_output(&conf.info, &run.info);
 	if (run.info.output_fd < 0) {
 		goto err0;
 	}
-	run.info.output = fdopen(run.info.output_fd, "w");
+	stream_prepare(&conf.info, &run.info, NULL, 0);
+	run.info.output = info_out_open(&run.info);
 	if (!run.info.output) {
 		log_crit("Failed to open output: %s", strerror(errno));
 		goto err1;
 	}
-	setvbuf(run.info.output, NULL, _IOFBF, OUT_BUFSIZE);
 
-	// Open core output
-	open_output(&conf.core, &run.core);
-	if (run.core.output_fd < 0) {
-		goto err1;
-	}
-	
-	pthread_mutex_unlock(&dump_lock);
-
-	if (info_pipe[1] >= 0) {
-#ifdef CRASHINFO_WITH_LIBUNWIND
-		blockfd(info_pipe[1]);
-		safe_write(run.core.output_fd, buf, buf_read);
-		if (buf_read > buf_write) {
-			safe_write(info_pipe[1], buf + buf_write, buf_read - buf_write);
+	// Open core output, a core file is copied only if the output is set
+	// or the unwinder reads it trough the pipe
+	if (core_file && !conf.core.output && info_pipe[1] < 0) {
+		log_dbg("Core output is not set, the core file is not copied");
+		run.core.output_fd = -1;
+	} else {
+		open_output(&conf.core, &run.core);
+		if (run.core.output_fd < 0) {
+			goto err1;
 		}
-#else
-		close(info_pipe[1]);
-#endif // CRASHINFO_WITH_LIBUNWIND
+		stream_prepare(&conf.core, &run.core, head, buf_read > 0 ? buf_read : 0);
+	}
+	if (head != buf) {
+		free(head);
 	}
 
-	do {
-		rtn = safe_read(0, buf, sizeof buf);
-		if (rtn > 0) {
-			safe_write(run.core.output_fd, buf, rtn);
-			if (info_pipe[1] >= 0) {
-				safe_write(info_pipe[1], buf, rtn);
-			}
-		}
-	} while (rtn > 0);
+	// Let the info dumper thread write the info
+	eventfd_write(gate_efd, 1);
+
+	if (run.core.output_fd >= 0 && !copy_start(copy, &run.core)) {
+		evloop_run(&loop, -1);
+	}
+	copy_close(copy);
 
 	close(info_pipe[1]);
 
@@ -699,6 +979,7 @@ int main(int argc, char *argv[])
 	if (rtn) {
 		log_err("Failed to join dumping thread: %s", strerror(rtn));
 	}
+	capture_free(unw_input.capture);
 
 	close_output(&conf.core, &run.core);
 	close_output(&conf.info, &run.info);
@@ -713,8 +994,13 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	// Reap filters
+	evloop_run(&loop, -1);
+	evloop_destroy(&loop);
+
 	return exitcode;
 
 err1:	close_output(&conf.info, &run.info);
+	evloop_run(&loop, -1);
 err0:	return exitcode;
 }
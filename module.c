@@ -0,0 +1,186 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#include <sys/mman.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "module.h"
+#include "conf.h"
+#include "log.h"
+
+/** Modules sorted by the address. */
+struct module_s *modules;
+int module_count;
+
+/** Serializes loading of module data by unwinder workers. */
+static pthread_mutex_t module_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Order modules by the start address. */
+static int module_cmp(const void *a, const void *b)
+{
+	const struct module_s *ma = a, *mb = b;
+
+	return ma->start < mb->start ? -1 : ma->start > mb->start;
+}
+
+/** Read images of executable mappings of the crashed process.
+ *  @return 0 on success, -1 on error */
+int module_init(void)
+{
+	const struct conf_multi_mapping_s *map;
+	uint64_t page = sysconf(_SC_PAGESIZE);
+	uint64_t vaddr, memsz;
+	struct module_s *m;
+	int count = 0;
+
+	if (modules) {
+		return 0;
+	}
+
+	for (map = conf.proc.maps; map; map = map->next) {
+		count++;
+	}
+
+	modules = calloc(count ?: 1, sizeof *modules);
+	if (!modules) {
+		log_err("Can't allocate memory for modules");
+		return -1;
+	}
+
+	for (map = conf.proc.maps; map; map = map->next) {
+		m = &modules[module_count++];
+		m->file = map->file;
+		m->start = map->addr;
+		m->end = map->addr + 1;
+
+		if (elf_image_open(map->file, &m->image)) {
+			continue;
+		}
+
+		// The mapping starts at the page containing the executable segment
+		if (!elf_image_text(&m->image, &vaddr, &memsz)) {
+			m->bias = map->addr - (vaddr & ~(page - 1));
+			m->end = m->bias + vaddr + memsz;
+		}
+
+		if (elf_image_build_id(&m->image, m->build_id, sizeof m->build_id)) {
+			log_dbg("'%s' has no build-id", m->file);
+		}
+	}
+
+	qsort(modules, module_count, sizeof *modules, module_cmp);
+	return 0;
+}
+
+/** Find the module containing the address.
+ *  @return The module or NULL */
+struct module_s *module_find(uint64_t addr)
+{
+	int lo = 0, hi = module_count;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (modules[mid].start <= addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (lo == 0 || addr >= modules[lo - 1].end) {
+		return NULL;
+	}
+
+	return &modules[lo - 1];
+}
+
+/** Get data derived from the module image. The data are read from the cache
+ *  or built and stored to the cache the first time they are needed.
+ *  @param[in] m - the module
+ *  @param[in,out] d - the data of the module
+ *  @param[in] kind - kind of the data
+ *  @return The data or NULL if they aren't available */
+const void *module_get(struct module_s *m, struct module_data_s *d,
+		const struct module_kind_s *kind)
+{
+	size_t size;
+	void *data, *map;
+
+	if (__atomic_load_n(&d->loaded, __ATOMIC_ACQUIRE)) {
+		return d->entry.data;
+	}
+
+	pthread_mutex_lock(&module_lock);
+	if (d->loaded) {
+		goto out;
+	}
+
+	if (!cache_map(m->build_id, kind->name, &d->entry)) {
+		if (kind->check(d->entry.data, d->entry.size)) {
+			(*kind->hits)++;
+			goto done;
+		}
+		log_notice("Invalid %s data of '%s' in the cache", kind->name, m->file);
+		cache_unmap(&d->entry);
+	}
+	(*kind->misses)++;
+
+	data = kind->build(m, &size);
+	if (!data) {
+		log_dbg("Can't build %s data of '%s'", kind->name, m->file);
+		goto done;
+	}
+
+	if (cache_store(m->build_id, kind->name, data, size)
+	    || cache_map(m->build_id, kind->name, &d->entry)) {
+		// Keep the data in the memory the cache would map them to
+		map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (map != MAP_FAILED) {
+			memcpy(map, data, size);
+			d->entry.data = map;
+			d->entry.size = size;
+		}
+	}
+	free(data);
+
+done:	__atomic_store_n(&d->loaded, 1, __ATOMIC_RELEASE);
+out:	pthread_mutex_unlock(&module_lock);
+	return d->entry.data;
+}
+
+/** Release all modules. */
+void module_free(void)
+{
+	int i;
+
+	for (i = 0; i < module_count; i++) {
+		cache_unmap(&modules[i].unwtab.entry);
+		cache_unmap(&modules[i].symtab.entry);
+		elf_image_close(&modules[i].image);
+	}
+	free(modules);
+	modules = NULL;
+	module_count = 0;
+}
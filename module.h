@@ -0,0 +1,82 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifndef MODULE_H
+#define MODULE_H
+
+#include <stdint.h>
+
+#include "elfimage.h"
+#include "cache.h"
+
+/** Data derived from a module image, cached by its build-id. */
+struct module_data_s {
+	/** The data, mapped from the cache or anonymous memory. */
+	struct cache_entry_s entry;
+	/** The data were looked for. */
+	int loaded;
+};
+
+struct module_s;
+
+/** Kind of data derived from module images. */
+struct module_kind_s {
+	/** Suffix of cache files. */
+	const char *name;
+	/** Check the data are valid, returns non-zero if they are. */
+	int (*check)(const void *data, size_t size);
+	/** Build the data from the image, returns allocated data or NULL. */
+	void *(*build)(const struct module_s *m, size_t *size);
+	/** Counters of data found in the cache and built. */
+	unsigned long long *hits, *misses;
+};
+
+/** Executable or shared library mapped by the crashed process. */
+struct module_s {
+	/** Mapped image file name. */
+	const char *file;
+	/** Address range of the executable segment. */
+	uint64_t start, end;
+	/** Difference between run time and link time addresses. */
+	uint64_t bias;
+	/** Hexadecimal build-id or an empty string. */
+	char build_id[65];
+	/** The image, not mapped if it can't be read. */
+	struct elf_image_s image;
+	/** Unwind table, see unwtab.h. */
+	struct module_data_s unwtab;
+	/** Symbol table, see symtab.h. */
+	struct module_data_s symtab;
+};
+
+extern struct module_s *modules;
+extern int module_count;
+
+int module_init(void);
+
+struct module_s *module_find(uint64_t addr);
+
+const void *module_get(struct module_s *m, struct module_data_s *d,
+		const struct module_kind_s *kind);
+
+void module_free(void);
+
+#endif // MODULE_H
@@ -20,10 +20,11 @@
  */
 
 #define _ATFILE_SOURCE
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <pthread.h>
 #include <inttypes.h>
 #include <dirent.h>
-#include <assert.h>
 #include <limits.h>
 #include <unistd.h>
 #include <string.h>
@@ -32,17 +33,58 @@
 #include <errno.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <elf.h>
 
+#include "elfcore.h"
 #include "util.h"
 #include "info.h"
 #include "conf.h"
 #include "log.h"
 
+/** Status files of tasks are read by threads, each takes this many tasks
+ *  at once and a thread is started for each this many tasks at most. */
+#define PROC_TASK_BATCH 256
+
+/** Files of the /proc snapshot are read by threads, each takes this many
+ *  files at once and a thread is started for each this many files at most. */
+#define PROC_SNAP_BATCH 64
+
+/** Size of chunks of snapshot arenas. */
+#define PROC_SNAP_CHUNK (256*1024)
+
+/** Free space of an arena chunk needed for a read. */
+#define PROC_SNAP_READ 4096
+
+/** Task of the process, its namespace PID is read from its status. */
+struct proc_task_s {
+	int pid, nspid;
+	/** Errno of the failed read, -1 if the status is malformed and 0 if
+	 *  the NSpid line is missing or the status is read. */
+	int error;
+};
+
+/** Tasks shared by threads reading them. */
 static struct {
-	long pid, nspid;
+	struct proc_task_s *all;
+	int count, next;
+	/** Descriptor of the task directory. */
+	int dir;
+} tasks;
+
+/** Map of namespace PIDs to PIDs, an open addressing hash table with
+ *  linear probing. Empty slots have zero pid. */
+static struct {
+	int pid, nspid;
 } *pidmap;
 
-static int pidmap_count;
+/** The table has 1 << pidmap_bits slots. */
+static int pidmap_bits;
+
+/** Slot of the namespace PID in the map. */
+static inline unsigned pidmap_slot(int nspid)
+{
+	return (uint32_t)nspid * 0x9e3779b1u >> (32 - pidmap_bits);
+}
 
 FILE *open_proc(const char *name)
 {
@@ -64,59 +106,132 @@ FILE *open_proc(const char *name)
 	return f;
 }
 
-int read_proc_info(void)
+/** Find the NSpid line of a task status. It follows the Groups line, which
+ *  may be longer than the buffer, so the file is read until the line is found.
+ *  @param[in] fd - the status file
+ *  @param[out] buf - buffer the line is read to
+ *  @param[in] size - size of the buffer
+ *  @param[out] error - errno of the failed read, -1 if the line is malformed
+ *  @return The line terminated by a new line or NULL if it's not found */
+static char *read_task_nspid(int fd, char *buf, size_t size, int *error)
 {
-	char buf[PATH_MAX + 256];
-	struct dirent *de;
-	int c, fd;
-	DIR *d;
-
-	// Read /proc/PID/exe
-	if (!conf.proc.exe) {
-		c = readlinkat(run.proc_fd, "exe", buf, sizeof buf - 1);
-		if (c >= 0) {
-			conf.proc.exe = strndup(buf, c);
+	char *line, *end;
+	size_t len = 0;
+	off_t off = 0;
+	int bol = 1;
+	ssize_t rtn;
+
+	for (;;) {
+		rtn = pread(fd, buf + len, size - 1 - len, off);
+		if (rtn < 0) {
+			*error = errno;
+			return NULL;
 		}
-		if (!conf.proc.exe) {
-			log_crit("Can't get executable path: %s", strerror(errno));
-			return -1;
+		off += rtn;
+		len += rtn;
+		buf[len] = '\0';
+
+		if (bol && !strncmp(buf, "NSpid:", 6)) {
+			line = buf;
+		} else if ((line = strstr(buf, "\nNSpid:"))) {
+			line++;
 		}
-	}
 
-	// Read /proc/PID/maps
-	if (!conf.proc.maps) {
-		FILE *f = open_proc("maps");
-
-		if (!f) {
-			log_crit("Can't open mappings: %s", strerror(errno));
-			return -1;
+		if (line && strchr(line, '\n')) {
+			return line;
+		} else if (!rtn) {
+			// The end of the file
+			*error = line ? -1 : 0;
+			return NULL;
+		} else if (line) {
+			if (line == buf && len == size - 1) {
+				*error = -1;
+				return NULL;
+			}
+			// Keep the beginning of the line
+			len -= line - buf;
+			memmove(buf, line, len);
+			bol = 1;
+		} else if ((end = strrchr(buf, '\n'))) {
+			// Keep the last line, it may be the beginning of NSpid
+			len -= end + 1 - buf;
+			memmove(buf, end + 1, len);
+			bol = 1;
+		} else {
+			// The middle of a long line
+			len = 0;
+			bol = 0;
 		}
+	}
+}
 
-		while (fgets(buf, sizeof buf, f)) {
-			int file, end, rtn;
-			char exec, tmp;
-			uint64_t addr;
-
-			rtn = sscanf(buf, "%jx-%*x %*c%*c%c%*c %*x %*s %*d %n%c%*[^\n]",
-					&addr, &exec, &file, &tmp);
-			if (3 != rtn || exec != 'x' || tmp != '/') {
+/** Read namespace PIDs of tasks until all are taken. Nothing is logged,
+ *  errors are stored in the tasks. */
+static void *read_tasks_worker(void *arg)
+{
+	char path[24], buf[4096], *line, *nspid, *end;
+	struct proc_task_s *t;
+	int i, last, fd;
+
+	while ((i = __atomic_fetch_add(&tasks.next, PROC_TASK_BATCH, __ATOMIC_RELAXED)) < tasks.count) {
+		last = i + PROC_TASK_BATCH < tasks.count ? i + PROC_TASK_BATCH : tasks.count;
+		for (t = &tasks.all[i]; t < &tasks.all[last]; t++) {
+			snprintf(path, sizeof path, "%d/status", t->pid);
+			fd = openat(tasks.dir, path, O_RDONLY | O_CLOEXEC);
+			if (fd < 0) {
+				t->error = errno;
 				continue;
 			}
 
-			end = snprintf(buf, sizeof buf, "proc_maps=%#" PRIx64 ":", addr);
-			assert(end < file);
-			memmove(buf + end, buf + file, strlen(buf + file) + 1);
+			// A single read gets NSpid, unless there are many groups
+			line = read_task_nspid(fd, buf, sizeof buf, &t->error);
+			close(fd);
+			if (!line) {
+				continue;
+			}
+			end = strchr(line, '\n');
 
-			if (parse_line(buf)) {
-				log_err("Failed to parse '%s'", buf);
-				fclose(f);
-				return -1;
+			// The last PID on the line is in the innermost namespace
+			for (nspid = end; nspid > line && nspid[-1] != ' ' && nspid[-1] != '\t'; nspid--);
+			t->nspid = strtol(nspid, &nspid, 10);
+			if (nspid != end || t->nspid <= 0) {
+				t->error = -1;
 			}
 		}
-		fclose(f);
 	}
 
-	// Read /proc/PID/task/TID/status to map namespace and toplevel PIDs
+	return arg;
+}
+
+/** Add the task to the map.
+ *  @return 0 on success, -1 if the namespace PID is already mapped */
+static int pidmap_add(int pid, int nspid)
+{
+	unsigned i, mask = (1u << pidmap_bits) - 1;
+
+	for (i = pidmap_slot(nspid); pidmap[i].pid; i = (i + 1) & mask) {
+		if (pidmap[i].nspid == nspid) {
+			return -1;
+		}
+	}
+	pidmap[i].pid = pid;
+	pidmap[i].nspid = nspid;
+
+	return 0;
+}
+
+/** Read namespace PIDs of all tasks of the process and build their map.
+ *  Status files are read in parallel by proc_threads threads.
+ *  @return 0 on success, -1 on error */
+static int read_tasks(void)
+{
+	struct proc_task_s *all, *t;
+	pthread_t *tids = NULL;
+	int i, size, started, workers, fd;
+	struct dirent *de;
+	char *end;
+	DIR *d;
+
 	fd = openat(run.proc_fd, "task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
 	if (fd < 0) {
 		log_err("Can't open '%s/task': %s", conf.proc.path, strerror(errno));
@@ -130,125 +245,749 @@ int read_proc_info(void)
 		return -1;
 	}
 
-	c = 0;
+	tasks.dir = fd;
+	tasks.count = tasks.next = size = 0;
+	tasks.all = NULL;
 	while (NULL != (de = readdir(d))) {
-		if (isdigit(de->d_name[0])) {
-			FILE *f;
-
-			snprintf(buf, sizeof buf, "task/%s/status", de->d_name);
-			fd = openat(run.proc_fd, buf, O_RDONLY);
-			if (fd < 0) {
-				log_err("Can't open '%s': %s", buf, strerror(errno));
+		if (!isdigit(de->d_name[0])) {
+			continue;
+		}
+		if (tasks.count == size) {
+			size = size * 2 ?: PROC_TASK_BATCH;
+			all = realloc(tasks.all, size * sizeof *all);
+			if (!all) {
+				log_crit("Can't allocate memory for %d tasks", size);
 				goto err;
 			}
-			f = fdopen(fd, "r");
-			if (!f) {
-				log_err("Can't open '%s': %s", buf, strerror(errno));
-				close(fd);
-				goto err;
+			tasks.all = all;
+		}
+		t = &tasks.all[tasks.count++];
+		t->pid = strtol(de->d_name, &end, 10);
+		t->nspid = t->error = 0;
+		if (*end != '\0') {
+			log_notice("Malformed task '%s'", de->d_name);
+			goto err;
+		}
+	}
+
+	// The calling thread reads as well, workers help with big processes
+	workers = conf.proc.threads > 0 ? conf.proc.threads : sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers > (tasks.count - 1) / PROC_TASK_BATCH) {
+		workers = (tasks.count - 1) / PROC_TASK_BATCH;
+	}
+	if (workers > 0) {
+		tids = calloc(workers, sizeof *tids);
+	}
+	for (started = 0; tids && started < workers; started++) {
+		if (pthread_create(&tids[started], NULL, read_tasks_worker, NULL)) {
+			break;
+		}
+	}
+	read_tasks_worker(NULL);
+	for (i = 0; i < started; i++) {
+		pthread_join(tids[i], NULL);
+	}
+	free(tids);
+
+	for (t = tasks.all; t < &tasks.all[tasks.count]; t++) {
+		if (t->error > 0) {
+			log_err("Can't read '%s/task/%d/status': %s", conf.proc.path,
+					t->pid, strerror(t->error));
+			goto err;
+		} else if (t->error < 0) {
+			log_notice("Malformed NSpid of task %d", t->pid);
+			goto err;
+		}
+	}
+
+	// Twice as many slots as tasks keep probe sequences short
+	free(pidmap);
+	for (pidmap_bits = 4; 1 << pidmap_bits < 2 * tasks.count; pidmap_bits++);
+	pidmap = calloc(1 << pidmap_bits, sizeof *pidmap);
+	if (!pidmap) {
+		log_crit("Can't allocate memory for the PID map");
+		goto err;
+	}
+	for (t = tasks.all; t < &tasks.all[tasks.count]; t++) {
+		if (t->nspid && pidmap_add(t->pid, t->nspid)) {
+			log_notice("Task %d has a duplicate NSpid %d", t->pid, t->nspid);
+		}
+	}
+
+	free(tasks.all);
+	closedir(d);
+	return 0;
+
+err:	free(tasks.all);
+	closedir(d);
+	return -1;
+}
+
+/** Parse a hexadecimal number.
+ *  @return The character after the number or NULL if there are no digits */
+static const char *parse_hex(const char *p, uint64_t *value)
+{
+	const char *start = p;
+	unsigned digit;
+
+	for (*value = 0; ; p++) {
+		digit = *p - '0';
+		if (digit > 9) {
+			digit = (*p | 0x20) - 'a';
+			if (digit > 5) {
+				break;
 			}
+			digit += 10;
+		}
+		*value = *value << 4 | digit;
+	}
 
-			while (fgets(buf, sizeof buf, f)) {
-				char *nspid, *end;
+	return p == start ? NULL : p;
+}
 
-				if (strncmp(buf, "NSpid:", 6)) continue;
+/** Add executable mappings of images from /proc/PID/maps to proc_maps.
+ *  Lines are "<start>-<end> <perms> <offset> <dev> <inode>   <path>".
+ *  @return 0 on success, -1 on error */
+static int read_maps(void)
+{
+	const char *line, *eol, *p;
+	uint64_t addr, end;
+	size_t size, len;
+	char *data;
+	int i, fd;
+
+	fd = openat(run.proc_fd, "maps", O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || NULL == (data = read_all(fd, &size))) {
+		log_crit("Can't open mappings: %s", strerror(errno));
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	close(fd);
 
-				nspid = strrchr(buf, ' ');
-				if (!nspid) {
-					nspid = strrchr(buf, '\t');
-					if (!nspid) {
-						goto malformed;
-					}
-				}
+	for (line = data; line < data + size; line = eol + 1) {
+		eol = memchr(line, '\n', data + size - line) ?: data + size;
 
-				if (c == pidmap_count) {
-					pidmap_count = pidmap_count * 2 ?: 32;
-					pidmap = realloc(pidmap, pidmap_count * sizeof *pidmap);
-				}
+		p = parse_hex(line, &addr);
+		if (!p || *p != '-' || !(p = parse_hex(p + 1, &end))
+		    || eol - p < 5 || p[3] != 'x') {
+			continue;
+		}
 
-				pidmap[c].nspid = strtol(nspid + 1, &end, 10);
-				if (*end != '\n') {
-					goto malformed;
-				}
+		// Skip permissions, offset, device and inode
+		for (i = 0; i < 4; i++) {
+			for (; p < eol && *p == ' '; p++);
+			for (; p < eol && *p != ' '; p++);
+		}
+		for (; p < eol && *p == ' '; p++);
+		if (p == eol || *p != '/') {
+			continue;
+		}
 
-				pidmap[c].pid = strtol(de->d_name, &end, 10);
-				if (*end != '\0') {
-					goto malformed;
-				}
+		for (len = eol - p; len > 0 && isspace((unsigned char)p[len - 1]); len--);
+		if (!conf_mapping_add(addr, end, p, len)) {
+			log_crit("Can't allocate memory for mappings");
+			free(data);
+			return -1;
+		}
+	}
 
-				c++;
-				break;
+	free(data);
+	return 0;
+}
 
-malformed:			log_notice("Malformed line '%s'", buf);
-				fclose(f);
-				goto err;
+/** Find the file mapped at the address in NT_FILE mappings.
+ *  @return The file name or NULL if the address isn't mapped */
+static const char *core_file_at(const struct elf_file_s *files, int count, uint64_t addr)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (files[i].start <= addr && addr < files[i].end) {
+			return files[i].name;
+		}
+	}
+
+	return NULL;
+}
+
+/** Get mappings and the executable from NT_FILE and NT_AUXV notes of the
+ *  core, if they aren't configured.
+ *  @param[in] head - beginning of the core
+ *  @param[in] len - number of bytes available in head
+ *  @return 0 on success, -1 if notes don't describe them */
+int read_core_info(const void *head, size_t len)
+{
+	static const uint64_t exe_auxv[] = { AT_PHDR, AT_ENTRY };
+	struct elf_file_s *files;
+	const char *exe;
+	uint64_t addr;
+	int i, count;
+
+	count = elf_core_files(head, len, &files);
+	if (count < 0) {
+		log_info("Mappings are not available in core notes");
+		return -1;
+	}
+
+	if (!conf.proc.maps) {
+		for (i = 0; i < count; i++) {
+			if (!files[i].exec || files[i].name[0] != '/') {
+				continue;
+			}
+			if (!conf_mapping_add(files[i].start, files[i].end,
+					files[i].name, strlen(files[i].name))) {
+				log_crit("Can't allocate memory for mappings");
+				free(files);
+				return -1;
 			}
-			fclose(f);
 		}
 	}
-	pidmap_count = c;
-	closedir(d);
+
+	// The executable is mapped at its program headers and its entry point.
+	// AT_EXECFN points to the memory of the process, which isn't in the head.
+	for (i = 0; !conf.proc.exe && i < ARRAY_SIZE(exe_auxv); i++) {
+		if (!elf_core_auxv(head, len, exe_auxv[i], &addr)
+		    && (exe = core_file_at(files, count, addr))) {
+			conf.proc.exe = strdup(exe);
+		}
+	}
+	free(files);
+
+	if (!conf.proc.exe) {
+		log_info("Executable is not available in core notes");
+		return -1;
+	}
 
 	return 0;
+}
 
-err:	closedir(d);
-	return -1;
+int read_proc_info(void)
+{
+	char buf[PATH_MAX + 256];
+	int c;
+
+	// Mappings from core notes are not overridden
+	if (conf.proc.mappings_source == CONF_MAPPINGS_SOURCE_CORE) {
+		return read_tasks();
+	}
+
+	// Read /proc/PID/exe
+	if (!conf.proc.exe) {
+		c = readlinkat(run.proc_fd, "exe", buf, sizeof buf - 1);
+		if (c >= 0) {
+			conf.proc.exe = strndup(buf, c);
+		}
+		if (!conf.proc.exe) {
+			log_crit("Can't get executable path: %s", strerror(errno));
+			return -1;
+		}
+	}
+
+	// Read /proc/PID/maps
+	if (!conf.proc.maps && read_maps()) {
+		return -1;
+	}
+
+	// Read /proc/PID/task/TID/status to map namespace and toplevel PIDs
+	return read_tasks();
 }
 
+/** Map a PID in the namespace of the crashed process to the PID in the
+ *  namespace crashinfo runs in.
+ *  @param[in] nspid - PID in the namespace of the process
+ *  @return The PID or nspid if it isn't known */
 int proc_pid_map(int nspid)
 {
-	int i;
+	unsigned i, mask = (1u << pidmap_bits) - 1;
 
-	for (i = 0; i < pidmap_count; i++) {
-		if (pidmap[i].nspid == nspid)
-			return pidmap[i].pid;
+	if (pidmap) {
+		for (i = pidmap_slot(nspid); pidmap[i].pid; i = (i + 1) & mask) {
+			if (pidmap[i].nspid == nspid) {
+				return pidmap[i].pid;
+			}
+		}
 	}
 
 	log_warn("Failed to map NS pid %d", nspid);
 	return nspid;
 }
 
-int proc_dump(int dir, const struct conf_multi_str_s *files, int indent)
+/** Mapping of the index. */
+struct proc_map_s {
+	uint64_t start, end;
+	const char *file;
+};
+
+/** Mappings with known ends sorted by their address. */
+static struct proc_map_s *maps_index;
+static int maps_index_count;
+
+/** Some mappings aren't in the index, because their end isn't known. */
+static int maps_index_partial;
+
+static int proc_map_cmp(const void *a, const void *b)
 {
-	fputs(spaces(indent), run.info.output);
+	const struct proc_map_s *ma = a, *mb = b;
 
-	if (!files) {
-		fputs("proc_dump: ~\n", run.info.output);
+	return ma->start < mb->start ? -1 : ma->start > mb->start;
+}
+
+/** Build the index of proc_maps for looking up images by addresses. It must
+ *  be built before proc_maps_file() is called from several threads.
+ *  @return 0 on success, -1 on error */
+int proc_maps_index(void)
+{
+	const struct conf_multi_mapping_s *map;
+	int count = 0, sorted = 1;
+
+	free(maps_index);
+	maps_index = NULL;
+	maps_index_count = 0;
+	maps_index_partial = 1;
+
+	for (map = conf.proc.maps; map; map = map->next) {
+		count++;
+	}
+	maps_index = malloc((count ?: 1) * sizeof *maps_index);
+	if (!maps_index) {
+		log_err("Can't allocate memory for the mapping index");
+		return -1;
+	}
+
+	maps_index_partial = 0;
+	for (map = conf.proc.maps; map; map = map->next) {
+		if (map->end <= map->addr) {
+			maps_index_partial = 1;
+			continue;
+		}
+		if (maps_index_count && maps_index[maps_index_count - 1].start > map->addr) {
+			sorted = 0;
+		}
+		maps_index[maps_index_count].start = map->addr;
+		maps_index[maps_index_count].end = map->end;
+		maps_index[maps_index_count].file = map->file;
+		maps_index_count++;
+	}
+
+	// Mappings read from /proc are already sorted
+	if (!sorted) {
+		qsort(maps_index, maps_index_count, sizeof *maps_index, proc_map_cmp);
+	}
+
+	return 0;
+}
+
+/** Find the image mapped at the address.
+ *  @param[in] addr - the address
+ *  @param[out] file - the image or NULL if the address isn't in any mapping
+ *  @return 0 if the file is found or the address isn't mapped, -1 if it
+ *          can't be told, because ends of some mappings aren't known */
+int proc_maps_file(uint64_t addr, const char **file)
+{
+	int lo = 0, hi = maps_index_count;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (maps_index[mid].start <= addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (lo > 0 && addr < maps_index[lo - 1].end) {
+		*file = maps_index[lo - 1].file;
 		return 0;
 	}
 
-	if (conf.proc.ignore) {
-		fputs("proc_dump: ~ # proc_ignore = 1\n", run.info.output);
+	*file = NULL;
+	return maps_index_partial ? -1 : 0;
+}
+
+/** Guess the crashed process PID from PIDs of its threads. It's the lowest
+ *  PID, which has a /proc entry, or the lowest PID if none has it.
+ *  @param[in] pids - PIDs of threads
+ *  @param[in] count - number of PIDs
+ *  @return The PID */
+int proc_guess_pid(const int *pids, int count)
+{
+	int minpid = INT_MAX, minpid_fs = INT_MAX, i;
+	char buf[20];
+
+	for (i = 0; i < count; i++) {
+		if (pids[i] < minpid) {
+			minpid = pids[i];
+		}
+
+		snprintf(buf, sizeof buf, "/proc/%d", pids[i]);
+		if (pids[i] < minpid_fs && !access(buf, F_OK)) {
+			minpid_fs = pids[i];
+		}
+	}
+
+	return minpid_fs < INT_MAX ? minpid_fs : minpid;
+}
+
+/** Get PID of the process referred by a pidfd, as seen in /proc.
+ *  @param[in] pidfd - the pidfd
+ *  @return PID or -1 if the descriptor isn't a pidfd of an existing process */
+int proc_pidfd_pid(int pidfd)
+{
+	char path[40], buf[1024], *p;
+	ssize_t len;
+	int fd, pid;
+
+	snprintf(path, sizeof path, "/proc/self/fdinfo/%d", pidfd);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		log_err("Can't open '%s': %s", path, strerror(errno));
+		return -1;
+	}
+	len = safe_read(fd, buf, sizeof buf - 1);
+	close(fd);
+	if (len < 0) {
+		log_err("Can't read '%s': %s", path, strerror(errno));
+		return -1;
+	}
+	buf[len] = '\0';
+
+	// Only pidfds have the Pid line, -1 if the process exited and 0 if
+	// it's not in the PID namespace of /proc
+	p = strstr(buf, "\nPid:");
+	if (!p) {
+		log_err("Descriptor %d is not a pidfd", pidfd);
+		return -1;
+	}
+	pid = strtol(p + 5, NULL, 10);
+	if (pid <= 0) {
+		log_err("Process of pidfd %d %s", pidfd,
+				pid ? "exited" : "is in a different PID namespace");
+		return -1;
+	}
+
+	return pid;
+}
+
+/** Check the process of a pidfd still exists. Its PID can't be reused then,
+ *  so /proc/<PID> opened before belongs to it.
+ *  @param[in] pidfd - the pidfd
+ *  @return 0 if the process exists, -1 otherwise */
+int proc_pidfd_check(int pidfd)
+{
+#ifdef SYS_pidfd_send_signal
+	if (!syscall(SYS_pidfd_send_signal, pidfd, 0, NULL, 0)) {
 		return 0;
 	}
+#else
+	errno = ENOSYS;
+#endif
+	log_err("Can't verify the process of pidfd %d: %s", pidfd, strerror(errno));
+	return -1;
+}
 
-	fputs("proc_dump:\n", run.info.output);
-	do {
-		char buf[4096];
-		FILE *pf;
-		int fd;
+/** Chunk of a snapshot arena, file contents are stored in its data. */
+struct proc_chunk_s {
+	struct proc_chunk_s *next;
+	size_t used, size;
+	char data[];
+};
+
+/** File of the /proc snapshot. */
+struct proc_snap_file_s {
+	/** Task of the file or 0 for files of the process directory. */
+	int tid;
+	const char *name;
+	/** Zero terminated content in an arena. */
+	const char *data;
+	size_t len;
+	/** Errno of the failed read. */
+	int error;
+};
+
+/** Thread reading the snapshot into its own arena. */
+struct proc_snap_worker_s {
+	pthread_t tid;
+	struct proc_chunk_s *arena;
+};
+
+/** Snapshot of /proc files dumped to the info stream. */
+static struct {
+	/** Process directory files followed by files of each task. */
+	struct proc_snap_file_s *files;
+	int count, next;
+	/** Number of process directory files. */
+	int root;
+	/** Sorted TIDs of tasks and the number of files of each. */
+	int *tids, tasks, task;
+	struct proc_snap_worker_s *workers;
+	int started;
+	/** Workers were joined. */
+	int done;
+} snap;
+
+/** Read a file to the end of an arena. Nothing is logged.
+ *  @return 0 on success or errno */
+static int snap_read(struct proc_chunk_s **arena, struct proc_snap_file_s *f)
+{
+	struct proc_chunk_s *c, *n;
+	char path[PATH_MAX];
+	size_t len = 0, size;
+	ssize_t rtn;
+	int fd, err = 0;
+
+	if (f->tid) {
+		snprintf(path, sizeof path, "task/%d/%s", f->tid, f->name);
+	} else {
+		snprintf(path, sizeof path, "%s", f->name);
+	}
+	fd = openat(run.proc_fd, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return errno;
+	}
 
-		fputs(spaces(indent + 2), run.info.output);
-		fputy(files->str, run.info.output);
+	// Most files are read by one read, a bigger one is moved to a new chunk
+	for (c = *arena; ; len += rtn) {
+		if (!c || c->size - c->used - len < PROC_SNAP_READ) {
+			size = 2 * len + PROC_SNAP_READ > PROC_SNAP_CHUNK
+				? 2 * len + PROC_SNAP_READ : PROC_SNAP_CHUNK;
+			n = malloc(sizeof *n + size);
+			if (!n) {
+				err = ENOMEM;
+				break;
+			}
+			n->next = c;
+			n->used = 0;
+			n->size = size;
+			if (len) {
+				memcpy(n->data, c->data + c->used, len);
+			}
+			*arena = c = n;
+		}
 
-		fd = openat(dir, files->str, O_RDONLY | O_CLOEXEC);
-		if (fd < 0 || NULL == (pf = fdopen(fd, "r"))) {
-			int err = errno;
-			log_err("Can't open proc file '%s': %s", files->str, strerror(err));
-			fprintf(run.info.output, ": ~ # Can't open: %s\n", strerror(err));
-			if (fd >= 0) close(fd);
+		// Files are read until an empty read, seq files return short reads
+		rtn = read(fd, c->data + c->used + len, c->size - c->used - len - 1);
+		if (rtn < 0 && errno == EINTR) {
+			rtn = 0;
 			continue;
+		} else if (rtn <= 0) {
+			err = rtn < 0 ? errno : 0;
+			break;
 		}
+	}
+	close(fd);
 
-		fputs(": |\n", run.info.output);
-		while (fgets(buf, sizeof buf, pf)) {
-			buf[strlen_chomp(buf)] = 0;
-			fputs(spaces(indent + 4), run.info.output);
-			fputs(buf, run.info.output);
-			fputc('\n', run.info.output);
+	if (!err) {
+		f->data = c->data + c->used;
+		f->len = len;
+		c->data[c->used + len] = '\0';
+		c->used += len + 1;
+	}
+
+	return err;
+}
+
+/** Read files of the snapshot until all are taken. */
+static void *snap_worker(void *arg)
+{
+	struct proc_snap_worker_s *w = arg;
+	int i, last;
+
+	while ((i = __atomic_fetch_add(&snap.next, PROC_SNAP_BATCH, __ATOMIC_RELAXED)) < snap.count) {
+		last = i + PROC_SNAP_BATCH < snap.count ? i + PROC_SNAP_BATCH : snap.count;
+		for (; i < last; i++) {
+			snap.files[i].error = snap_read(&w->arena, &snap.files[i]);
 		}
-		fclose(pf);
-	} while (NULL != (files = files->next));
+	}
+
+	return arg;
+}
+
+static int int_cmp(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/** Get TIDs of tasks of the process.
+ *  @return Number of tasks or -1 on error */
+static int snap_tasks(int **tids)
+{
+	struct dirent *de;
+	int count = 0, size = 0, fd, *tmp;
+	DIR *d;
+
+	*tids = NULL;
+	fd = openat(run.proc_fd, "task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0 || !(d = fdopendir(fd))) {
+		log_err("Can't open '%s/task': %s", conf.proc.path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+
+	while (NULL != (de = readdir(d))) {
+		if (!isdigit(de->d_name[0])) {
+			continue;
+		}
+		if (count == size) {
+			size = size * 2 ?: PROC_SNAP_BATCH;
+			tmp = realloc(*tids, size * sizeof *tmp);
+			if (!tmp) {
+				log_crit("Can't allocate memory for %d tasks", size);
+				free(*tids);
+				*tids = NULL;
+				closedir(d);
+				return -1;
+			}
+			*tids = tmp;
+		}
+		(*tids)[count++] = atoi(de->d_name);
+	}
+	closedir(d);
+
+	qsort(*tids, count, sizeof **tids, int_cmp);
+	return count;
+}
+
+/** Start reading cmdline and files of proc_dump_root and proc_dump_task in
+ *  parallel by proc_threads threads, so they are read at once and early.
+ *  The caller continues, while files are read.
+ *  @return 0 on success, -1 if the snapshot is not available */
+int proc_snapshot_start(void)
+{
+	const struct conf_multi_str_s *str;
+	struct proc_snap_file_s *f;
+	int root = 1, task = 0, workers, i, j;
+
+	for (str = conf.proc_dump.root; str; str = str->next) root++;
+	for (str = conf.proc_dump.task; str; str = str->next) task++;
+
+	snap.tasks = task ? snap_tasks(&snap.tids) : 0;
+	if (snap.tasks < 0) {
+		snap.tasks = task = 0;
+	}
+
+	snap.count = root + snap.tasks * task;
+	snap.files = calloc(snap.count, sizeof *snap.files);
+	if (!snap.files) {
+		log_crit("Can't allocate memory for %d /proc files", snap.count);
+		goto err0;
+	}
+	snap.root = root;
+	snap.task = task;
+
+	f = snap.files;
+	(f++)->name = "cmdline";
+	for (str = conf.proc_dump.root; str; str = str->next) {
+		(f++)->name = str->str;
+	}
+	for (i = 0; i < snap.tasks; i++) {
+		for (str = conf.proc_dump.task; str; str = str->next) {
+			f->tid = snap.tids[i];
+			(f++)->name = str->str;
+		}
+	}
+
+	workers = conf.proc.threads > 0 ? conf.proc.threads : sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers > (snap.count - 1) / PROC_SNAP_BATCH + 1) {
+		workers = (snap.count - 1) / PROC_SNAP_BATCH + 1;
+	}
+	snap.workers = calloc(workers, sizeof *snap.workers);
+	if (!snap.workers) {
+		log_crit("Can't allocate memory for %d /proc readers", workers);
+		goto err1;
+	}
+
+	for (j = 0; j < workers; j++) {
+		i = pthread_create(&snap.workers[j].tid, NULL, snap_worker, &snap.workers[j]);
+		if (i) {
+			log_err("Failed to create /proc reader: %s", strerror(i));
+			break;
+		}
+	}
+	snap.started = j;
+	if (!snap.started) {
+		goto err2;
+	}
 
 	return 0;
+
+err2:	free(snap.workers);
+	snap.workers = NULL;
+err1:	free(snap.files);
+	snap.files = NULL;
+err0:	free(snap.tids);
+	snap.tids = NULL;
+	snap.count = snap.tasks = snap.root = snap.task = 0;
+	return -1;
+}
+
+/** Wait until all files of the snapshot are read. */
+static void snap_wait(void)
+{
+	int i;
+
+	if (!snap.done) {
+		for (i = 0; i < snap.started; i++) {
+			pthread_join(snap.workers[i].tid, NULL);
+		}
+		snap.done = 1;
+	}
+}
+
+/** Get a file of the /proc snapshot. Must be called from one thread only,
+ *  it waits until the snapshot is read.
+ *  @param[in] tid - task of the file or 0 for the process directory
+ *  @param[in] name - file name or NULL to check the task is in the snapshot
+ *  @param[out] data - zero terminated content of the file
+ *  @param[out] len - length of the content
+ *  @return 0 on success, errno if the file couldn't be read or -1 if it's
+ *          not in the snapshot */
+int proc_snapshot_get(int tid, const char *name, const char **data, size_t *len)
+{
+	const struct proc_snap_file_s *f, *end;
+	const int *t;
+
+	snap_wait();
+	if (!tid) {
+		f = snap.files;
+		end = f + snap.root;
+	} else {
+		t = snap.tasks ? bsearch(&tid, snap.tids, snap.tasks, sizeof tid, int_cmp) : NULL;
+		if (!t) {
+			return -1;
+		}
+		f = snap.files + snap.root + (t - snap.tids) * snap.task;
+		end = f + snap.task;
+		if (!name) {
+			return 0;
+		}
+	}
+
+	for (; f < end; f++) {
+		if (!strcmp(f->name, name)) {
+			*data = f->data;
+			*len = f->len;
+			return f->error;
+		}
+	}
+
+	return -1;
+}
+
+/** Free the /proc snapshot. */
+void proc_snapshot_free(void)
+{
+	struct proc_chunk_s *c;
+	int i;
+
+	snap_wait();
+	for (i = 0; i < snap.started; i++) {
+		while ((c = snap.workers[i].arena)) {
+			snap.workers[i].arena = c->next;
+			free(c);
+		}
+	}
+	free(snap.workers);
+	free(snap.files);
+	free(snap.tids);
+	memset(&snap, 0, sizeof snap);
 }
@@ -24,8 +24,26 @@
 
 FILE *open_proc(const char *name);
 
+int read_core_info(const void *head, size_t len);
+
 int read_proc_info(void);
 
 int proc_pid_map(int nspid);
 
+int proc_guess_pid(const int *pids, int count);
+
+int proc_pidfd_pid(int pidfd);
+
+int proc_pidfd_check(int pidfd);
+
+int proc_snapshot_start(void);
+
+int proc_snapshot_get(int tid, const char *name, const char **data, size_t *len);
+
+void proc_snapshot_free(void);
+
+int proc_maps_index(void);
+
+int proc_maps_file(uint64_t addr, const char **file);
+
 #endif // PROC_H
@@ -0,0 +1,205 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <elf.h>
+
+#include "reprocess.h"
+#include "conf.h"
+#include "log.h"
+
+/** Default info output of reprocessed cores, relative to their directory. */
+#define REPROCESS_INFO_OUTPUT "/@c.yaml"
+#define REPROCESS_INFO_OUTPUT_CBOR "/@c.cbor"
+
+/** Check the directory entry is a core file. */
+static int is_core(int dirfd, const char *name)
+{
+	unsigned char ehdr[EI_NIDENT + 2];
+	int fd, rtn = 0;
+
+	fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+	if (fd < 0) {
+		return 0;
+	}
+
+	// e_type follows e_ident in both ELF classes
+	if (read(fd, ehdr, sizeof ehdr) == sizeof ehdr && !memcmp(ehdr, ELFMAG, SELFMAG)) {
+		rtn = (ehdr[EI_DATA] == ELFDATA2LSB ? ehdr[EI_NIDENT]
+				: ehdr[EI_NIDENT + 1]) == ET_CORE;
+	}
+
+	close(fd);
+	return rtn;
+}
+
+/** Seconds elapsed since the start. */
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/** Process all cores in the directory by a pool of child processes, each
+ *  core is taken by the first child slot which becomes free. Children share
+ *  unwind and symbol tables through the cache, if it's enabled.
+ *  @param[in] dir - the directory with cores
+ *  @return 1 in a child, which should process conf.core_path, 0 in the parent
+ *  when all cores are processed, -1 on error */
+int reprocess(const char *dir)
+{
+	char path[PATH_MAX], *output;
+	int count, next, running = 0, done = 0, failed = 0;
+	int jobs = conf.reprocess_jobs, dirfd, status, i;
+	struct dirent **names;
+	struct timespec start;
+	double reported = 0;
+	pid_t pid;
+
+	if (!realpath(dir, path)) {
+		log_crit("Can't resolve '%s': %s", dir, strerror(errno));
+		goto err0;
+	}
+
+	dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0) {
+		log_crit("Can't open '%s': %s", path, strerror(errno));
+		goto err0;
+	}
+
+	count = scandirat(dirfd, ".", &names, NULL, alphasort);
+	if (count < 0) {
+		log_crit("Can't read '%s': %s", path, strerror(errno));
+		goto err1;
+	}
+
+	// Keep only cores, so the progress is accurate
+	for (i = next = 0; i < count; i++) {
+		if (names[i]->d_name[0] != '.' && is_core(dirfd, names[i]->d_name)) {
+			names[next++] = names[i];
+		} else {
+			free(names[i]);
+		}
+	}
+	count = next;
+
+	// Archived cores are unrelated to running processes
+	conf.proc.ignore = 1;
+	conf.core.output = NULL;
+	if (!conf.info.output) {
+		output = malloc(strlen(path) * 2 + sizeof REPROCESS_INFO_OUTPUT);
+		if (!output) {
+			log_crit("Can't allocate memory for the info output");
+			goto err2;
+		}
+		// Escape wild cards in the directory name
+		for (conf.info.output = output, i = 0; path[i]; i++) {
+			if (path[i] == '@') {
+				*output++ = '@';
+			}
+			*output++ = path[i];
+		}
+		strcpy(output, conf.info_format == CONF_INFO_FORMAT_CBOR
+				? REPROCESS_INFO_OUTPUT_CBOR : REPROCESS_INFO_OUTPUT);
+		conf.info.exists = CONF_EXISTS_OVERWRITE;
+	}
+
+	if (jobs <= 0) {
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = jobs > 0 ? jobs : 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (next = 0; next < count || running > 0; ) {
+		while (running < jobs && next < count) {
+			pid = fork();
+			if (pid == 0) {
+				static char core[PATH_MAX];
+				snprintf(core, sizeof core, "%s/%s", path, names[next]->d_name);
+				conf.core_path = core;
+				run.pid = -1;
+				close(dirfd);
+				return 1;
+			} else if (pid < 0) {
+				log_err("Can't create a process for '%s': %s",
+						names[next]->d_name, strerror(errno));
+				if (!running) {
+					goto err2;
+				}
+				break;
+			}
+			running++;
+			next++;
+		}
+
+		pid = wait(&status);
+		if (pid < 0) {
+			log_err("Can't wait for a child: %s", strerror(errno));
+			goto err2;
+		}
+		running--;
+		done++;
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			failed++;
+		}
+
+		// Report the progress once per second and when finished
+		if (elapsed(&start) - reported >= 1 || done == count) {
+			reported = elapsed(&start);
+			printf("Reprocessed %d/%d cores, %d failed, %.1f cores/s\n",
+					done, count, failed, done / (reported ?: 1e-9));
+			fflush(stdout);
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		free(names[i]);
+	}
+	free(names);
+	close(dirfd);
+	if (failed) {
+		log_err("Processing of %d cores failed", failed);
+	}
+	return 0;
+
+err2:	while (running-- > 0) {
+		wait(NULL);
+	}
+	for (i = 0; i < count; i++) {
+		free(names[i]);
+	}
+	free(names);
+err1:	close(dirfd);
+err0:	return -1;
+}
@@ -0,0 +1,191 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include "module.h"
+#include "storm.h"
+#include "util.h"
+#include "conf.h"
+
+/** Magic number of the table, "STM1". */
+#define STORM_MAGIC 0x314d5453
+
+/** Number of signatures tracked by the table. */
+#define STORM_ENTRIES 512
+
+/** Recent crashes of an executable with the same signature. */
+struct storm_entry_s {
+	/** Hash of the executable path and the crash signature. */
+	uint64_t exe, signature;
+	/** Time of the last crash and time the bucket was refilled to in ms. */
+	uint64_t seen, last;
+	/** Cores which may be written now, in thousandths. */
+	uint64_t tokens;
+	/** Cores suppressed since the last written one. */
+	uint64_t suppressed;
+};
+
+/** Table shared by all crashinfo instances trough a mapped file. */
+struct storm_table_s {
+	/** STORM_MAGIC */
+	uint32_t magic;
+	uint32_t count;
+	struct storm_entry_s entries[STORM_ENTRIES];
+};
+
+/** Add a frame to the crash signature. The frame is identified by the image
+ *  and the offset in it, so the signature doesn't depend on load addresses.
+ *  @param[in] signature - the signature of previous frames
+ *  @param[in] ip - instruction pointer of the frame
+ *  @return The new signature */
+uint64_t storm_frame(uint64_t signature, uint64_t ip)
+{
+	struct module_s *m = module_find(ip);
+
+	if (m) {
+		const char *id = m->build_id[0] ? m->build_id : m->file;
+		signature = hash_fnv(signature, id, strlen(id) + 1);
+		ip -= m->bias;
+	}
+
+	return hash_fnv(signature, &ip, sizeof ip);
+}
+
+/** Account the crash in the table.
+ *  @param[in] t - the locked table
+ *  @param[in] exe - hash of the executable
+ *  @param[in] signature - the crash signature
+ *  @return 1 if the core should be suppressed, 0 otherwise */
+static int storm_account(struct storm_table_s *t, uint64_t exe, uint64_t signature)
+{
+	const uint64_t burst = conf.storm.burst * 1000ULL;
+	struct storm_entry_s *e, *lru = NULL;
+	struct timespec ts;
+	uint64_t now;
+	int i;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	now = ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+
+	for (i = 0, e = t->entries; i < STORM_ENTRIES; i++, e++) {
+		if (e->exe == exe && e->signature == signature) {
+			break;
+		} else if (!lru || e->seen < lru->seen) {
+			lru = e;
+		}
+	}
+
+	// Forget the least recently seen crash
+	if (i == STORM_ENTRIES) {
+		e = lru;
+		memset(e, 0, sizeof *e);
+		e->exe = exe;
+		e->signature = signature;
+		e->tokens = burst;
+		e->last = now;
+	}
+
+	// Refill the bucket by one core each interval, the remainder is kept
+	if (now > e->last && conf.storm.interval > 0) {
+		uint64_t refill = (now - e->last) / conf.storm.interval;
+		e->tokens += refill;
+		e->last += refill * conf.storm.interval;
+	}
+	if (e->tokens >= burst) {
+		e->tokens = burst;
+		e->last = now;
+	}
+	e->seen = now;
+
+	if (e->tokens >= 1000) {
+		e->tokens -= 1000;
+		run.storm.count = e->suppressed;
+		e->suppressed = 0;
+		return 0;
+	}
+
+	run.storm.count = ++e->suppressed;
+	return 1;
+}
+
+/** Record the signature of the crash and suppress the core stream if too
+ *  many crashes with the same signature happened recently. Nothing is logged,
+ *  because this may run in an unwinder worker, the result is stored to the
+ *  runtime structure instead.
+ *  @param[in] signature - the crash signature */
+void storm_crash(uint64_t signature)
+{
+	const char *exe = conf.proc.exe ? conf.proc.exe : "";
+	struct storm_table_s *t;
+	struct stat st;
+	int fd;
+
+	run.storm.signature = signature;
+	run.storm.known = 1;
+
+	if (!conf.storm.table) {
+		return;
+	}
+
+	fd = open(conf.storm.table, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		goto err0;
+	}
+
+	if (flock(fd, LOCK_EX) || fstat(fd, &st)
+	    || (st.st_size != sizeof *t && ftruncate(fd, sizeof *t))) {
+		goto err1;
+	}
+
+	t = mmap(NULL, sizeof *t, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (t == MAP_FAILED) {
+		goto err1;
+	}
+
+	if (t->magic != STORM_MAGIC || st.st_size != sizeof *t) {
+		memset(t, 0, sizeof *t);
+		t->magic = STORM_MAGIC;
+		t->count = STORM_ENTRIES;
+	}
+
+	run.storm.suppressed = storm_account(t, hash_fnv(HASH_FNV_INIT, exe, strlen(exe)),
+			signature);
+	if (run.storm.suppressed) {
+		__atomic_store_n(&run.core.suppressed, 1, __ATOMIC_RELAXED);
+	}
+
+	munmap(t, sizeof *t);
+	close(fd);
+	return;
+
+err1:	close(fd);
+err0:	run.storm.error = errno;
+}
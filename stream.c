@@ -0,0 +1,259 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+
+#include "compress.h"
+#include "elfcore.h"
+#include "stream.h"
+#include "util.h"
+#include "conf.h"
+#include "log.h"
+
+/** Granularity of the zero detection, a multiple of the file system block. */
+#define ZERO_BLOCK 4096
+
+/** Vector used for the zero detection, the compiler maps it to SIMD registers. */
+typedef unsigned long zero_vec_t __attribute__((vector_size(32)));
+
+/** Check if a block contains only zeros.
+ *  @param[in] buf - ZERO_BLOCK bytes long block, doesn't need to be aligned
+ *  @return true if the block contains only zeros. */
+static bool is_zero_block(const char *buf)
+{
+	zero_vec_t v[4], acc;
+	int i, j;
+
+	for (i = 0; i < ZERO_BLOCK; i += sizeof v) {
+		memcpy(v, buf + i, sizeof v);
+		acc = v[0] | v[1] | v[2] | v[3];
+		for (j = 0; j < sizeof acc / sizeof acc[0]; j++) {
+			if (acc[j]) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/** Seek over skipped zero pages and release space preallocated for them.
+ *  @return 0 on success. */
+static int flush_hole(struct run_output_s *r)
+{
+	off_t start = r->offset - r->hole, end;
+
+	if (!r->hole) {
+		return 0;
+	}
+	r->hole = 0;
+
+	if (start < r->prealloc) {
+		end = r->offset < r->prealloc ? r->offset : r->prealloc;
+		if (fallocate(r->output_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+					start, end - start)) {
+			log_dbg("Can't punch a hole in the core: %s", strerror(errno));
+		}
+	}
+
+	if (lseek(r->output_fd, r->offset, SEEK_SET) < 0) {
+		log_err("Can't seek in the core output: %s", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Prepare the output for writing the stream. The stream is compressed if
+ *  requested. Otherwise, if requested and the output is a regular file,
+ *  the output is preallocated and zero pages are skipped.
+ *  @param[in] c - output configuration
+ *  @param[in] r - opened output
+ *  @param[in] head - beginning of the stream, used to determine its size
+ *  @param[in] len - number of bytes available in head
+ *  @return 0 on success. */
+int stream_prepare(const struct conf_output_s *c, struct run_output_s *r,
+		const void *head, size_t len)
+{
+	struct stat st;
+	long long size;
+
+	r->sparse = 0;
+	r->offset = r->hole = r->prealloc = 0;
+	r->compress = NULL;
+
+	if (c->compress.type != CONF_COMPRESS_NONE) {
+		if (c->sparse) {
+			log_notice("Compressed output is not sparse");
+		}
+		r->compress = compress_open(&c->compress, r->output_fd);
+		if (!r->compress) {
+			log_err("Stream will not be compressed");
+			return -1;
+		}
+		return 0;
+	}
+
+	if (!c->sparse) {
+		return 0;
+	}
+
+	if (r->filter || fstat(r->output_fd, &st) || !S_ISREG(st.st_mode)
+	    || (fcntl(r->output_fd, F_GETFL) & O_APPEND)) {
+		log_dbg("Output is not a seekable file, zero pages will be written");
+		return 0;
+	}
+	r->sparse = 1;
+
+	size = elf_core_size(head, len);
+	if (size > 0) {
+		if (fallocate(r->output_fd, FALLOC_FL_KEEP_SIZE, 0, size)) {
+			log_dbg("Can't preallocate %lld bytes: %s", size, strerror(errno));
+		} else {
+			log_info("Preallocated %lld bytes for the output", size);
+			r->prealloc = size;
+		}
+	}
+
+	return 0;
+}
+
+/** Write data to the stream output.
+ *  @param[in] r - the output
+ *  @param[in] buf - data to write
+ *  @param[in] count - number of bytes to write
+ *  @return Number of written bytes or -1 on error. */
+ssize_t stream_write(struct run_output_s *r, const void *buf, size_t count)
+{
+	const char *p, *data = NULL, *end = (const char *)buf + count;
+	ssize_t rtn;
+	size_t len;
+
+	// The output of a suppressed stream is removed, skip writing it
+	if (__atomic_load_n(&r->suppressed, __ATOMIC_RELAXED)) {
+		r->offset += count;
+		return count;
+	} else if (r->compress) {
+		rtn = compress_write(r->compress, buf, count);
+		if (rtn > 0) {
+			r->offset += rtn;
+		}
+		return rtn;
+	} else if (!r->sparse) {
+		rtn = safe_write(r->output_fd, buf, count);
+		if (rtn > 0) {
+			r->offset += rtn;
+		}
+		return rtn;
+	}
+
+	// Only whole aligned blocks are skipped, everything else is written
+	for (p = buf; p < end; p += len) {
+		len = ZERO_BLOCK - r->offset % ZERO_BLOCK;
+		if (len > end - p) {
+			len = end - p;
+		}
+
+		if (len == ZERO_BLOCK && is_zero_block(p)) {
+			if (data && safe_write(r->output_fd, data, p - data) != p - data) {
+				return -1;
+			}
+			data = NULL;
+			r->hole += len;
+		} else if (!data) {
+			if (flush_hole(r)) {
+				return -1;
+			}
+			data = p;
+		}
+		r->offset += len;
+	}
+
+	if (data && safe_write(r->output_fd, data, end - data) != end - data) {
+		return -1;
+	}
+
+	return count;
+}
+
+/** Switch the output to the non-blocking mode if it's a pipe or a socket
+ *  written directly, so it can be watched by the event loop. stream_write()
+ *  then fails with EAGAIN instead of blocking.
+ *  @return The output descriptor or -1 if it can't be polled. */
+int stream_pollable(struct run_output_s *r)
+{
+	struct stat st;
+	int flags;
+
+	if (r->compress || r->sparse || fstat(r->output_fd, &st)
+	    || !(S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode))) {
+		return -1;
+	}
+
+	flags = fcntl(r->output_fd, F_GETFL);
+	if (flags < 0 || fcntl(r->output_fd, F_SETFL, flags | O_NONBLOCK)) {
+		return -1;
+	}
+
+	return r->output_fd;
+}
+
+/** Finish writing the stream, must be called before the output is closed.
+ *  @return 0 on success. */
+int stream_finish(struct run_output_s *r)
+{
+	int rtn = 0;
+
+	if (r->compress) {
+		rtn = compress_close(r->compress);
+		r->compress = NULL;
+		return rtn;
+	} else if (!r->sparse) {
+		return 0;
+	}
+
+	// The file size must be set explicitly if the stream ends with a hole
+	if (r->hole) {
+		rtn = flush_hole(r);
+		if (ftruncate(r->output_fd, r->offset)) {
+			log_err("Can't set the core size: %s", strerror(errno));
+			rtn = -1;
+		}
+	}
+
+	// Release the space preallocated beyond the end of the stream
+	if (r->prealloc > r->offset) {
+		if (fallocate(r->output_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+					r->offset, r->prealloc - r->offset)) {
+			log_dbg("Can't release preallocated space: %s", strerror(errno));
+		}
+	}
+
+	return rtn;
+}
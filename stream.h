@@ -0,0 +1,40 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <sys/types.h>
+#include <stdio.h>
+
+struct conf_output_s;
+struct run_output_s;
+
+int stream_prepare(const struct conf_output_s *c, struct run_output_s *r,
+		const void *head, size_t len);
+
+ssize_t stream_write(struct run_output_s *r, const void *buf, size_t count);
+
+int stream_pollable(struct run_output_s *r);
+
+int stream_finish(struct run_output_s *r);
+
+#endif // STREAM_H
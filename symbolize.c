@@ -0,0 +1,320 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "symbolize.h"
+#include "module.h"
+#include "symtab.h"
+#include "info.h"
+#include "conf.h"
+#include "log.h"
+
+/** Prefix of backtrace frames in the info stream. */
+#define FRAME "      { a: "
+
+/** Read a double quoted YAML string written by info_out_yaml().
+ *  @param[in] s - the opening quote
+ *  @param[out] buf - the unquoted string
+ *  @param[in] size - size of the buffer
+ *  @return Character after the closing quote or NULL */
+static const char *unquote(const char *s, char *buf, size_t size)
+{
+	size_t len = 0;
+
+	if (*s++ != '"') {
+		return NULL;
+	}
+
+	for (; *s != '"'; s++) {
+		char c = *s;
+
+		if (c == '\0' || len + 1 >= size) {
+			return NULL;
+		}
+		if (c == '\\') {
+			switch (*++s) {
+				case 'n': c = '\n'; break;
+				case 't': c = '\t'; break;
+				case 'r': c = '\r'; break;
+				case 'x':
+					if (!s[1] || !s[2]) {
+						return NULL;
+					}
+					c = strtol((char[]){ s[1], s[2], 0 }, NULL, 16);
+					s += 2;
+					break;
+				case '\0': return NULL;
+				default: c = *s;
+			}
+		}
+		buf[len++] = c;
+	}
+	buf[len] = 0;
+
+	return s + 1;
+}
+
+/** Add an executable mapping listed in the info stream to the configuration.
+ *  If the image on this system has a different build-id, its separate debug
+ *  file is used instead.
+ *  @param[in] line - "  0x<addr>: { f: <file>, b: <build-id> }"
+ *  @return 0 on success, -1 if the line isn't a mapping */
+static int add_mapping(const char *line)
+{
+	struct elf_image_s image;
+	char file[PATH_MAX], id[65], debug[PATH_MAX];
+	const char *p, *path = file;
+	uint64_t addr;
+	char *end;
+	size_t len;
+
+	if (strncmp(line, "  0x", 4)) {
+		return -1;
+	}
+
+	addr = strtoull(line + 2, &end, 16);
+	if (strncmp(end, ": { f: ", 7) || !(p = unquote(end + 7, file, sizeof file))
+	    || strncmp(p, ", b: ", 5)) {
+		return -1;
+	}
+	p += 5;
+	len = strcspn(p, " }");
+	if (len >= sizeof id) {
+		return -1;
+	}
+	memcpy(id, p, len);
+	id[len] = 0;
+
+	if (strcmp(id, "~") && elf_image_open(file, &image) == 0) {
+		char current[65] = "";
+
+		elf_image_build_id(&image, current, sizeof current);
+		elf_image_close(&image);
+		if (strcmp(id, current)) {
+			symtab_debug_path(id, debug, sizeof debug);
+			log_info("Build-id of '%s' differs, using '%s'", file, debug);
+			path = debug;
+		}
+	}
+
+	if (!conf_mapping_add(addr, 0, path, strlen(path))) {
+		log_err("Can't allocate memory for a mapping");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Release mappings of the previous file. */
+static void free_mappings(void)
+{
+	struct conf_multi_mapping_s *map;
+
+	module_free();
+	while ((map = conf.proc.maps)) {
+		conf.proc.maps = map->next;
+		free(map);
+	}
+}
+
+/** Write a frame emitted in the deferred mode with its function name.
+ *  @param[in] line - "      { a: <addr>[, m: <module>], S: <signal> }<rest>"
+ *  @param[in,out] prev_signal - the previous frame is a signal frame
+ *  @param[out] out - writer of the symbolized stream
+ *  @return 0 if the frame is written, -1 if the line isn't such frame */
+static int write_frame(const char *line, int *prev_signal, struct info_out_s *out)
+{
+	const char *p = line + sizeof FRAME - 1, *name;
+	struct module_s *m;
+	uint64_t ip, off, len;
+	int signal;
+	char *end;
+
+	ip = strtoull(p, &end, 16);
+	if (end == p) {
+		return -1;
+	}
+	// The module index is found again by the address
+	if (!strncmp(end, ", m: ", 5)) {
+		end += 5 + strspn(end + 5, "0123456789");
+	}
+	if (strncmp(end, ", S: ", 5)) {
+		return -1;
+	}
+	signal = strtol(end + 5, &end, 10);
+	if (strncmp(end, " }", 2)) {
+		return -1;
+	}
+
+	info_out_puts(out, FRAME);
+	info_out_write(out, p, strchr(p, ',') - p);
+
+	// Return addresses are looked up by the call instruction before them
+	name = symtab_symbol(ip - !*prev_signal, &off, &len);
+	if (name) {
+		info_out_puts(out, ", s: ");
+		if (conf.symbolize_demangle) {
+			info_out_yaml(out, name);
+			info_out_putc(out, ',');
+			info_out_puts(out, spaces(20 - strlen(name) - 2));
+		} else {
+			info_out_puts(out, name);
+			info_out_putc(out, ',');
+			info_out_puts(out, spaces(20 - strlen(name)));
+		}
+		info_out_puts(out, " o: ");
+		info_out_hex_alt(out, off + !*prev_signal, 5);
+		info_out_puts(out, ", l: ");
+		info_out_hex_alt(out, len, 5);
+	}
+	*prev_signal = signal > 0;
+
+	info_out_puts(out, ", e: -1, S: ");
+	info_out_int(out, signal);
+
+	m = module_find(ip);
+	if (m) {
+		info_out_puts(out, ", f: ");
+		info_out_yaml(out, m->file);
+	}
+	info_out_puts(out, end);
+
+	return 0;
+}
+
+/** Fill function names into backtraces of an info stream written in the
+ *  deferred mode. The file is replaced by the symbolized one.
+ *  @param[in] path - the info stream file
+ *  @return 0 on success, -1 on error */
+static int symbolize_file(const char *path)
+{
+	struct run_output_s stream = { .output_fd = -1 };
+	char tmp[PATH_MAX], *line = NULL;
+	int mappings = 0, frames = 0, prev_signal = 1, fd;
+	struct info_out_s *out;
+	size_t alloc = 0;
+	struct stat st;
+	ssize_t len;
+	FILE *in;
+
+	in = fopen(path, "r");
+	if (!in) {
+		log_err("Can't open '%s': %s", path, strerror(errno));
+		goto err0;
+	}
+
+	snprintf(tmp, sizeof tmp, "%s.XXXXXX", path);
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0) {
+		log_err("Can't create a file for '%s': %s", path, strerror(errno));
+		goto err1;
+	}
+	if (!fstat(fileno(in), &st)) {
+		fchmod(fd, st.st_mode & 07777);
+	}
+	stream.output_fd = fd;
+	out = info_out_open(&stream);
+	if (!out) {
+		log_err("Can't allocate memory for the output of '%s'", path);
+		goto err2;
+	}
+
+	while ((len = getline(&line, &alloc, in)) > 0) {
+		if (!strcmp(line, "executable_mappings:\n")) {
+			mappings = 1;
+		} else if (mappings && line[0] != ' ') {
+			mappings = 0;
+			module_init();
+		} else if (mappings) {
+			add_mapping(line);
+		} else if (!strncmp(line, "    backtrace: [", 16)) {
+			prev_signal = 1;
+		} else if (!strncmp(line, FRAME, sizeof FRAME - 1)
+		           && !write_frame(line, &prev_signal, out)) {
+			frames++;
+			continue;
+		}
+		info_out_write(out, line, len);
+	}
+	free(line);
+
+	if (ferror(in)) {
+		log_err("Can't read '%s': %s", path, strerror(errno));
+		info_out_close(out);
+		goto err2;
+	}
+	if (info_out_close(out)) {
+		log_err("Can't write '%s': %s", tmp, strerror(errno));
+		goto err2;
+	}
+	if (close(fd)) {
+		fd = -1;
+		log_err("Can't write '%s': %s", tmp, strerror(errno));
+		goto err2;
+	}
+	fd = -1;
+
+	if (!frames) {
+		log_info("No frames to symbolize in '%s'", path);
+		unlink(tmp);
+	} else if (rename(tmp, path)) {
+		log_err("Can't replace '%s': %s", path, strerror(errno));
+		goto err2;
+	}
+
+	fclose(in);
+	free_mappings();
+	return 0;
+
+err2:	if (fd >= 0) close(fd);
+	unlink(tmp);
+err1:	fclose(in);
+	free_mappings();
+err0:	return -1;
+}
+
+/** Symbolize info streams written in the deferred mode. Symbol tables of
+ *  modules are built only once for all streams if the cache is enabled.
+ *  @param[in] count - number of files
+ *  @param[in] paths - the files
+ *  @return 0 on success, -1 if any of files can't be symbolized */
+int symbolize(int count, char *paths[])
+{
+	int i, rtn = 0;
+
+	for (i = 0; i < count; i++) {
+		if (symbolize_file(paths[i])) {
+			rtn = -1;
+		}
+	}
+
+	return rtn;
+}
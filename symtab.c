@@ -0,0 +1,336 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <elf.h>
+
+#include "symtab.h"
+#include "conf.h"
+#include "log.h"
+
+/** Symbol tables of modules. */
+const struct module_kind_s symtab_kind = {
+	.name = "sym",
+	.check = symtab_check,
+	.build = symtab_build,
+	.hits = &run.symbol_cache_hits,
+	.misses = &run.symbol_cache_misses,
+};
+
+/** Symbol tables of modules with demangled names. */
+const struct module_kind_s symtab_demangled_kind = {
+	.name = "symd",
+	.check = symtab_check,
+	.build = symtab_build,
+	.hits = &run.symbol_cache_hits,
+	.misses = &run.symbol_cache_misses,
+};
+
+/** Directory with separate debug files, if debug_dir isn't set. */
+#define SYMTAB_DEBUG_DIR "/usr/lib/debug"
+
+/** Number of preceding functions checked if they contain an address, which
+ *  isn't in the function with the nearest lower address. */
+#define SYMTAB_NESTED 16
+
+/** Function symbol found in an image. */
+struct sym_s {
+	uint64_t addr;
+	uint64_t size;
+	/** Name in the mapped image. */
+	const char *name;
+	/** Order in the image, the first of symbols at the same address wins. */
+	size_t order;
+};
+
+/** Symbols collected from images. */
+struct syms_s {
+	struct sym_s *syms;
+	size_t count, alloc;
+};
+
+/** Signature of __cxa_demangle(). */
+typedef char *(*demangle_t)(const char *name, char *buf, size_t *len, int *status);
+
+/** Get the demangler of the C++ runtime, it's loaded only if needed. */
+static demangle_t demangler(void)
+{
+	static demangle_t demangle;
+	static int loaded;
+	void *lib;
+
+	if (!loaded) {
+		loaded = 1;
+		lib = dlopen("libstdc++.so.6", RTLD_LAZY | RTLD_LOCAL);
+		if (lib) {
+			demangle = (demangle_t)dlsym(lib, "__cxa_demangle");
+		}
+		if (!demangle) {
+			log_notice("C++ demangler is not available, names are not demangled");
+		}
+	}
+
+	return demangle;
+}
+
+/** Collect function symbols from symbol tables of the image.
+ *  @return 0 on success, -1 on error */
+static int syms_collect(const struct elf_image_s *img, struct syms_s *s)
+{
+	struct elf_shdr_s shdr, strtab;
+	struct sym_s *tmp;
+	unsigned i, num;
+	uint64_t j;
+
+	num = img->map ? (img->elf64 ? ((const Elf64_Ehdr *)img->map)->e_shnum
+			: ((const Elf32_Ehdr *)img->map)->e_shnum) : 0;
+	for (i = 1; i < num; i++) {
+		if (elf_image_shdr(img, i, &shdr)
+		    || (shdr.type != SHT_SYMTAB && shdr.type != SHT_DYNSYM)
+		    || shdr.entsize != (img->elf64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym))
+		    || elf_image_shdr(img, shdr.link, &strtab)) {
+			continue;
+		}
+
+		for (j = 1; j < shdr.size / shdr.entsize; j++) {
+			const char *src = (const char *)img->map + shdr.offset + j * shdr.entsize;
+			uint64_t value, size;
+			unsigned type, shndx;
+			uint32_t name;
+
+			if (img->elf64) {
+				Elf64_Sym sym;
+				memcpy(&sym, src, sizeof sym);
+				name = sym.st_name, type = ELF64_ST_TYPE(sym.st_info);
+				shndx = sym.st_shndx, value = sym.st_value, size = sym.st_size;
+			} else {
+				Elf32_Sym sym;
+				memcpy(&sym, src, sizeof sym);
+				name = sym.st_name, type = ELF32_ST_TYPE(sym.st_info);
+				shndx = sym.st_shndx, value = sym.st_value, size = sym.st_size;
+			}
+
+			if (type != STT_FUNC || shndx == SHN_UNDEF || !size || name >= strtab.size
+			    || !memchr((const char *)img->map + strtab.offset + name, 0, strtab.size - name)) {
+				continue;
+			}
+
+			if (s->count == s->alloc) {
+				s->alloc = s->alloc ? 2 * s->alloc : 1024;
+				tmp = realloc(s->syms, s->alloc * sizeof *s->syms);
+				if (!tmp) {
+					log_err("Can't allocate memory for symbols");
+					return -1;
+				}
+				s->syms = tmp;
+			}
+			s->syms[s->count].addr = value;
+			s->syms[s->count].size = size;
+			s->syms[s->count].name = (const char *)img->map + strtab.offset + name;
+			s->syms[s->count].order = s->count;
+			s->count++;
+		}
+	}
+
+	return 0;
+}
+
+/** Order symbols by the address and the order in the image. */
+static int sym_cmp(const void *a, const void *b)
+{
+	const struct sym_s *sa = a, *sb = b;
+
+	if (sa->addr != sb->addr) {
+		return sa->addr < sb->addr ? -1 : 1;
+	}
+	return sa->order < sb->order ? -1 : sa->order > sb->order;
+}
+
+/** Check the data contain a valid symbol table.
+ *  @return Non-zero if they do */
+int symtab_check(const void *data, size_t size)
+{
+	const struct symtab_s *t = data;
+
+	return data && size > sizeof *t && t->magic == SYMTAB_MAGIC
+		&& t->count <= (size - sizeof *t) / sizeof t->entries[0]
+		&& !((const char *)data)[size - 1];
+}
+
+/** Get the path of the separate debug file of an image.
+ *  @param[in] build_id - build-id of the image
+ *  @param[out] path - the path
+ *  @param[in] size - size of the path buffer */
+void symtab_debug_path(const char *build_id, char *path, size_t size)
+{
+	snprintf(path, size, "%s/.build-id/%.2s/%s.debug",
+			conf.debug_dir ? conf.debug_dir : SYMTAB_DEBUG_DIR,
+			build_id, build_id + 2);
+}
+
+/** Build the symbol table of the module. If the image is stripped, symbols
+ *  are read also from the separate debug file found by the build-id.
+ *  @param[in] m - the module
+ *  @param[out] size - size of the table
+ *  @return Allocated table or NULL if it can't be built */
+void *symtab_build(const struct module_s *m, size_t *size)
+{
+	struct elf_image_s debug = { .map = NULL };
+	struct syms_s s = { .syms = NULL };
+	struct elf_shdr_s shdr;
+	demangle_t demangle = NULL;
+	char path[PATH_MAX], **names;
+	struct symtab_s *t = NULL;
+	size_t i, len, pos;
+
+	if (syms_collect(&m->image, &s)) {
+		goto err0;
+	}
+
+	if (elf_image_section(&m->image, ".symtab", &shdr) < 0 && m->build_id[0]) {
+		symtab_debug_path(m->build_id, path, sizeof path);
+		if (!elf_image_open(path, &debug)) {
+			log_dbg("Reading symbols of '%s' from '%s'", m->file, path);
+			if (syms_collect(&debug, &s)) {
+				goto err1;
+			}
+		}
+	}
+
+	if (!s.count) {
+		goto err1;
+	}
+	qsort(s.syms, s.count, sizeof *s.syms, sym_cmp);
+
+	if (conf.symbolize_demangle) {
+		demangle = demangler();
+	}
+
+	names = calloc(s.count, sizeof *names);
+	if (!names) {
+		log_err("Can't allocate memory for symbols");
+		goto err1;
+	}
+
+	len = sizeof *t + s.count * sizeof t->entries[0];
+	pos = len;
+	for (i = 0; i < s.count; i++) {
+		int status;
+
+		if (demangle && !strncmp(s.syms[i].name, "_Z", 2)) {
+			names[i] = demangle(s.syms[i].name, NULL, NULL, &status);
+		}
+		len += strlen(names[i] ? names[i] : s.syms[i].name) + 1;
+	}
+
+	t = malloc(len);
+	if (!t) {
+		log_err("Can't allocate memory for the symbol table");
+		goto err2;
+	}
+	t->magic = SYMTAB_MAGIC;
+	t->count = s.count;
+	for (i = 0; i < s.count; i++) {
+		const char *name = names[i] ? names[i] : s.syms[i].name;
+
+		t->entries[i].addr = s.syms[i].addr;
+		t->entries[i].size = s.syms[i].size;
+		t->entries[i].name = pos;
+		strcpy((char *)t + pos, name);
+		pos += strlen(name) + 1;
+	}
+	*size = len;
+
+err2:	for (i = 0; i < s.count; i++) {
+		free(names[i]);
+	}
+	free(names);
+err1:	elf_image_close(&debug);
+err0:	free(s.syms);
+	return t;
+}
+
+/** Find the function containing the address.
+ *  @param[in] data - the symbol table
+ *  @param[in] size - size of the symbol table
+ *  @param[in] addr - link time address
+ *  @param[out] off - offset of the address in the function
+ *  @param[out] len - size of the function
+ *  @return Name of the function or NULL if it isn't found */
+const char *symtab_lookup(const void *data, size_t size, uint64_t addr,
+		uint64_t *off, uint64_t *len)
+{
+	const struct symtab_s *t = data;
+	int lo = 0, hi = t->count, i, best = -1;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (t->entries[mid].addr <= addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	// Prefer the nearest function, the first one if more start at the address
+	for (i = lo - 1; i >= 0 && lo - i <= SYMTAB_NESTED; i--) {
+		if (best >= 0 && t->entries[i].addr != t->entries[best].addr) {
+			break;
+		}
+		if (addr - t->entries[i].addr < t->entries[i].size) {
+			best = i;
+		}
+	}
+
+	if (best < 0 || t->entries[best].name >= size) {
+		return NULL;
+	}
+
+	*off = addr - t->entries[best].addr;
+	*len = t->entries[best].size;
+	return (const char *)t + t->entries[best].name;
+}
+
+/** Find the function containing the run time address by the symbol table of
+ *  its module.
+ *  @param[in] addr - the address
+ *  @param[out] off - offset of the address in the function
+ *  @param[out] len - size of the function
+ *  @return Name of the function or NULL if it isn't found */
+const char *symtab_symbol(uint64_t addr, uint64_t *off, uint64_t *len)
+{
+	struct module_s *m = module_find(addr);
+	const void *t;
+	const char *name;
+
+	t = m ? module_get(m, &m->symtab, conf.symbolize_demangle
+			? &symtab_demangled_kind : &symtab_kind) : NULL;
+	name = t ? symtab_lookup(t, m->symtab.entry.size, addr - m->bias, off, len) : NULL;
+	if (!name) {
+		*off = *len = 0;
+	}
+
+	return name;
+}
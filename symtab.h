@@ -0,0 +1,61 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "module.h"
+
+/** Magic number of the symbol table, "SYM1". */
+#define SYMTAB_MAGIC 0x314d5953
+
+/** Function symbols of an image sorted by the link time address, followed
+ *  by their names. */
+struct symtab_s {
+	/** SYMTAB_MAGIC */
+	uint32_t magic;
+	/** Number of entries. */
+	uint32_t count;
+	/** Function address, size and offset of its name. */
+	struct symtab_entry_s {
+		uint64_t addr;
+		uint64_t size;
+		uint64_t name;
+	} entries[];
+};
+
+extern const struct module_kind_s symtab_kind, symtab_demangled_kind;
+
+int symtab_check(const void *data, size_t size);
+
+void symtab_debug_path(const char *build_id, char *path, size_t size);
+
+void *symtab_build(const struct module_s *m, size_t *size);
+
+const char *symtab_lookup(const void *data, size_t size, uint64_t addr,
+		uint64_t *off, uint64_t *len);
+
+const char *symtab_symbol(uint64_t addr, uint64_t *off, uint64_t *len);
+
+#endif // SYMTAB_H
@@ -4,7 +4,7 @@ use Cwd;
 package Util;
 
 use base 'Exporter';
-our @EXPORT = qw(crashinfo $exe $exe_exclamation);
+our @EXPORT = qw(crashinfo crashinfo_pipe $exe $exe_exclamation);
 
 our $exe = Cwd::getcwd() . '/inputdir/crash';
 our $exe_exclamation = $exe;
@@ -22,4 +22,13 @@ sub crashinfo {
 	return system '../crashinfo', @args;
 }
 
+sub crashinfo_pipe {
+	my @args = qw(-oproc_path=inputdir/proc);
+	push @args, "-P$pid";
+	while(my ($opt, $val) = splice(@_, 0, 2)) {
+		push @args, "-o$opt=$val";
+	}
+	return system 'sh', '-c', 'cat inputdir/core | "$@"', 'sh', '../crashinfo', @args;
+}
+
 1;
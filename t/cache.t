@@ -0,0 +1,73 @@
+#!/usr/bin/perl
+# This tests the cache of symbol tables, it's filled by symbolizing frames
+# of crashinfo itself
+
+use strict;
+
+use Test::More tests => 8;
+use File::Temp;
+use Cwd;
+
+my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+my $cache = "$outputdir/cache";
+my $image = getcwd . '/../crashinfo';
+
+sub symbolize {
+	open my $f, '>', "$outputdir/info";
+	print $f <<"EOF";
+executable_mappings:
+  0x0000000001000000: { f: "$image", b: ~ }
+threads:
+  - tid: 1
+    backtrace: [
+      { a: 0x0000000001000010, S: 0 }
+    ]
+EOF
+	close $f;
+	system '../crashinfo', "-ocache_path=$cache", @_, '-S', "$outputdir/info";
+	my @sym = glob "$cache/*.sym";
+	return @sym;
+}
+
+sub touch_old {
+	my ($path, $size) = @_;
+	open my $f, '>', $path;
+	print $f "\0" x $size;
+	close $f;
+	utime 1, 1, $path;
+}
+
+# Miss
+my @sym = symbolize();
+is(scalar @sym, 1, 'Symbol table is stored to the cache');
+my $ino = (stat $sym[0])[1];
+
+# Hit, the file is used and marked as recently used
+utime 1, 1, $sym[0];
+symbolize();
+is((stat $sym[0])[1], $ino, 'Cached symbol table is used');
+ok((stat $sym[0])[9] > 1, 'Cached symbol table is marked as used');
+
+# Eviction of the least recently used file, files are removed when a new
+# one is stored
+my $size = -s $sym[0];
+unlink $sym[0];
+touch_old("$cache/old.sym", $size);
+touch_old("$cache/.old.sym.XXXXXX", 16);
+open my $f, '>', "$cache/.new.sym.XXXXXX";
+close $f;
+@sym = symbolize("-ocache_size=" . ($size + 1024));
+is(scalar @sym, 1, 'Least recently used file is evicted');
+ok(!-e "$cache/.old.sym.XXXXXX", 'Stale temporary file is removed');
+ok(-e "$cache/.new.sym.XXXXXX", 'Temporary file being written is kept');
+
+# Expiration
+unlink $sym[0];
+touch_old("$cache/old.sym", 16);
+@sym = symbolize("-ocache_max_age=3600");
+is(scalar @sym, 1, 'Expired file is removed');
+
+# Sizes over 4 GB aren't truncated
+unlink $sym[0];
+@sym = symbolize("-ocache_size=4294967360");
+is(scalar @sym, 1, 'Cache size over 4 GB is accepted');
@@ -0,0 +1,56 @@
+#!/usr/bin/perl
+# This tests cores passed to the daemon and the fallback if it isn't running
+
+use strict;
+
+use Test::More tests => 10;
+use IO::Socket::UNIX;
+use File::Temp;
+use Time::HiRes qw(sleep);
+use Util;
+use Cwd;
+
+my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+my $socket = "$outputdir/socket";
+
+# The core is processed by the client if the daemon isn't running
+is(crashinfo_pipe("daemon_socket" => $socket, "core_output" => "$outputdir/fallback"), 0,
+		'Crashinfo return value is 0');
+is(system("cmp -s '$outputdir/fallback' 'inputdir/core'"), 0, 'Core is the same');
+
+my $daemon = fork;
+if (!$daemon) {
+	exec '../crashinfo', '-D', "-odaemon_socket=$socket", '-oproc_path=inputdir/proc',
+			"-ocore_output=$outputdir/core-\@Q", '-ocore_exists=sequence',
+			"-oinfo_output=$outputdir/info-\@Q", '-oinfo_exists=sequence';
+	exit 1;
+}
+for (my $i = 0; $i < 50 && ! -S $socket; $i++) {
+	sleep 0.1;
+}
+ok(-S $socket, 'Daemon is listening');
+
+foreach my $seq (0, 1) {
+	is(crashinfo_pipe("daemon_socket" => $socket, "core_output" => "$outputdir/client"), 0,
+			'Crashinfo return value is 0');
+}
+ok(! -e "$outputdir/client", 'Client does not write the core');
+
+# The client exits once the daemon took the core, wait for it
+for (my $i = 0; $i < 50 && (-s "$outputdir/core-1" // 0) < -s 'inputdir/core'; $i++) {
+	sleep 0.1;
+}
+sleep 0.2;
+is(system("cmp -s '$outputdir/core-0' 'inputdir/core' && cmp -s '$outputdir/core-1' 'inputdir/core'"),
+		0, 'Cores are the same');
+ok(-s "$outputdir/info-0" && -s "$outputdir/info-1", 'Info streams are written');
+
+# A client which doesn't pass its core doesn't stall others
+my $silent = IO::Socket::UNIX->new(Peer => $socket);
+is(crashinfo_pipe("daemon_socket" => $socket, "core_output" => "$outputdir/stalled"), 0,
+		'Crashinfo return value is 0');
+ok(! -e "$outputdir/stalled", 'Core is passed to the daemon after a silent client');
+close $silent;
+
+kill 'TERM', $daemon;
+waitpid $daemon, 0;
@@ -0,0 +1,45 @@
+#!/usr/bin/perl
+# This tests threads with identical stacks are grouped
+
+use strict;
+
+use Test::More;
+use File::Temp;
+use Util;
+use Cwd;
+
+my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+
+# Stacks are dumped by the unwinder
+crashinfo("info_output" => "$outputdir/probe");
+if (system("grep -q '^crash_signature:' '$outputdir/probe'")) {
+	plan skip_all => 'Crashinfo is built without libunwind';
+}
+plan tests => 7;
+
+sub info {
+	my ($name) = @_;
+	open my $f, '<', "$outputdir/$name";
+	return grep !/^(processing_time|unwinder_lag_peak):/, <$f>;
+}
+
+is(crashinfo("info_output" => "$outputdir/serial", "backtrace_group" => 1,
+		"unwind_threads" => 1), 0, 'Crashinfo return value is 0');
+my @info = info("serial");
+my @stacks = grep /^  - id: 0x[0-9a-f]{16}$/, @info;
+my @refs = grep /^    stack: 0x[0-9a-f]{16}$/, @info;
+ok(scalar @stacks, 'Stacks are dumped');
+is(scalar(grep /^    registers:/, @info), 0, 'Registers are not dumped');
+
+# Every stack referred by a thread is dumped exactly once
+my %ids = map { /(0x[0-9a-f]+)/; $1 => 1 } @stacks;
+is(scalar(keys %ids), scalar @stacks, 'Stacks are unique');
+is(scalar(grep { /(0x[0-9a-f]+)/; !$ids{$1} } @refs), 0, 'Threads refer to dumped stacks');
+
+# Parallel unwinding produces the same output
+crashinfo("info_output" => "$outputdir/parallel", "backtrace_group" => 1, "unwind_threads" => 4);
+is_deeply([info("parallel")], \@info, 'Parallel output is the same');
+
+crashinfo("info_output" => "$outputdir/registers", "backtrace_group" => 1,
+		"backtrace_group_registers" => 1);
+ok(scalar(grep /^    registers:/, info("registers")), 'Registers are dumped');
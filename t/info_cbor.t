@@ -0,0 +1,53 @@
+#!/usr/bin/perl
+# This tests the CBOR info format and its conversion to YAML
+
+use strict;
+
+use Test::More tests => 9;
+use File::Temp;
+use Util;
+use Cwd;
+
+my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+
+sub text {
+	my ($s) = @_;
+	return chr(0x60 + length $s) . $s;
+}
+
+sub lines {
+	my ($file) = @_;
+	open my $f, '<', $file;
+	return grep !/^(#|datetime:|processing_time:)/, <$f>;
+}
+
+is(crashinfo("info_output" => "$outputdir/info.yaml"), 0, 'Crashinfo return value is 0');
+is(crashinfo("info_output" => "$outputdir/info.cbor", "info_format" => "cbor"), 0,
+		'Crashinfo return value is 0');
+
+# Self-described CBOR with an indefinite length map
+open my $f, '<:raw', "$outputdir/info.cbor";
+read $f, my $magic, 4;
+is(unpack('H*', $magic), 'd9d9f7bf', 'Stream starts with the CBOR tag');
+ok(-s "$outputdir/info.cbor" < -s "$outputdir/info.yaml", 'Stream is smaller');
+
+# Converted stream is the same as the YAML one
+is(system("../crashinfo -Y '$outputdir/info.cbor' > '$outputdir/converted.yaml'"), 0,
+		'Conversion return value is 0');
+is_deeply([lines("$outputdir/converted.yaml")], [lines("$outputdir/info.yaml")],
+		'Converted stream is the same');
+
+# Truncated stream is reported
+truncate "$outputdir/info.cbor", (-s "$outputdir/info.cbor") - 1;
+isnt(system("../crashinfo -Y '$outputdir/info.cbor' > /dev/null 2>&1"), 0,
+		'Conversion of a truncated stream fails');
+
+# Files of older streams are chunked text strings
+open $f, '>:raw', "$outputdir/chunked.cbor";
+print $f "\xd9\xd9\xf7\xbf", text('proc_dump'), "\xbf", text('lines'),
+		"\x7f", text("first\n"), text('second'), "\xff\xff\xff";
+close $f;
+is(system("../crashinfo -Y '$outputdir/chunked.cbor' > '$outputdir/chunked.yaml'"), 0,
+		'Conversion return value is 0');
+is(join('', lines("$outputdir/chunked.yaml")),
+		"proc_dump:\n  \"lines\": |\n    first\n    second\n", 'Chunked text is joined');
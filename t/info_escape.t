@@ -0,0 +1,56 @@
+#!/usr/bin/perl
+# This tests escaping of strings and dumping of /proc files in the info stream
+
+use strict;
+
+use Test::More tests => 7;
+use File::Temp;
+use Util;
+use Cwd;
+
+my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+
+sub lines {
+	my ($file) = @_;
+	open my $f, '<', $file;
+	return grep !/^(#|datetime:|processing_time:)/, <$f>;
+}
+
+# Arguments are longer than a vector and need escaping in the middle and at the end
+system 'cp', '-a', 'inputdir/proc', "$outputdir/proc";
+my @args = ('a' x 70, "q\"b\\t\tn\nc\x01d\x7fe\xc3\xa9" . 'x' x 40, "\r");
+open my $f, '>:raw', "$outputdir/proc/cmdline";
+print $f join("\0", @args), "\0";
+close $f;
+open $f, '>:raw', "$outputdir/proc/lines";
+print $f "first  \t\nsecond\r\n\nlast";
+close $f;
+
+my @opts = ("proc_path" => "$outputdir/proc", "proc_dump_root" => "lines");
+is(crashinfo(@opts, "info_output" => "$outputdir/info.yaml"), 0, 'Crashinfo return value is 0');
+my @info = lines("$outputdir/info.yaml");
+
+my $cmdline = '"' . 'a' x 70 . '", "q\\"b\\\\t\\tn\\nc\\x01d\\x7fe\\xc3\\xa9' . 'x' x 40 . '", "\\r"';
+is((grep /^cmdline:/, @info)[0], "cmdline: [ $cmdline ]\n", 'Arguments are escaped');
+
+my ($i) = grep { $info[$_] =~ /^  "lines": \|$/ } 0 .. $#info;
+ok(defined $i, 'File is dumped');
+is(join('', @info[$i + 1 .. $i + 4]), "    first\n    second\n    \n    last\n",
+		'Trailing white spaces are removed');
+
+# The converted CBOR stream is escaped in the same way
+is(crashinfo(@opts, "info_output" => "$outputdir/info.cbor", "info_format" => "cbor"), 0,
+		'Crashinfo return value is 0');
+system "../crashinfo -Y '$outputdir/info.cbor' > '$outputdir/converted.yaml'";
+is_deeply([lines("$outputdir/converted.yaml")], \@info, 'Converted stream is the same');
+
+# A file bigger than a chunk of the snapshot arena is dumped whole
+open $f, '>', "$outputdir/proc/big";
+print $f map { "line $_\n" } 1 .. 40000;
+close $f;
+crashinfo("proc_path" => "$outputdir/proc", "proc_dump_root" => "big",
+		"info_output" => "$outputdir/big.yaml");
+@info = lines("$outputdir/big.yaml");
+($i) = grep { $info[$_] =~ /^  "big": \|$/ } 0 .. $#info;
+is(join('', @info[$i + 1 .. $i + 40000]), join('', map { "    line $_\n" } 1 .. 40000),
+		'Big file is dumped');
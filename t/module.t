@@ -0,0 +1,46 @@
+#!/usr/bin/perl
+# This tests symbol tables of modules are loaded only when they are needed
+
+use strict;
+
+use Test::More;
+use File::Temp;
+use Util;
+use Cwd;
+
+my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+my $cache = "$outputdir/cache";
+
+# Stacks are dumped by the unwinder
+crashinfo("info_output" => "$outputdir/probe");
+if (system("grep -q '^crash_signature:' '$outputdir/probe'")) {
+	plan skip_all => 'Crashinfo is built without libunwind';
+}
+plan tests => 7;
+
+sub info {
+	my ($name, @opts) = @_;
+	crashinfo("info_output" => "$outputdir/$name", @opts);
+	open my $f, '<', "$outputdir/$name";
+	return <$f>;
+}
+
+# Without the cache, functions are looked up by the unwinder
+my @info = info("nocache");
+ok(!grep(/^symbol_cache:/, @info), 'Symbol tables are not used without the cache');
+ok(grep(/ s: recurse,/, @info), 'Frames are named by the unwinder');
+
+# With the cache, tables are built only for images with frames
+@info = info("miss", "cache_path" => $cache);
+my ($misses) = map /^symbol_cache: \{ hits: 0, misses: (\d+) \}/, @info;
+my $mappings = grep /^  0x/, @info;
+my @sym = glob "$cache/*.sym";
+ok($misses && @sym == $misses, 'Symbol tables are stored to the cache');
+ok($misses < $mappings, 'Symbol tables of images without frames are not built');
+ok(grep(/ s: recurse,/, @info), 'Frames are named by symbol tables');
+
+# Tables are found in the cache
+@info = info("hit", "cache_path" => $cache);
+is((grep /^symbol_cache:/, @info)[0], "symbol_cache: { hits: $misses, misses: 0 }\n",
+		'Symbol tables are found in the cache');
+ok(grep(/ s: recurse,/, @info), 'Frames are named by cached symbol tables');
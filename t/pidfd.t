@@ -0,0 +1,57 @@
+#!/usr/bin/perl
+# This tests access to the process given by a pidfd
+
+use strict;
+
+use Test::More;
+use File::Temp;
+use Fcntl;
+use Util;
+use Cwd;
+
+my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+
+# The process of the pidfd is read from /proc instead of the core
+my $pid = fork;
+if (!$pid) {
+	exec 'sleep', '30';
+}
+my $pidfd = syscall(434, $pid, 0); # pidfd_open
+if ($pidfd < 0) {
+	kill 'KILL', $pid;
+	plan skip_all => 'pidfd is not supported';
+}
+plan tests => 3;
+
+# pidfd_open sets close-on-exec
+open my $fh, '<&=', $pidfd;
+fcntl($fh, F_SETFD, 0);
+
+sub crashinfo_pidfd {
+	my ($fd, $name) = @_;
+	open my $stderr, '>&', \*STDERR;
+	open STDERR, '>', "$outputdir/$name.log";
+	system '../crashinfo', "-F$fd", '-ocore=inputdir/core', '-oproc_dump_root=comm',
+			"-oinfo_output=$outputdir/$name";
+	open STDERR, '>&', $stderr;
+	open my $f, '<', "$outputdir/$name";
+	my @info = <$f>;
+	open $f, '<', "$outputdir/$name.log";
+	return (\@info, [<$f>]);
+}
+
+my ($info, $log) = crashinfo_pidfd($pidfd, 'pidfd');
+my ($i) = grep { $info->[$_] =~ /^  "comm": \|$/ } 0 .. $#$info;
+is($info->[$i + 1], "    sleep\n", 'Process of the pidfd is read');
+
+# Other descriptors are rejected
+open my $null, '<', '/dev/null';
+fcntl($null, F_SETFD, 0);
+($info, $log) = crashinfo_pidfd(fileno($null), 'null');
+is(scalar(grep /is not a pidfd/, @$log), 1, 'Descriptor which is not a pidfd is rejected');
+
+# The process must exist
+kill 'KILL', $pid;
+waitpid $pid, 0;
+($info, $log) = crashinfo_pidfd($pidfd, 'exited');
+is(scalar(grep /Process of pidfd \d+ exited/, @$log), 1, 'Exited process is detected');
@@ -0,0 +1,97 @@
+#!/usr/bin/perl
+# This tests reading of mappings from /proc and from core notes
+
+use strict;
+
+use Test::More tests => 13;
+use File::Temp;
+use Util;
+use Cwd;
+
+my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+
+system 'cp', '-a', 'inputdir/proc', "$outputdir/proc";
+open my $f, '>', "$outputdir/proc/maps";
+print $f <<'EOF';
+55d000-55e000 r--p 00000000 08:01 123   /usr/bin/crash
+55e000-55f000 r-xp 00001000 08:01 123                       /usr/bin/crash
+7f0000-7f1000 r-xp 00000000 08:01 124 /lib/with space.so (deleted)
+7f1000-7f2000 r-xp 00000000 00:00 0
+7f2000-7f3000 r-xp 00000000 00:00 0                          [vdso]
+7f3000-7f4000 rwxp 00000000 08:01 125   /jit/file
+7F5000-7F6000 r-xp 00000000 08:01 126 /upper/hex
+ffffffffff600000-ffffffffff601000 --xp 00000000 00:00 0                  [vsyscall]
+EOF
+close $f;
+
+is(crashinfo("proc_path" => "$outputdir/proc", "info_output" => "$outputdir/info",
+		"mappings_source" => "proc"), 0,
+		'Crashinfo return value is 0');
+
+open $f, '<', "$outputdir/info";
+my @info = <$f>;
+my ($i) = grep { $info[$_] eq "executable_mappings:\n" } 0 .. $#info;
+ok(defined $i, 'Mappings are dumped');
+is(join('', @info[$i + 1 .. $i + 4]),
+		"  0x000000000055e000: \"/usr/bin/crash\"\n" .
+		"  0x00000000007f0000: \"/lib/with space.so (deleted)\"\n" .
+		"  0x00000000007f3000: \"/jit/file\"\n" .
+		"  0x00000000007f5000: \"/upper/hex\"\n",
+		'Executable mappings of images are read');
+
+# A core with NT_AUXV and NT_FILE notes, the second mapping is executable
+sub note {
+	my ($type, $desc) = @_;
+	$desc .= "\0" x (-length($desc) % 4);
+	return pack('LLL', 5, length $desc, $type) . "CORE\0\0\0\0" . $desc;
+}
+sub core {
+	my ($path, $auxv) = @_;
+	my $notes = note(6, $auxv) . note(0x46494c45,
+			pack('Q11', 3, 4096, 0x400000, 0x401000, 0, 0x401000, 0x402000, 1,
+				0x7f0000, 0x7f1000, 0) . "/bin/exe\0/bin/exe\0/lib/data\0");
+	my @loads = ([0x400000, 4], [0x401000, 5], [0x7f0000, 6]);
+	my $data = unpack('C', pack('S', 1)) == 1 ? 1 : 2;
+	my $phoff = 64;
+	my $notesoff = $phoff + 56 * (1 + @loads);
+	open my $f, '>:raw', $path;
+	print $f "\x7fELF", pack('CCC', 2, $data, 1), "\0" x 9,
+			pack('SSLQQQLSSSSSS', 4, 62, 1, 0, $phoff, 0, 0, 64, 56, 1 + @loads, 0, 0, 0),
+			pack('LLQQQQQQ', 4, 0, $notesoff, 0, 0, length $notes, 0, 4),
+			map({ pack('LLQQQQQQ', 1, $_->[1], 0, $_->[0], 0, 0, 4096, 4096) } @loads),
+			$notes;
+	close $f;
+}
+
+sub exe {
+	my ($name, @conf) = @_;
+	@conf = ("mappings_source" => "core") if !@conf;
+	is(crashinfo("core" => "$outputdir/$name", "proc_path" => "$outputdir/proc",
+			"info_output" => "$outputdir/$name.info", @conf), 0,
+			'Crashinfo return value is 0');
+	open my $f, '<', "$outputdir/$name.info";
+	my @info = <$f>;
+	return ((grep /^exe:/, @info)[0], @info);
+}
+
+core("$outputdir/core", pack('Q4', 3, 0x400040, 0, 0));
+(my $exe, @info) = exe("core");
+is($exe, "exe: \"/bin/exe\"\n", 'Executable is read from notes');
+($i) = grep { $info[$_] eq "executable_mappings:\n" } 0 .. $#info;
+ok(defined $i, 'Mappings are dumped');
+is(join('', grep /^  0x/, @info[$i + 1 .. $i + 2]), "  0x0000000000401000: \"/bin/exe\"\n",
+		'Executable mappings are read from notes');
+
+# Program headers aren't mapped, the entry point is
+core("$outputdir/entry", pack('Q6', 3, 0x900040, 9, 0x401010, 0, 0));
+($exe) = exe("entry");
+is($exe, "exe: \"/bin/exe\"\n", 'Executable is found by the entry point');
+
+# Paths in notes may be in another mount namespace, /proc is preferred
+core("$outputdir/auto", pack('Q4', 3, 0x400040, 0, 0));
+($exe, @info) = exe("auto", "mappings_source" => "auto");
+ok(grep($_ eq "  0x000000000055e000: \"/usr/bin/crash\"\n", @info)
+		&& !grep(/"\/bin\/exe"/, @info), 'Mappings are read from /proc by default');
+core("$outputdir/ignore", pack('Q4', 3, 0x400040, 0, 0));
+($exe) = exe("ignore", "mappings_source" => "auto", "proc_ignore" => 1);
+is($exe, "exe: \"/bin/exe\"\n", 'Notes are used, when /proc is ignored');
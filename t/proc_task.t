@@ -0,0 +1,69 @@
+#!/usr/bin/perl
+# This tests reading of namespace PIDs of tasks from /proc
+
+use strict;
+
+use Test::More tests => 7;
+use File::Temp;
+use Util;
+use Cwd;
+
+my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+
+# /proc is read before the info stream is opened, messages go to stderr
+sub crashinfo_log {
+	my ($name, @opts) = @_;
+	open my $stderr, '>&', \*STDERR;
+	open STDERR, '>', "$outputdir/$name";
+	my $rtn = crashinfo("proc_path" => "$outputdir/proc", "log_stderr" => "notice",
+			"info_output" => "$outputdir/info", @opts);
+	open STDERR, '>&', $stderr;
+	open my $f, '<', "$outputdir/$name";
+	return ($rtn, <$f>);
+}
+
+# Add synthetic tasks, so they are read by several threads
+system 'cp', '-a', 'inputdir/proc', "$outputdir/proc";
+for my $tid (100000 .. 102999) {
+	mkdir "$outputdir/proc/task/$tid";
+	open my $f, '>', "$outputdir/proc/task/$tid/status";
+	print $f "Name:\tcrash\nTgid:\t100000\nPid:\t$tid\nNSpid:\t$tid\t" . ($tid - 99000) . "\n";
+}
+
+my ($rtn, @log) = crashinfo_log("read", "proc_threads" => 4);
+is($rtn, 0, 'Crashinfo return value is 0');
+is(scalar(grep /Failed to read \/proc info/, @log), 0, 'Tasks are read');
+
+# A malformed status fails reading of /proc
+open my $f, '>', "$outputdir/proc/task/102999/status";
+print $f "Name:\tcrash\nNSpid:\t102999\tx\n";
+close $f;
+($rtn, @log) = crashinfo_log("malformed");
+is(scalar(grep /Malformed NSpid of task 102999/, @log), 1, 'Malformed status is reported');
+is(scalar(grep /Failed to read \/proc info/, @log), 1, 'Reading of /proc fails');
+
+# A missing status fails reading of /proc as well
+unlink "$outputdir/proc/task/102999/status";
+($rtn, @log) = crashinfo_log("missing");
+is(scalar(grep /Can't read '.*\/task\/102999\/status'/, @log), 1, 'Missing status is reported');
+
+# NSpid follows groups, which may not fit a single read. All tasks have the
+# same NSpid, so each one after the first is reported as a duplicate.
+open $f, '>', "$outputdir/proc/task/102999/status";
+print $f "Name:\tcrash\nNSpid:\t102999\t3999\n";
+close $f;
+for my $i (0 .. 40) {
+	my $tid = 103000 + $i;
+	mkdir "$outputdir/proc/task/$tid";
+	open $f, '>', "$outputdir/proc/task/$tid/status";
+	print $f "Name:\tcrash\nGroups:\t" . '0' x (4050 + $i) . "\nNSpid:\t$tid\t5000\n";
+	close $f;
+}
+($rtn, @log) = crashinfo_log("groups");
+is(scalar(grep /Task \d+ has a duplicate NSpid 5000/, @log), 40, 'NSpid after long groups is read');
+
+open $f, '>', "$outputdir/proc/task/103040/status";
+print $f "Name:\tcrash\nGroups:\t" . '0' x 10000 . "\nNSpid:\t103040\tx\n";
+close $f;
+($rtn, @log) = crashinfo_log("groups_malformed");
+is(scalar(grep /Malformed NSpid of task 103040/, @log), 1, 'Malformed NSpid after long groups is reported');
@@ -0,0 +1,38 @@
+#!/usr/bin/perl
+# This tests reprocessing of a directory with cores
+
+use strict;
+
+use Test::More tests => 9;
+use File::Temp;
+use File::Copy;
+use Util;
+use Cwd;
+
+my $coredir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+foreach my $core (qw(a b c)) {
+	copy('inputdir/core', "$coredir/$core.core");
+}
+copy('inputdir/proc/stat', "$coredir/stat");
+
+# Info streams are written next to the cores by default
+is(system('../crashinfo', '-R', $coredir, '-oreprocess_jobs=2'), 0, 'Crashinfo returns 0');
+my @files = map s/.*\/// && $_, sort glob "$coredir/*.yaml";
+is_deeply(\@files, [qw(a.core.yaml b.core.yaml c.core.yaml)], 'Info of each core is created');
+is(-s "$coredir/a.core.yaml" > 0, 1, 'Info is not empty');
+
+# Reprocessing overwrites them
+my $size = -s "$coredir/a.core.yaml";
+is(system('../crashinfo', '-R', $coredir), 0, 'Crashinfo returns 0');
+is(-s "$coredir/a.core.yaml", $size, 'Info is overwritten');
+
+# Configured output
+my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+is(system('../crashinfo', '--reprocess', $coredir, "-oinfo_output=$outputdir/\@c.info",
+		'-oreprocess_jobs=1'), 0, 'Crashinfo returns 0');
+@files = map s/.*\/// && $_, sort glob "$outputdir/*";
+is_deeply(\@files, [qw(a.core.info b.core.info c.core.info)], 'Info of each core is created');
+
+# Missing directory
+isnt(system('../crashinfo', '-R', "$coredir/missing"), 0, 'Crashinfo fails');
+is(-e "$coredir/missing", undef, 'Nothing is created');
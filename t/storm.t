@@ -0,0 +1,45 @@
+#!/usr/bin/perl
+# This tests cores of repeated crashes are suppressed
+
+use strict;
+
+use Test::More;
+use File::Temp;
+use Util;
+use Cwd;
+
+my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+
+# Signatures are computed by the unwinder
+crashinfo("info_output" => "$outputdir/probe");
+if (system("grep -q '^crash_signature:' '$outputdir/probe'")) {
+	plan skip_all => 'Crashinfo is built without libunwind';
+}
+plan tests => 16;
+my @conf = ("storm_table" => "$outputdir/table", "storm_burst" => 2, "storm_interval" => 3600);
+
+foreach my $crash (1 .. 4) {
+	my @stream = ("core_output" => "$outputdir/core$crash", "info_output" => "$outputdir/info$crash");
+	is(crashinfo_pipe(@conf, @stream), 0, 'Crashinfo return value is 0');
+
+	open my $info, '<', "$outputdir/info$crash";
+	my ($storm) = grep /^crash_storm:/, <$info>;
+	if ($crash <= 2) {
+		is(system("cmp -s '$outputdir/core$crash' 'inputdir/core'"), 0, 'Core is written');
+		is($storm, "crash_storm: { suppressed: 0, count: 0 }\n", 'Core is not suppressed');
+	} else {
+		ok(! -e "$outputdir/core$crash", 'Core is removed');
+		is($storm, "crash_storm: { suppressed: 1, count: " . ($crash - 2) . " }\n",
+				'Core is suppressed');
+	}
+}
+
+# Signatures are the same for all crashes
+my @signatures = map { open my $f, '<', $_; grep /^crash_signature:/, <$f> } glob "$outputdir/info*";
+is(scalar @signatures, 4, 'Signature is written');
+is(scalar(grep $_ eq $signatures[0], @signatures), 4, 'Signatures are the same');
+
+# Each executable has its own bucket
+my @other = ("storm_table" => "$outputdir/table", "storm_burst" => 2, "proc_exe" => "/other");
+is(crashinfo(@other, "core_output" => "$outputdir/other"), 0, 'Crashinfo return value is 0');
+ok(-e "$outputdir/other", 'Core of another executable is written');
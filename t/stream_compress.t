@@ -0,0 +1,46 @@
+#!/usr/bin/perl
+# This tests the built-in compression of both streams
+
+use strict;
+
+use Test::More;
+use File::Temp;
+use Util;
+use Cwd;
+
+my %algorithms = (
+	"zstd" => "zstd -dc",
+	"zstd:19" => "zstd -dc",
+	"lz4" => "lz4 -dc",
+	"lz4:9" => "lz4 -dc",
+);
+
+foreach my $algorithm (sort keys %algorithms) {
+	my $decompress = $algorithms{$algorithm};
+
+	SKIP: {
+		skip "$algorithm is not compiled in", 9
+			if system("../crashinfo -o core_compress=$algorithm -h > /dev/null 2>&1");
+		skip "$decompress is not available", 9
+			if system("$decompress < /dev/null > /dev/null 2>&1") >> 8 == 127;
+
+		foreach my $variant (["info", 0], ["core", 0], ["core", 4]) {
+			my ($stream, $threads) = @$variant;
+			my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+			my @conf = ("${stream}_output" => "$outputdir/output",
+					"${stream}_compress" => $algorithm,
+					"core_compress_threads" => $threads,
+					"core_compress_chunk_size" => 65536);
+
+			is(crashinfo(@conf), 0, 'Crashinfo return value is 0');
+			is(system("$decompress '$outputdir/output' > '$outputdir/reverse'"), 0, "Decompress $algorithm");
+			if ($stream eq 'core') {
+				is(system("cmp -s '$outputdir/reverse' 'inputdir/core'"), 0, 'Core is the same');
+			} else {
+				like(`head -1 '$outputdir/reverse'`, qr/^---$/, 'Info is YAML');
+			}
+		}
+	}
+}
+
+done_testing();
@@ -0,0 +1,48 @@
+#!/usr/bin/perl
+# This tests notify commands are started after filters wrote the whole output
+
+use strict;
+
+use Test::More tests => 6;
+use File::Temp;
+use Util;
+use Cwd;
+
+my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+
+sub script {
+	my ($name, $body) = @_;
+	open my $f, '>', "$outputdir/$name";
+	print $f "#!/bin/sh\n$body";
+	close $f;
+	chmod 0755, "$outputdir/$name";
+	return "$outputdir/$name";
+}
+
+# Filters write their output a while after the end of the input, notify
+# commands take a snapshot of the output
+my $slow = "cat > \"\$0.tmp\"\nsleep 1\ncat \"\$0.tmp\"\n";
+my @conf = (
+	"core_output" => "$outputdir/core", "core_filter" => script('core_slow', $slow),
+	"info_output" => "$outputdir/info", "info_filter" => script('info_slow', $slow),
+	"core_notify" => script('snapshot', "cp \"\$1\" \"\$1.\$2\"\n") . " \@1 notify",
+	"info_notify" => "$outputdir/snapshot \@1 notify",
+	"info_core_notify" => "$outputdir/snapshot \@2 both \@1",
+);
+
+sub snapshot {
+	my $path = shift;
+	for (1 .. 50) {
+		last if -e $path;
+		select undef, undef, undef, 0.1;
+	}
+	select undef, undef, undef, 0.2;
+	return system('cmp', '-s', $path, shift);
+}
+
+is(crashinfo(@conf), 0, 'Crashinfo return value is 0');
+is(system("cmp -s '$outputdir/core' inputdir/core"), 0, 'Core is the same');
+ok(-s "$outputdir/info", 'Info is written');
+is(snapshot("$outputdir/core.notify", "$outputdir/core"), 0, 'Core notify sees the whole core');
+is(snapshot("$outputdir/info.notify", "$outputdir/info"), 0, 'Info notify sees the whole info');
+is(snapshot("$outputdir/core.both", "$outputdir/core"), 0, 'Info and core notify sees the whole core');
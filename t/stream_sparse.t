@@ -0,0 +1,34 @@
+#!/usr/bin/perl
+# This tests core_sparse doesn't change the core content
+
+use strict;
+
+use Test::More tests => 10;
+use File::Temp;
+use Util;
+use Cwd;
+
+my %confs = (
+	"plain" => [],
+	"append" => ["core_exists" => "append"],
+	"filtered" => ["core_filter" => "cat"],
+);
+
+while (my ($name, $conf) = each %confs) {
+	my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+	my @conf = ("core_output" => "$outputdir/core", "core_sparse" => 1, @$conf);
+
+	is(crashinfo(@conf), 0, 'Crashinfo return value is 0');
+	is(system("cmp -s '$outputdir/core' 'inputdir/core'"), 0, "Core is the same ($name)");
+	is(-s "$outputdir/core", -s "inputdir/core", "Core size is the same ($name)");
+}
+
+# The output is preallocated to the size of the core from its headers
+my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+open my $stderr, '>&', \*STDERR;
+open STDERR, '>', "$outputdir/log";
+crashinfo("core_output" => "$outputdir/core", "core_sparse" => 1, "log_stderr" => "info");
+open STDERR, '>&', $stderr;
+open my $f, '<', "$outputdir/log";
+my $size = -s "inputdir/core";
+is(scalar(grep /Preallocated $size bytes for the output/, <$f>), 1, 'Output is preallocated');
@@ -0,0 +1,40 @@
+#!/usr/bin/perl
+# This tests the core read from a pipe or a file is copied unchanged
+
+use strict;
+
+use Test::More tests => 20;
+use File::Temp;
+use Util;
+use Cwd;
+
+foreach my $splice (0, 1) {
+	# Append mode can't be spliced, which tests the fallback
+	foreach my $exists (qw(overwrite append)) {
+		my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+		my @conf = ("core_output" => "$outputdir/core", "core_exists" => $exists,
+				"core_splice" => $splice);
+
+		is(crashinfo_pipe(@conf), 0, 'Crashinfo return value is 0');
+		is(system("cmp -s '$outputdir/core' 'inputdir/core'"), 0, 'Core is the same');
+	}
+
+	my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+	my @conf = ("core_output" => "$outputdir/core.gz", "core_filter" => "gzip",
+			"core_splice" => $splice);
+
+	is(crashinfo_pipe(@conf), 0, 'Crashinfo return value is 0');
+	is(system("gunzip < '$outputdir/core.gz' | cmp -s - 'inputdir/core'"), 0, 'Filtered core is the same');
+}
+
+# A core file is copied in the kernel unless the output is appended
+foreach my $splice (0, 1) {
+	foreach my $exists (qw(overwrite append)) {
+		my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+		my @conf = ("core_output" => "$outputdir/core", "core_exists" => $exists,
+				"core_splice" => $splice);
+
+		is(crashinfo(@conf), 0, 'Crashinfo return value is 0');
+		is(system("cmp -s '$outputdir/core' 'inputdir/core'"), 0, 'Core file is the same');
+	}
+}
@@ -0,0 +1,51 @@
+#!/usr/bin/perl
+# This tests filling of function names into info streams written in the
+# deferred mode, frames are in crashinfo itself
+
+use strict;
+
+use Test::More tests => 6;
+use File::Copy;
+use File::Path;
+use File::Temp;
+use Cwd;
+
+my $outputdir = File::Temp->newdir('crashtest.XXXXX', CLEANUP => 1, DIR => getcwd);
+my $image = getcwd . '/../crashinfo';
+
+my ($main) = map { /^([0-9a-f]+) T main$/ ? hex $1 : () } `nm $image`;
+my ($text) = map { /^\s+LOAD\s+\S+\s+(0x[0-9a-f]+)\s.*R E/ ? hex $1 : () } `readelf -lW $image`;
+my $base = 0x1000000;
+my $ip = $base + $main - ($text & ~0xfff);
+
+sub symbolize {
+	my ($build_id, @frames) = @_;
+	open my $f, '>', "$outputdir/info";
+	print $f "executable_mappings:\n",
+			sprintf("  0x%016x: { f: \"%s\", b: %s }\n", $base, $image, $build_id),
+			"threads:\n", "  - tid: 1\n", "    backtrace: [\n",
+			join(",\n", @frames), " ]\n";
+	close $f;
+	system '../crashinfo', "-odebug_dir=$outputdir/debug", '-S', "$outputdir/info";
+	open $f, '<', "$outputdir/info";
+	return grep /^      \{ a: /, <$f>;
+}
+
+my @frames = symbolize('~', sprintf('      { a: 0x%016x, S: 0 }', $ip + 5),
+		sprintf('      { a: 0x%016x, m: 0, S: 0 }', $ip + 1));
+like($frames[0], qr/ s: main, +o: +0x5, /, 'Frame is named');
+like($frames[0], qr/, f: "\Q$image\E" \}/, 'Image of the frame is added');
+like($frames[1], qr/ s: main, +o: +0x1, /, 'Frame with the module index is named');
+
+@frames = symbolize('~', sprintf('      { a: 0x%016x, S: 0 }', $ip - 1),
+		sprintf('      { a: 0x%016x, S: 0 }', $ip));
+unlike($frames[1], qr/ s: main,/, 'Return address is looked up by the call instruction');
+
+# An image with a different build-id is read from its separate debug file
+my $id = '00112233445566778899aabbccddeeff00112233';
+@frames = symbolize($id, sprintf('      { a: 0x%016x, S: 0 }', $ip + 5));
+unlike($frames[0], qr/ s: /, 'Image with a different build-id is not used');
+mkpath("$outputdir/debug/.build-id/00");
+copy($image, "$outputdir/debug/.build-id/00/" . substr($id, 2) . '.debug');
+@frames = symbolize($id, sprintf('      { a: 0x%016x, S: 0 }', $ip + 5));
+like($frames[0], qr/ s: main,/, 'Debug file is found by the build-id');
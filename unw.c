@@ -21,7 +21,9 @@
 
 #define _ATFILE_SOURCE
 #include <sys/types.h>
+#include <pthread.h>
 #include <dirent.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -31,6 +33,13 @@
 #include <stdio.h>
 #include <ctype.h>
 
+#include "capture.h"
+#include "module.h"
+#include "unwtab.h"
+#include "symtab.h"
+#include "storm.h"
+#include "cache.h"
+#include "util.h"
 #include "info.h"
 #include "conf.h"
 #include "proc.h"
@@ -41,186 +50,745 @@
 
 #include <libunwind-coredump.h>
 
+/** Searches the binary search table of FDEs, it's exported by libunwind for
+ *  its remote unwinding libraries, but not declared in public headers. */
+extern int UNW_OBJ(dwarf_search_unwind_table)(unw_addr_space_t as, unw_word_t ip,
+		unw_dyn_info_t *di, unw_proc_info_t *pi, int need_unwind_info, void *arg);
+
+/** Start of the address range unwind tables of modules are visible at in the
+ *  address space of the unwinder. It's in the kernel half of 64-bit address
+ *  spaces, 32-bit user space can map it, so the window isn't used there. */
+#define UNWTAB_WINDOW ((unw_word_t)0xf << (sizeof(unw_word_t) * 8 - 4))
+
 static struct {
 	unw_addr_space_t as;
 	struct UCD_info *ui;
+	struct capture_s *capture;
+	/** Path the core can be opened again by, if capture is used. */
+	char path[32];
 	int ok;
 } core;
 
+/** Core accessors reading captured regions and cached unwind tables. */
+static unw_accessors_t accessors;
+
+/** Size of the window part each module table is visible at. */
+static unw_word_t unwtab_slot;
+
+/** Unwind tables of modules. */
+static const struct module_kind_s unwtab_kind = {
+	.name = "unw",
+	.check = unwtab_check,
+	.build = unwtab_build,
+	.hits = &run.unwind_cache_hits,
+	.misses = &run.unwind_cache_misses,
+};
+
+/** Read memory from unwind tables and captured regions, fall back to the
+ *  core reader, which can still read mappings from backing files. */
+static int unw_access_mem(unw_addr_space_t as, unw_word_t addr,
+		unw_word_t *val, int write, void *arg)
+{
+	if (!write && addr >= UNWTAB_WINDOW && unwtab_slot) {
+		unw_word_t idx = (addr - UNWTAB_WINDOW) / unwtab_slot;
+		unw_word_t off = (addr - UNWTAB_WINDOW) % unwtab_slot;
+
+		const struct cache_entry_s *e;
+
+		if (idx >= module_count) {
+			return -UNW_EINVAL;
+		}
+		e = &modules[idx].unwtab.entry;
+		if (off + sizeof *val > e->size) {
+			return -UNW_EINVAL;
+		}
+		memcpy(val, (const char *)e->data + off, sizeof *val);
+		return 0;
+	}
+
+	if (!write && core.capture && !capture_read(core.capture, addr, val, sizeof *val)) {
+		return 0;
+	}
+
+	return _UCD_accessors.access_mem(as, addr, val, write, arg);
+}
+
+/** Find the FDE of a function by the cached unwind table of its module,
+ *  fall back to the core reader, which parses the image. */
+static int unw_find_proc_info(unw_addr_space_t as, unw_word_t ip,
+		unw_proc_info_t *pi, int need_unwind_info, void *arg)
+{
+	const struct unwtab_s *t;
+	struct module_s *m;
+	unw_dyn_info_t di;
+	int rtn;
+
+	m = unwtab_slot ? module_find(ip) : NULL;
+	t = m ? module_get(m, &m->unwtab, &unwtab_kind) : NULL;
+	if (t && m->unwtab.entry.size <= unwtab_slot) {
+		memset(&di, 0, sizeof di);
+		di.start_ip = m->start;
+		di.end_ip = m->end;
+		di.format = UNW_INFO_FORMAT_REMOTE_TABLE;
+		di.u.rti.segbase = m->bias;
+		di.u.rti.table_data = UNWTAB_WINDOW + (m - modules) * unwtab_slot
+				+ offsetof(struct unwtab_s, entries);
+		di.u.rti.table_len = t->count * sizeof t->entries[0] / sizeof(unw_word_t);
+
+		rtn = UNW_OBJ(dwarf_search_unwind_table)(as, ip, &di, pi, need_unwind_info, arg);
+		if (rtn != -UNW_ENOINFO) {
+			return rtn;
+		}
+	}
+
+	return _UCD_accessors.find_proc_info(as, ip, pi, need_unwind_info, arg);
+}
+
 /** Prepare for dumping the core, doesn't require mappings
+ * @param[in] core_fd - pipe the core is read from or, if capture is given,
+ *                      a seekable file with the core headers and notes
+ * @param[in] capture - core regions captured while the core is copied
  * @return PID or -1 on error */
-int unw_prepare(int core_fd)
+int unw_prepare(int core_fd, struct capture_s *capture)
 {
-	int minpid = INT_MAX, minpid_fs = INT_MAX, pid, thread;
-	char buf[20];
+	int *pids, pid, thread, count;
 
-	core.as = unw_create_addr_space(&_UCD_accessors, 0);
+	accessors = _UCD_accessors;
+	accessors.access_mem = unw_access_mem;
+	accessors.find_proc_info = unw_find_proc_info;
+	core.capture = capture;
+
+	core.as = unw_create_addr_space(&accessors, 0);
 	if (!core.as) {
 		log_err("Failed to create address space");
 		return -1;
 	}
 
-	core.ui = _UCD_create_fd(core_fd, "<pipe>", conf.core_buffer_size);
+	if (capture) {
+		snprintf(core.path, sizeof core.path, "/proc/self/fd/%d", core_fd);
+		core.ui = _UCD_create(core.path);
+	} else {
+		core.ui = _UCD_create_fd(core_fd, "<pipe>", conf.core_buffer_size);
+	}
 	if (!core.ui) {
 		log_err("Failed to create UCD_info");
 		unw_destroy_addr_space(core.as);
 		return -1;
 	}
 
-	for (thread = 0; thread < _UCD_get_num_threads(core.ui); thread++) {
+	count = _UCD_get_num_threads(core.ui);
+	pids = malloc((count ?: 1) * sizeof *pids);
+	if (!pids) {
+		log_err("Can't allocate memory for PIDs");
+		core.ok = 1;
+		return -1;
+	}
+
+	for (thread = 0; thread < count; thread++) {
 		_UCD_select_thread(core.ui, thread);
-		pid = _UCD_get_pid(core.ui);
+		pids[thread] = _UCD_get_pid(core.ui);
+	}
+
+	pid = count ? proc_guess_pid(pids, count) : -1;
+	free(pids);
+	log_dbg("Unwinder returned PID: %d", pid);
+	core.ok = 1;
+	return pid;
+}
+
+/** Dump the backtrace of a core thread.
+ * @param[in] c - cursor at the top frame of the thread
+ * @param[out] out - stream the backtrace is dumped to
+ * @param[in,out] signature - signature of top frames, NULL if not needed */
+static void unw_backtrace(unw_cursor_t *c, struct info_out_s *out, uint64_t *signature)
+{
+	int rtn, depth, prev_signal = 1;
+
+	info_enc->backtrace_begin(out);
+	for (depth = 0; depth < conf.backtrace_max_depth; depth++) {
+		struct info_frame_s f = { .module = -1 };
+		unw_word_t woff;
+		uint64_t off, len;
+		unw_proc_info_t pi;
+		struct module_s *m;
+		char fname[256];
+		unw_word_t ip = 0;
+
+		f.ip_known = !unw_get_reg(c, UNW_REG_IP, &ip);
+		f.ip = ip;
+
+		rtn = unw_is_signal_frame(c);
+		if (rtn > 0) {
+			f.signal = 1;
+		} else if (rtn == 0) {
+			f.signal = 0;
+		} else {
+			f.signal = -1;
+		}
 
-		if (pid < minpid) {
-			minpid = pid;
+		if (signature && depth < conf.storm.frames) {
+			*signature = storm_frame(*signature, ip);
 		}
 
-		snprintf(buf, sizeof buf, "/proc/%d", pid);
-		if (pid < minpid_fs && !access(buf, F_OK)) {
-			minpid_fs = pid;
+		if (conf.symbolize == CONF_SYMBOLIZE_DEFERRED) {
+			// Names are filled in by crashinfo --symbolize
+			m = module_find(ip);
+			if (m) {
+				f.module = m - modules;
+			}
+			f.deferred = 1;
+			goto next;
+		}
+
+		rtn = unw_get_proc_info(c, &pi);
+		if (!rtn) {
+			f.len = pi.end_ip - pi.start_ip;
+			f.exception = pi.handler ? 1 : 0;
+		} else {
+			f.len = 0;
+			f.exception = -1;
+		}
+
+		// Return addresses are looked up by the call instruction before them
+		f.name = symtab_symbol(ip - !prev_signal, &off, &len);
+		if (f.name) {
+			f.off = off + !prev_signal;
+		} else if (!unw_get_proc_name(c, fname, sizeof fname, &woff)) {
+			f.name = fname;
+			f.off = woff;
+		}
+		f.quote = conf.symbolize_demangle;
+
+		// Backing files are the same in views of the core of all workers
+		if (proc_maps_file(ip, &f.file)) {
+			f.file = _UCD_get_proc_backing_file(core.ui, ip);
+		}
+
+next:		info_enc->frame(out, depth, &f);
+		prev_signal = f.signal > 0;
+
+		if (0 >= unw_step(c)) {
+			break;
 		}
 	}
+	info_enc->backtrace_end(out);
+}
 
-	pid = minpid_fs < INT_MAX ? minpid_fs : minpid;
-	log_dbg("Unwinder returned PID: %d", pid);
-	core.ok = 1;
-	return pid;
+/** Frame identity used to group threads with the same stack. */
+struct unw_frame_s {
+	unw_word_t ip;
+	unw_word_t signal;
+};
+
+/** Distinct stack of threads. */
+struct unw_stack_s {
+	/** Hash of frames. */
+	uint64_t hash;
+	/** Identifies the stack in the info stream, it's the hash made unique in
+	 *  the order of threads, so it doesn't depend on the order of unwinding. */
+	uint64_t id;
+	struct unw_frame_s *frames;
+	int depth;
+	/** Formatted backtrace. */
+	char *buf;
+	size_t len;
+	/** Threads with the stack, filled in the order of the core. */
+	int *tids, count;
+};
+
+/** Stacks shared by workers and the emitter. */
+static struct {
+	pthread_mutex_t lock;
+	/** Open addressing table of stacks keyed by their hashes, it has
+	 *  1 << bits slots, at least twice as many as threads. */
+	struct unw_stack_s **table;
+	int bits;
+	/** Stacks in the order of their first thread. */
+	struct unw_stack_s **order;
+	int ordered;
+} stacks = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/** Slot of the stacks table, where probing for a stack hash starts. */
+static inline unsigned unw_stack_slot(uint64_t hash)
+{
+	return hash * 0x9e3779b97f4a7c15ull >> (64 - stacks.bits);
 }
 
-int unw_dump(task_dumper_t task_dumper)
+/** Find the stack of a thread or add it, if it's seen for the first time.
+ *  Its backtrace is formatted only when it's added.
+ * @param[in] as - address space of the unwinder
+ * @param[in] ui - core of the unwinder, the thread is selected in it
+ * @param[in] thread - index of the thread in the core
+ * @return The stack or NULL on error */
+static struct unw_stack_s *unw_stack(unw_addr_space_t as, struct UCD_info *ui, int thread)
 {
+	struct unw_frame_s *frames;
+	struct unw_stack_s *s;
+	uint64_t hash = HASH_FNV_INIT, signature = HASH_FNV_INIT;
+	unsigned i, mask = (1u << stacks.bits) - 1;
 	unw_cursor_t c;
-	int rtn, thread, i;
+	struct info_out_s out;
+	int depth, rtn;
 
-	if (!core.ok) return -1;
+	frames = calloc(conf.backtrace_max_depth > 0 ? conf.backtrace_max_depth : 1,
+			sizeof *frames);
+	if (!frames || unw_init_remote(&c, as, ui)) {
+		goto err0;
+	}
 
-	if (!conf.proc.maps) {
-		log_warn("Mapping information are not available\n");
-	} else {
-		const struct conf_multi_mapping_s *map;
-		for (map = conf.proc.maps; map; map = map->next) {
-			rtn = _UCD_add_backing_file_at_vaddr(core.ui, map->addr, map->file);
+	for (depth = 0; depth < conf.backtrace_max_depth; depth++) {
+		unw_word_t ip = 0;
+
+		unw_get_reg(&c, UNW_REG_IP, &ip);
+		rtn = unw_is_signal_frame(&c);
+		frames[depth].ip = ip;
+		frames[depth].signal = rtn > 0 ? 1 : rtn == 0 ? 0 : -1;
+		if (thread == 0 && depth < conf.storm.frames) {
+			signature = storm_frame(signature, ip);
+		}
+		if (0 >= unw_step(&c)) {
+			depth++;
+			break;
 		}
 	}
+	hash = hash_fnv(hash, frames, depth * sizeof *frames);
 
-	rtn = unw_init_remote(&c, core.as, core.ui);
-	if (rtn) {
-		log_err("Failed to initialize the unwind cursor: %s",
-				unw_strerror(rtn));
-		rtn = -1;
-		goto rtn0;
+	if (thread == 0) {
+		storm_crash(signature);
 	}
 
-	fputs("threads:\n", run.info.output);
-	for (thread = 0; thread < _UCD_get_num_threads(core.ui); thread++) {
-		const struct timeval *t;
-		int depth;
+	// Each thread adds one stack at most, so the table never fills up
+	pthread_mutex_lock(&stacks.lock);
+	for (i = unw_stack_slot(hash); (s = stacks.table[i]); i = (i + 1) & mask) {
+		if (s->hash == hash && s->depth == depth
+		    && !memcmp(s->frames, frames, depth * sizeof *frames)) {
+			pthread_mutex_unlock(&stacks.lock);
+			free(frames);
+			return s;
+		}
+	}
 
-		_UCD_select_thread(core.ui, thread);
+	s = calloc(1, sizeof *s);
+	if (!s) {
+		pthread_mutex_unlock(&stacks.lock);
+		goto err0;
+	}
+	s->hash = hash;
+	s->frames = frames;
+	s->depth = depth;
+	stacks.table[i] = s;
+	pthread_mutex_unlock(&stacks.lock);
+
+	// Other threads only find the stack, the backtrace is read after all
+	// threads are unwound
+	info_out_init(&out, NULL);
+	if (!unw_init_remote(&c, as, ui)) {
+		unw_backtrace(&c, &out, NULL);
+	}
+	s->buf = out.buf;
+	s->len = out.len;
 
-		rtn = unw_init_remote(&c, core.as, core.ui);
-		if (rtn) {
-			log_err("Failed to initialize the unwind cursor: %s",
-					unw_strerror(rtn));
-			continue;
+	return s;
+
+err0:	free(frames);
+	return NULL;
+}
+
+/** Add a thread to its stack and reference the stack from the thread, stacks
+ *  are dumped in the order of their first threads. Called by the emitter in
+ *  the order of the core.
+ *  @param[out] out - stream the thread is dumped to */
+static void unw_stack_add(struct unw_stack_s *s, int tid, struct info_out_s *out)
+{
+	int *tids, i;
+
+	if (!s->count) {
+		// Stacks with the same hash are numbered by their first threads
+		s->id = s->hash;
+		for (i = 0; i < stacks.ordered; i++) {
+			if (stacks.order[i]->id == s->id) {
+				s->id++;
+				i = -1;
+			}
+		}
+		stacks.order[stacks.ordered++] = s;
+	}
+	info_enc->stack_ref(out, s->id);
+
+	tids = realloc(s->tids, (s->count + 1) * sizeof *tids);
+	if (tids) {
+		s->tids = tids;
+		s->tids[s->count++] = tid;
+	}
+}
+
+/** Dump stacks of threads and release them. */
+static void unw_stacks_dump(void)
+{
+	struct unw_stack_s *s;
+	int i;
+
+	info_enc->stacks_begin(run.info.output);
+	for (i = 0; i < stacks.ordered; i++) {
+		s = stacks.order[i];
+		info_enc->stack_begin(run.info.output, s->id, s->tids, s->count);
+		if (s->buf) {
+			info_out_write(run.info.output, s->buf, s->len);
+		}
+		info_enc->stack_end(run.info.output);
+	}
+	info_enc->stacks_end(run.info.output);
+
+	for (i = 0; i < 1 << stacks.bits; i++) {
+		s = stacks.table[i];
+		if (s) {
+			free(s->frames);
+			free(s->buf);
+			free(s->tids);
+			free(s);
 		}
+	}
+	free(stacks.table);
+	free(stacks.order);
+	stacks.table = stacks.order = NULL;
+	stacks.ordered = 0;
+}
+
+/** Dump registers and the backtrace of a core thread. Nothing is logged,
+ *  so the info output is the same if threads are dumped by workers.
+ * @param[in] as - address space of the unwinder
+ * @param[in] ui - core of the unwinder, the thread is selected in it
+ * @param[in] thread - index of the thread in the core
+ * @param[out] out - stream the thread is dumped to
+ * @param[in] task_dumper - called with the thread PID before the registers
+ *                          are dumped, may be NULL
+ * @param[out] pid - PID of the thread, mapped to the /proc namespace if
+ *                  task_dumper is called
+ * @param[out] stack - stack of the thread if threads are grouped
+ * @return 0 or the unwinder error if nothing was dumped */
+static int unw_thread(unw_addr_space_t as, struct UCD_info *ui, int thread,
+		struct info_out_s *out, task_dumper_t task_dumper, int *pid, struct unw_stack_s **stack)
+{
+	uint64_t signature = HASH_FNV_INIT;
+	unw_cursor_t c;
+	int rtn, i;
+
+	_UCD_select_thread(ui, thread);
 
-		task_dumper(proc_pid_map(_UCD_get_pid(core.ui)));
+	rtn = unw_init_remote(&c, as, ui);
+	if (rtn) {
+		return rtn;
+	}
 
-                t = _UCD_get_utime(core.ui);
-		fprintf(run.info.output, "    user_time: %ld.%06ld\n", t->tv_sec, t->tv_usec);
+	*pid = _UCD_get_pid(ui);
+	if (task_dumper) {
+		*pid = proc_pid_map(*pid);
+		task_dumper(*pid);
+	}
 
-		t = _UCD_get_stime(core.ui);
-		fprintf(run.info.output, "    system_time: %ld.%06ld\n", t->tv_sec, t->tv_usec);
-		
-		fputs("    registers: [", run.info.output);
+	info_enc->thread_time(out, "user_time", _UCD_get_utime(ui));
+	info_enc->thread_time(out, "system_time", _UCD_get_stime(ui));
+
+	if (!conf.backtrace_group || conf.backtrace_group_registers) {
+		info_enc->registers_begin(out);
 		for (i = 0; i < 256; i++) {
 			unw_word_t reg;
 
 			if (unw_get_reg(&c, i, &reg)) {
 				break;
 			}
+			info_enc->reg(out, i, reg);
+		}
+		info_enc->registers_end(out);
+	}
 
-			if (i != 0) fputc(',', run.info.output);
-			if (i % 4 == 0) {
-				fputs("\n     ", run.info.output);
-			}
-			fprintf(run.info.output, " 0x%016lx", (long)reg);
+	// The stack is referenced by the emitter
+	if (conf.backtrace_group) {
+		*stack = unw_stack(as, ui, thread);
+		return 0;
+	}
+
+	// The crashing thread is the first one
+	unw_backtrace(&c, out, thread == 0 ? &signature : NULL);
+	if (thread == 0) {
+		storm_crash(signature);
+	}
+
+	return 0;
+}
+
+/** Worker unwinding threads in parallel. */
+struct unw_worker_s {
+	pthread_t tid;
+	/** Private unwinder, the first worker uses the main one. */
+	unw_addr_space_t as;
+	struct UCD_info *ui;
+};
+
+/** Dump of a core thread rendered by a worker. */
+struct unw_block_s {
+	char *buf;
+	size_t len;
+	/** PID of the thread, -1 if the unwinder failed to initialize, and
+	 *  the unwinder error. */
+	int pid, error;
+	/** Stack of the thread if threads are grouped. */
+	struct unw_stack_s *stack;
+	/** The block is rendered. */
+	int done;
+};
+
+/** Threads shared by workers and the emitter. */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct unw_block_s *blocks;
+	/** Number of threads and the index of the next one to render. */
+	int count, next;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+/** Register images of all mappings with the unwinder. */
+static void unw_add_backing_files(struct UCD_info *ui)
+{
+	const struct conf_multi_mapping_s *map;
+
+	for (map = conf.proc.maps; map; map = map->next) {
+		_UCD_add_backing_file_at_vaddr(ui, map->addr, map->file);
+	}
+}
+
+/** Create a private unwinder over the core, so workers don't share a
+ *  selected thread nor the address space caches. */
+static int unw_open(struct unw_worker_s *w)
+{
+	w->as = unw_create_addr_space(&accessors, 0);
+	if (!w->as) {
+		log_err("Failed to create address space");
+		return -1;
+	}
+	unw_set_caching_policy(w->as, UNW_CACHE_GLOBAL);
+
+	w->ui = _UCD_create(core.path);
+	if (!w->ui) {
+		log_err("Failed to create UCD_info");
+		unw_destroy_addr_space(w->as);
+		return -1;
+	}
+
+	unw_add_backing_files(w->ui);
+
+	return 0;
+}
+
+/** Render threads into blocks until all are taken. */
+static void *unw_worker(void *arg)
+{
+	struct unw_worker_s *w = arg;
+	struct unw_block_s b;
+	struct info_out_s out;
+	int thread;
+
+	if (!w->ui && unw_open(w)) {
+		return NULL;
+	}
+
+	while ((thread = __atomic_fetch_add(&pool.next, 1, __ATOMIC_RELAXED)) < pool.count) {
+		b.stack = NULL;
+		b.pid = -1;
+		info_out_init(&out, NULL);
+		b.error = unw_thread(w->as, w->ui, thread, &out, NULL, &b.pid, &b.stack);
+		if (!b.error && out.error) {
+			b.error = -UNW_ENOMEM;
 		}
-		fputs(" ]\n", run.info.output);
-
-		fputs("    backtrace: [", run.info.output);
-		for (depth = 0; depth < conf.backtrace_max_depth; depth++) {
-			unw_word_t off;
-			unw_proc_info_t pi;
-			char ptr[17], fname[256];
-			const char *file;
-			int signal, exception;
-			unw_word_t ip;
-			long length;
-
-			rtn = unw_get_reg(&c, UNW_REG_IP, &ip);
-			if (!rtn) {
-				snprintf(ptr, sizeof ptr, "%016lx", (long)ip);
-			} else {
-				strncpy(ptr, "UNKNOWN", sizeof ptr);
-			}
+		b.buf = out.buf;
+		b.len = out.len;
+
+		pthread_mutex_lock(&pool.lock);
+		pool.blocks[thread] = b;
+		pool.blocks[thread].done = 1;
+		pthread_cond_broadcast(&pool.cond);
+		pthread_mutex_unlock(&pool.lock);
+	}
 
-			rtn = unw_get_proc_info(&c, &pi);
-			if (!rtn) {
-				length = pi.end_ip - pi.start_ip;
-				exception = pi.handler ? 1 : 0;
-			} else {
-				length = 0;
-				exception = -1;
-			}
+	if (w->ui != core.ui) {
+		_UCD_destroy(w->ui);
+		unw_destroy_addr_space(w->as);
+	}
+
+	return NULL;
+}
+
+/** Unwind threads by workers and emit them in the order of the core.
+ * @return 0 on success, -1 if no worker was started */
+static int unw_parallel(int workers, task_dumper_t task_dumper)
+{
+	struct unw_worker_s *w;
+	struct unw_block_s *b;
+	int i, rtn, started = 0;
+
+	w = calloc(workers, sizeof *w);
+	pool.blocks = calloc(pool.count, sizeof *pool.blocks);
+	if (!w || !pool.blocks) {
+		log_err("Can't allocate memory for unwinder workers");
+		goto err0;
+	}
 
-			rtn = unw_is_signal_frame(&c);
-			if (rtn > 0) {
-				signal = 1;
-			} else if (rtn == 0) {
-				signal = 0;
+	pool.next = 0;
+	w[0].as = core.as;
+	w[0].ui = core.ui;
+	for (i = 0; i < workers; i++) {
+		rtn = pthread_create(&w[i].tid, NULL, unw_worker, &w[i]);
+		if (rtn) {
+			log_err("Can't create unwinder worker: %s", strerror(rtn));
+			break;
+		}
+		started++;
+	}
+	if (!started) {
+		goto err0;
+	}
+	log_dbg("Unwinding %d threads by %d workers", pool.count, started);
+
+	for (i = 0; i < pool.count; i++) {
+		b = &pool.blocks[i];
+
+		pthread_mutex_lock(&pool.lock);
+		while (!b->done) {
+			pthread_cond_wait(&pool.cond, &pool.lock);
+		}
+		pthread_mutex_unlock(&pool.lock);
+
+		if (b->error && b->pid < 0) {
+			log_err("Failed to initialize the unwind cursor: %s",
+					unw_strerror(b->error));
+		} else {
+			b->pid = proc_pid_map(b->pid);
+			task_dumper(b->pid);
+			if (b->error) {
+				// The thread is listed as in the serial path, but the
+				// partially rendered dump can't be used
+				log_err("Failed to dump thread %d: %s",
+						b->pid, unw_strerror(b->error));
 			} else {
-				signal = -1;
+				info_out_write(run.info.output, b->buf, b->len);
 			}
-
-			if (depth > 0) {
-				fputc(',', run.info.output);
+			if (b->stack) {
+				unw_stack_add(b->stack, b->pid, run.info.output);
 			}
-			fprintf(run.info.output, "\n      { a: %s", ptr);
+			info_enc->thread_end(run.info.output);
+		}
+		free(b->buf);
+	}
 
-			rtn = unw_get_proc_name(&c, fname, sizeof fname, &off);
-			if (!rtn) {
-				fprintf(run.info.output, ", s: %s,%s o: %#5lx, l: %#5lx", fname,
-						spaces(20 - strlen(fname)), (long)off, length);
-			}
+	for (i = 0; i < started; i++) {
+		pthread_join(w[i].tid, NULL);
+	}
+	free(pool.blocks);
+	free(w);
+	return 0;
 
-			fprintf(run.info.output, ", e: %d, S: %d", exception, signal);
+err0:	free(pool.blocks);
+	free(w);
+	return -1;
+}
 
-			file = _UCD_get_proc_backing_file(core.ui, ip);
-			if (file) {
-				fputs(", f: ", run.info.output);
-				fputy(file, run.info.output);
-			}
-			fputs(" }", run.info.output);
+int unw_dump(task_dumper_t task_dumper)
+{
+	struct unw_stack_s *stack;
+	unw_cursor_t c;
+	int rtn, thread, workers, pid;
 
-			if (0 >= unw_step(&c)) {
-				break;
+	if (!core.ok) return -1;
+
+	if (!conf.proc.maps) {
+		log_warn("Mapping information are not available\n");
+	} else {
+		unw_add_backing_files(core.ui);
+	}
+	proc_maps_index();
+
+	if (core.capture) {
+		capture_wait(core.capture);
+	}
+
+	// Building tables of modules for a single crash is slower than lookups of
+	// the unwinder, they are used if they are cached by build-ids or if symbol
+	// tables provide names the unwinder can't
+	if (conf.cache.path || conf.symbolize_demangle || conf.debug_dir) {
+		module_init();
+	}
+	if (conf.cache.path && module_count && sizeof(unw_word_t) == 8) {
+		unwtab_slot = (~(unw_word_t)0 - UNWTAB_WINDOW) / module_count + 1;
+		unwtab_slot &= ~(unw_word_t)(sizeof(unw_word_t) - 1);
+	}
+
+	rtn = unw_init_remote(&c, core.as, core.ui);
+	if (rtn) {
+		log_err("Failed to initialize the unwind cursor: %s",
+				unw_strerror(rtn));
+		rtn = -1;
+		goto rtn0;
+	}
+
+	// Workers need their own view of the core, a pipe can be read only once
+	pool.count = _UCD_get_num_threads(core.ui);
+	workers = conf.unwind_threads > 0 ? conf.unwind_threads : sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers > pool.count) {
+		workers = pool.count;
+	}
+	if (conf.backtrace_group) {
+		// Twice as many slots as threads keep probe sequences short
+		for (stacks.bits = 4; 1 << stacks.bits < 2 * pool.count; stacks.bits++);
+		stacks.table = calloc(1 << stacks.bits, sizeof *stacks.table);
+		stacks.order = calloc(pool.count ?: 1, sizeof *stacks.order);
+		if (!stacks.table || !stacks.order) {
+			log_err("Can't allocate memory for stacks");
+			free(stacks.table);
+			free(stacks.order);
+			stacks.table = stacks.order = NULL;
+			rtn = -1;
+			goto rtn0;
+		}
+	}
+	info_enc->threads_begin(run.info.output, NULL);
+	if (!core.capture || workers <= 1 || unw_parallel(workers, task_dumper)) {
+		for (thread = 0; thread < pool.count; thread++) {
+			stack = NULL;
+			rtn = unw_thread(core.as, core.ui, thread, run.info.output,
+					task_dumper, &pid, &stack);
+			if (rtn) {
+				log_err("Failed to initialize the unwind cursor: %s",
+						unw_strerror(rtn));
+				continue;
 			}
+			if (stack) {
+				unw_stack_add(stack, pid, run.info.output);
+			}
+			info_enc->thread_end(run.info.output);
 		}
-		fputs(" ]\n", run.info.output);
+	}
+	info_enc->threads_end(run.info.output);
+	if (conf.backtrace_group) {
+		unw_stacks_dump();
 	}
 
 	rtn = 0;
 
 rtn0:	_UCD_destroy(core.ui);
 	unw_destroy_addr_space(core.as);
+	unwtab_slot = 0;
+	module_free();
 	return rtn;
 }
 
 #else // CRASHINFO_WITH_LIBUNWIND
 
-int unw_prepare(int core_fd)
+int unw_prepare(int core_fd, struct capture_s *capture)
 {
 	return -1;
 }
@@ -232,7 +800,7 @@ int unw_dump(task_dumper_t task_dumper)
 	DIR *d;
 
 	if (conf.proc.ignore) {
-		fputs("threads: ~ # Unwinder is disabled and proc_ignore = 1\n", run.info.output);
+		info_enc->threads_begin(run.info.output, "Unwinder is disabled and proc_ignore = 1");
 		return 0;
 	}
 
@@ -249,12 +817,14 @@ int unw_dump(task_dumper_t task_dumper)
 		return -1;
 	}
 
-	fputs("threads:\n", run.info.output);
+	info_enc->threads_begin(run.info.output, NULL);
 	while (NULL != (dirent = readdir(d))) {
 		if (isdigit(dirent->d_name[0])) {
 			task_dumper(atoi(dirent->d_name));
+			info_enc->thread_end(run.info.output);
 		}
 	}
+	info_enc->threads_end(run.info.output);
 	closedir(d);
 
 	return 0;
@@ -24,7 +24,9 @@
 
 typedef void (*task_dumper_t)(int tid);
 
-int unw_prepare(int core_fd);
+struct capture_s;
+
+int unw_prepare(int core_fd, struct capture_s *capture);
 
 int unw_dump(task_dumper_t task_dumper);
 
@@ -0,0 +1,381 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <elf.h>
+
+#include "unwtab.h"
+#include "log.h"
+
+/** Pointer encodings of the call frame information. */
+#define DW_EH_PE_absptr  0x00
+#define DW_EH_PE_uleb128 0x01
+#define DW_EH_PE_udata2  0x02
+#define DW_EH_PE_udata4  0x03
+#define DW_EH_PE_udata8  0x04
+#define DW_EH_PE_sleb128 0x09
+#define DW_EH_PE_sdata2  0x0a
+#define DW_EH_PE_sdata4  0x0b
+#define DW_EH_PE_sdata8  0x0c
+#define DW_EH_PE_pcrel   0x10
+#define DW_EH_PE_omit    0xff
+
+/** Section with the call frame information. */
+struct cfi_s {
+	const unsigned char *data;
+	size_t size;
+	/** Link time address of the section. */
+	uint64_t addr;
+};
+
+/** Read an unsigned LEB128 number. */
+static int read_uleb(const unsigned char **p, const unsigned char *end, uint64_t *val)
+{
+	unsigned shift = 0;
+
+	*val = 0;
+	while (*p < end) {
+		unsigned char b = *(*p)++;
+		if (shift < 64) {
+			*val |= (uint64_t)(b & 0x7f) << shift;
+		}
+		shift += 7;
+		if (!(b & 0x80)) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/** Read a signed LEB128 number. */
+static int read_sleb(const unsigned char **p, const unsigned char *end, int64_t *val)
+{
+	unsigned shift = 0;
+	unsigned char b;
+	uint64_t v = 0;
+
+	do {
+		if (*p >= end) {
+			return -1;
+		}
+		b = *(*p)++;
+		if (shift < 64) {
+			v |= (uint64_t)(b & 0x7f) << shift;
+		}
+		shift += 7;
+	} while (b & 0x80);
+
+	if (shift < 64 && (b & 0x40)) {
+		v |= ~(uint64_t)0 << shift;
+	}
+	*val = v;
+
+	return 0;
+}
+
+/** Read a fixed size number of the native byte order. */
+static int read_fixed(const unsigned char **p, const unsigned char *end,
+		size_t len, int sign, uint64_t *val)
+{
+	union { uint16_t u16; int16_t s16; uint32_t u32; int32_t s32; uint64_t u64; } u;
+
+	if (len > end - *p) {
+		return -1;
+	}
+	memcpy(&u, *p, len);
+	*p += len;
+
+	switch (len) {
+		case 2: *val = sign ? (uint64_t)u.s16 : u.u16; break;
+		case 4: *val = sign ? (uint64_t)u.s32 : u.u32; break;
+		default: *val = u.u64; break;
+	}
+
+	return 0;
+}
+
+/** Read a pointer encoded by DW_EH_PE_* constants.
+ *  @param[in] cfi - section the pointer is read from
+ *  @param[in,out] p - position of the pointer, moved after it
+ *  @param[in] end - end of the entry
+ *  @param[in] enc - encoding of the pointer
+ *  @param[out] val - the pointer
+ *  @return 0 on success, 1 if the pointer is relative to an unknown base,
+ *          -1 if the encoding is invalid or the entry is truncated */
+static int read_encoded(const struct cfi_s *cfi, const unsigned char **p,
+		const unsigned char *end, uint8_t enc, uint64_t *val)
+{
+	uint64_t addr = cfi->addr + (*p - cfi->data);
+	int64_t sval;
+	int rtn;
+
+	switch (enc & 0x0f) {
+		case DW_EH_PE_absptr:
+			rtn = read_fixed(p, end, sizeof(void *), 0, val);
+			break;
+		case DW_EH_PE_uleb128:
+			rtn = read_uleb(p, end, val);
+			break;
+		case DW_EH_PE_sleb128:
+			rtn = read_sleb(p, end, &sval);
+			*val = sval;
+			break;
+		case DW_EH_PE_udata2:
+		case DW_EH_PE_sdata2:
+			rtn = read_fixed(p, end, 2, enc & 0x08, val);
+			break;
+		case DW_EH_PE_udata4:
+		case DW_EH_PE_sdata4:
+			rtn = read_fixed(p, end, 4, enc & 0x08, val);
+			break;
+		case DW_EH_PE_udata8:
+		case DW_EH_PE_sdata8:
+			rtn = read_fixed(p, end, 8, 0, val);
+			break;
+		default:
+			return -1;
+	}
+	if (rtn) {
+		return -1;
+	}
+
+	switch (enc & 0x70) {
+		case 0:
+			return 0;
+		case DW_EH_PE_pcrel:
+			*val += addr;
+			return 0;
+		default:
+			return 1;
+	}
+}
+
+/** Read the length and the ID of a CIE or an FDE.
+ *  @param[in,out] p - start of the entry, moved after the ID
+ *  @param[out] end - end of the entry
+ *  @param[out] id - the CIE ID or the CIE pointer
+ *  @return Offset of the ID in the section, 0 on the terminator or -1 if
+ *          the entry is truncated */
+static int64_t read_entry(const struct cfi_s *cfi, const unsigned char **p,
+		const unsigned char **end, uint64_t *id)
+{
+	const unsigned char *secend = cfi->data + cfi->size;
+	uint64_t len;
+	int64_t off;
+	int idlen = 4;
+
+	if (read_fixed(p, secend, 4, 0, &len)) {
+		return -1;
+	} else if (!len) {
+		return 0;
+	} else if (len == 0xffffffff) {
+		if (read_fixed(p, secend, 8, 0, &len)) {
+			return -1;
+		}
+		idlen = 8;
+	}
+
+	if (len > secend - *p) {
+		return -1;
+	}
+	*end = *p + len;
+	off = *p - cfi->data;
+
+	return read_fixed(p, *end, idlen, 0, id) ? -1 : off;
+}
+
+/** Get the FDE pointer encoding from the augmentation of a CIE.
+ *  @return 0 on success, -1 if the CIE is malformed */
+static int cie_encoding(const struct cfi_s *cfi, uint64_t off, uint8_t *enc)
+{
+	const unsigned char *p = cfi->data + off, *end;
+	const char *aug, *a;
+	uint64_t id, val;
+	int64_t sval;
+	int version;
+
+	if (off >= cfi->size || read_entry(cfi, &p, &end, &id) <= 0 || id || p >= end) {
+		return -1;
+	}
+
+	version = *p++;
+	aug = (const char *)p;
+	p = memchr(p, 0, end - p);
+	if (!p++) {
+		return -1;
+	}
+	if (strstr(aug, "eh")) {
+		p += sizeof(void *);
+	}
+	if (version == 4) {
+		// Address size and segment selector size
+		p += 2;
+	}
+	if (read_uleb(&p, end, &val) || read_sleb(&p, end, &sval)) {
+		return -1;
+	}
+	if (version == 1) {
+		p++;
+	} else if (read_uleb(&p, end, &val)) {
+		return -1;
+	}
+
+	*enc = DW_EH_PE_absptr;
+	if (aug[0] != 'z' || read_uleb(&p, end, &val)) {
+		return aug[0] == 'z' ? -1 : 0;
+	}
+
+	for (a = aug + 1; *a; a++) {
+		if (p >= end) {
+			return -1;
+		}
+		switch (*a) {
+			case 'R':
+				*enc = *p;
+				return 0;
+			case 'L':
+				p++;
+				break;
+			case 'P':
+				p++;
+				if (read_encoded(cfi, &p, end, p[-1] & 0x7f, &val) < 0) {
+					return -1;
+				}
+				break;
+			case 'S':
+			case 'B':
+				break;
+			default:
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Order table entries by the function address. */
+static int entry_cmp(const void *a, const void *b)
+{
+	const struct unwtab_entry_s *ea = a, *eb = b;
+
+	return ea->start < eb->start ? -1 : ea->start > eb->start;
+}
+
+/** Check the data contain a valid unwind table.
+ *  @return Non-zero if they do */
+int unwtab_check(const void *data, size_t size)
+{
+	const struct unwtab_s *t = data;
+
+	return data && size >= sizeof *t && t->magic == UNWTAB_MAGIC
+		&& t->count == (size - sizeof *t) / sizeof t->entries[0];
+}
+
+/** Build the unwind table of the module from the .eh_frame section.
+ *  @param[in] m - the module
+ *  @param[out] size - size of the table
+ *  @return Allocated table or NULL if it can't be built */
+void *unwtab_build(const struct module_s *m, size_t *size)
+{
+	const struct elf_image_s *img = &m->image;
+	uint64_t cie = UINT64_MAX, id, start, range;
+	const unsigned char *p, *end;
+	struct elf_shdr_s shdr;
+	struct unwtab_s *t, *tmp;
+	size_t off, alloc = 256;
+	struct cfi_s cfi;
+	uint8_t enc = 0;
+	int64_t idpos;
+
+	if (elf_image_section(img, ".eh_frame", &shdr) < 0 || shdr.type == SHT_NOBITS) {
+		return NULL;
+	}
+	cfi.data = (const unsigned char *)img->map + shdr.offset;
+	cfi.size = shdr.size;
+	cfi.addr = shdr.addr;
+
+	t = malloc(sizeof *t + alloc * sizeof t->entries[0]);
+	if (!t) {
+		log_err("Can't allocate memory for the unwind table");
+		return NULL;
+	}
+	t->magic = UNWTAB_MAGIC;
+	t->count = 0;
+
+	for (off = 0; off < cfi.size; off = end - cfi.data) {
+		p = cfi.data + off;
+		idpos = read_entry(&cfi, &p, &end, &id);
+		if (!idpos) {
+			break;
+		} else if (idpos < 0) {
+			goto err0;
+		} else if (!id) {
+			continue;
+		}
+
+		// The CIE pointer is relative to its own position
+		if (id > (uint64_t)idpos) {
+			goto err0;
+		}
+		if (cie != idpos - id) {
+			cie = idpos - id;
+			if (cie_encoding(&cfi, cie, &enc)) {
+				goto err0;
+			}
+		}
+
+		if (read_encoded(&cfi, &p, end, enc, &start)
+		    || read_encoded(&cfi, &p, end, enc & 0x0f, &range) < 0) {
+			goto err0;
+		}
+		if (!range) {
+			continue;
+		}
+
+		if (start > INT32_MAX || cfi.addr + off > INT32_MAX) {
+			log_dbg("FDE addresses don't fit to the unwind table");
+			goto err0;
+		}
+
+		if (t->count == alloc) {
+			alloc *= 2;
+			tmp = realloc(t, sizeof *t + alloc * sizeof t->entries[0]);
+			if (!tmp) {
+				log_err("Can't allocate memory for the unwind table");
+				goto err0;
+			}
+			t = tmp;
+		}
+		t->entries[t->count].start = start;
+		t->entries[t->count].fde = cfi.addr + off;
+		t->count++;
+	}
+
+	qsort(t->entries, t->count, sizeof t->entries[0], entry_cmp);
+	*size = sizeof *t + t->count * sizeof t->entries[0];
+	return t;
+
+err0:	free(t);
+	return NULL;
+}
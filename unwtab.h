@@ -0,0 +1,51 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#ifndef UNWTAB_H
+#define UNWTAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "module.h"
+
+/** Magic number of the unwind table, "UWT1". */
+#define UNWTAB_MAGIC 0x31545755
+
+/** Sorted lookup table of FDEs in .eh_frame, in the format of the binary
+ *  search table in .eh_frame_hdr with link time addresses. */
+struct unwtab_s {
+	/** UNWTAB_MAGIC */
+	uint32_t magic;
+	/** Number of entries. */
+	uint32_t count;
+	/** Start address of a function and address of its FDE. */
+	struct unwtab_entry_s {
+		int32_t start;
+		int32_t fde;
+	} entries[];
+};
+
+int unwtab_check(const void *data, size_t size);
+
+void *unwtab_build(const struct module_s *m, size_t *size);
+
+#endif // UNWTAB_H
@@ -22,6 +22,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <ctype.h>
@@ -41,6 +42,22 @@ int strlen_chomp(const char *value) {
 	return i;
 }
 
+/** Add data to a FNV-1a hash.
+ *  @param[in] hash - the hash of previous data or HASH_FNV_INIT
+ *  @param[in] data - the data
+ *  @param[in] len - length of the data
+ *  @return The new hash */
+uint64_t hash_fnv(uint64_t hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--) {
+		hash = (hash ^ *p++) * 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
 /** Open /dev/null
  *  @return Opened file descriptor or -1 on error */
 int open_devnull(void)
@@ -53,3 +70,36 @@ int open_devnull(void)
 
 	return dup(fd);
 }
+
+/** Read the whole file.
+ *  @param[out] len - number of bytes read, a zero is added after them
+ *  @return The content or NULL on error, errno is set */
+char *read_all(int fd, size_t *len)
+{
+	size_t size = 4096;
+	char *buf = NULL, *tmp;
+	ssize_t rtn;
+
+	*len = 0;
+	do {
+		if (size - *len < 2) {
+			size *= 2;
+		}
+		tmp = realloc(buf, size);
+		if (!tmp) {
+			free(buf);
+			errno = ENOMEM;
+			return NULL;
+		}
+		buf = tmp;
+		rtn = safe_read(fd, buf + *len, size - *len - 1);
+		if (rtn < 0) {
+			free(buf);
+			return NULL;
+		}
+		*len += rtn;
+	} while (rtn > 0);
+
+	buf[*len] = 0;
+	return buf;
+}
@@ -22,8 +22,60 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+
+/** Initial value of FNV-1a hashes. */
+#define HASH_FNV_INIT 0xcbf29ce484222325ULL
+
 int strlen_chomp(const char *value);
 
+uint64_t hash_fnv(uint64_t hash, const void *data, size_t len);
+
 int open_devnull(void);
 
+char *read_all(int fd, size_t *len);
+
+static inline ssize_t safe_read(int fd, void *buf, size_t count)
+{
+	ssize_t size = 0, rtn;
+
+repeat: rtn = read(fd, (char*)buf + size, count - size);
+	if (rtn > 0) {
+		size += rtn;
+		if (size < count) {
+			goto repeat;
+		}
+	} else if (rtn < 0) {
+		if (errno == EINTR) {
+			goto repeat;
+		} else if (size == 0) {
+			return rtn;
+		}
+	}
+	return size;
+}
+
+static inline ssize_t safe_write(int fd, const void *buf, size_t count)
+{
+	ssize_t size = 0, rtn;
+
+repeat: rtn = write(fd, (const char*)buf + size, count - size);
+	if (rtn > 0) {
+		size += rtn;
+		if (size < count) {
+			goto repeat;
+		}
+	} else if (rtn < 0) {
+		if (errno == EINTR) {
+			goto repeat;
+		} else if (size == 0) {
+			return rtn;
+		}
+	}
+	return size;
+}
+
 #endif // UTIL_H
@@ -0,0 +1,390 @@
+/**
+ * This is part of the crashinfo utility
+ *
+ * Copyright (C) 2017 Petr Malat
+ *
+ * Contact: Petr Malat <oss@malat.biz>
+ *
+ * This utility is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3 as published by the Free Software Foundation.
+ *
+ * This utility is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include "info.h"
+
+const char SP[24] = "                       ";
+
+/** Write an empty section, the comment is added if it isn't empty. */
+static void yaml_none(struct info_out_s *out, const char *key, const char *none)
+{
+	info_out_puts(out, key);
+	if (none[0]) {
+		info_out_puts(out, ": ~ # ");
+		info_out_puts(out, none);
+		info_out_putc(out, '\n');
+	} else {
+		info_out_puts(out, ": ~\n");
+	}
+}
+
+static void yaml_nop(struct info_out_s *out)
+{
+}
+
+static void yaml_begin(struct info_out_s *out, const char *datetime)
+{
+	// datetime: 2001-12-15T02:59:43Z
+	info_out_puts(out, "---\ndatetime: ");
+	info_out_puts(out, datetime);
+	info_out_putc(out, '\n');
+}
+
+static void yaml_exe(struct info_out_s *out, const char *exe)
+{
+	// exe: "/usr/bin/vi"
+	info_out_puts(out, "exe: ");
+	if (exe) {
+		info_out_yaml(out, exe);
+	} else {
+		info_out_putc(out, '~');
+	}
+	info_out_putc(out, '\n');
+}
+
+static void yaml_cmdline_begin(struct info_out_s *out)
+{
+	// cmdline: [ "vi", "/etc/passwd" ]
+	info_out_puts(out, "cmdline: [ ");
+}
+
+static void yaml_cmdline_arg(struct info_out_s *out, int index, const char *arg)
+{
+	if (index > 0) {
+		info_out_puts(out, ", ");
+	}
+	info_out_yaml(out, arg);
+}
+
+static void yaml_cmdline_end(struct info_out_s *out)
+{
+	info_out_puts(out, " ]\n");
+}
+
+static void yaml_mappings_begin(struct info_out_s *out, int known)
+{
+	if (known) {
+		info_out_puts(out, "executable_mappings:\n");
+	} else {
+		yaml_none(out, "executable_mappings", "");
+	}
+}
+
+static void yaml_mapping(struct info_out_s *out, uint64_t addr, const char *file, const char *build_id)
+{
+	info_out_puts(out, "  0x");
+	info_out_hex16(out, addr);
+	info_out_puts(out, ": ");
+	if (build_id) {
+		// Modules are referenced by their index in backtraces
+		info_out_puts(out, "{ f: ");
+		info_out_yaml(out, file);
+		info_out_puts(out, ", b: ");
+		info_out_puts(out, build_id[0] ? build_id : "~");
+		info_out_puts(out, " }\n");
+	} else {
+		info_out_yaml(out, file);
+		info_out_putc(out, '\n');
+	}
+}
+
+static void yaml_proc_dump_begin(struct info_out_s *out, int indent, const char *none)
+{
+	info_out_puts(out, spaces(indent));
+	if (none) {
+		yaml_none(out, "proc_dump", none);
+	} else {
+		info_out_puts(out, "proc_dump:\n");
+	}
+}
+
+static void yaml_proc_file(struct info_out_s *out, int indent, const char *name,
+		const char *data, size_t len, int err)
+{
+	const char *end = data + len, *eol;
+	size_t line;
+
+	info_out_puts(out, spaces(indent + 2));
+	info_out_yaml(out, name);
+
+	if (!data) {
+		if (err) {
+			info_out_puts(out, ": ~ # Can't open: ");
+			info_out_puts(out, strerror(err));
+			info_out_putc(out, '\n');
+		} else {
+			info_out_puts(out, ": ~\n");
+		}
+		return;
+	}
+
+	// Lines are split to 4 KiB pieces, trailing white spaces are removed
+	// and the content is cut at zero bytes
+	info_out_puts(out, ": |\n");
+	for (; data < end; data += line) {
+		line = end - data < 4095 ? end - data : 4095;
+		eol = memchr(data, '\n', line);
+		if (eol) {
+			line = eol - data + 1;
+		}
+
+		eol = memchr(data, '\0', line) ?: data + line;
+		while (eol > data && isspace((unsigned char)eol[-1])) {
+			eol--;
+		}
+
+		info_out_puts(out, spaces(indent + 4));
+		info_out_write(out, data, eol - data);
+		info_out_putc(out, '\n');
+	}
+}
+
+static void yaml_threads_begin(struct info_out_s *out, const char *none)
+{
+	if (none) {
+		yaml_none(out, "threads", none);
+	} else {
+		info_out_puts(out, "threads:\n");
+	}
+}
+
+static void yaml_thread_begin(struct info_out_s *out, int tid)
+{
+	info_out_puts(out, "  - tid: ");
+	info_out_int(out, tid);
+	info_out_puts(out, " # -------------------------"
+			"-------------------------\n");
+}
+
+static void yaml_thread_time(struct info_out_s *out, const char *key, const struct timeval *tv)
+{
+	info_out_puts(out, "    ");
+	info_out_puts(out, key);
+	info_out_puts(out, ": ");
+	info_out_usec(out, tv->tv_sec, tv->tv_usec);
+	info_out_putc(out, '\n');
+}
+
+static void yaml_registers_begin(struct info_out_s *out)
+{
+	info_out_puts(out, "    registers: [");
+}
+
+static void yaml_reg(struct info_out_s *out, int index, uint64_t value)
+{
+	if (index != 0) {
+		info_out_putc(out, ',');
+	}
+	if (index % 4 == 0) {
+		info_out_puts(out, "\n     ");
+	}
+	info_out_puts(out, " 0x");
+	info_out_hex16(out, value);
+}
+
+static void yaml_list_end(struct info_out_s *out)
+{
+	info_out_puts(out, " ]\n");
+}
+
+static void yaml_stack_ref(struct info_out_s *out, uint64_t id)
+{
+	info_out_puts(out, "    stack: 0x");
+	info_out_hex16(out, id);
+	info_out_putc(out, '\n');
+}
+
+static void yaml_backtrace_begin(struct info_out_s *out)
+{
+	info_out_puts(out, "    backtrace: [");
+}
+
+static void yaml_frame(struct info_out_s *out, int depth, const struct info_frame_s *f)
+{
+	if (depth > 0) {
+		info_out_putc(out, ',');
+	}
+	if (f->ip_known) {
+		info_out_puts(out, "\n      { a: ");
+		info_out_hex16(out, f->ip);
+	} else {
+		info_out_puts(out, "\n      { a: UNKNOWN");
+	}
+
+	if (f->deferred) {
+		// Names are filled in by crashinfo --symbolize
+		if (f->module >= 0) {
+			info_out_puts(out, ", m: ");
+			info_out_int(out, f->module);
+		}
+		info_out_puts(out, ", S: ");
+		info_out_int(out, f->signal);
+		info_out_puts(out, " }");
+		return;
+	}
+
+	if (f->name) {
+		info_out_puts(out, ", s: ");
+		if (f->quote) {
+			info_out_yaml(out, f->name);
+			info_out_putc(out, ',');
+			info_out_puts(out, spaces(20 - strlen(f->name) - 2));
+		} else {
+			info_out_puts(out, f->name);
+			info_out_putc(out, ',');
+			info_out_puts(out, spaces(20 - strlen(f->name)));
+		}
+		info_out_puts(out, " o: ");
+		info_out_hex_alt(out, f->off, 5);
+		info_out_puts(out, ", l: ");
+		info_out_hex_alt(out, f->len, 5);
+	}
+
+	info_out_puts(out, ", e: ");
+	info_out_int(out, f->exception);
+	info_out_puts(out, ", S: ");
+	info_out_int(out, f->signal);
+
+	if (f->file) {
+		info_out_puts(out, ", f: ");
+		info_out_yaml(out, f->file);
+	}
+	info_out_puts(out, " }");
+}
+
+static void yaml_stacks_begin(struct info_out_s *out)
+{
+	info_out_puts(out, "stacks:\n");
+}
+
+static void yaml_stack_begin(struct info_out_s *out, uint64_t id, const int *tids, int count)
+{
+	int i;
+
+	info_out_puts(out, "  - id: 0x");
+	info_out_hex16(out, id);
+	info_out_puts(out, "\n    tids: [");
+	for (i = 0; i < count; i++) {
+		info_out_puts(out, i ? ", " : " ");
+		info_out_int(out, tids[i]);
+	}
+	info_out_puts(out, " ]\n");
+}
+
+static void yaml_counter(struct info_out_s *out, const char *key, unsigned long long value)
+{
+	info_out_puts(out, key);
+	info_out_puts(out, ": ");
+	info_out_uint(out, value);
+	info_out_putc(out, '\n');
+}
+
+static void yaml_signature(struct info_out_s *out, const char *key, unsigned long long value)
+{
+	info_out_puts(out, key);
+	info_out_puts(out, ": 0x");
+	info_out_hex16(out, value);
+	info_out_putc(out, '\n');
+}
+
+static void yaml_pair(struct info_out_s *out, const char *key, const char *key1,
+		unsigned long long value1, const char *key2, unsigned long long value2)
+{
+	info_out_puts(out, key);
+	info_out_puts(out, ": { ");
+	info_out_puts(out, key1);
+	info_out_puts(out, ": ");
+	info_out_uint(out, value1);
+	info_out_puts(out, ", ");
+	info_out_puts(out, key2);
+	info_out_puts(out, ": ");
+	info_out_uint(out, value2);
+	info_out_puts(out, " }\n");
+}
+
+static void yaml_end(struct info_out_s *out, const struct timeval *processing_time)
+{
+	// processing_time: 12.123456
+	info_out_puts(out, "processing_time: ");
+	info_out_usec(out, processing_time->tv_sec, processing_time->tv_usec);
+	info_out_putc(out, '\n');
+}
+
+static void yaml_log(struct info_out_s *out, const char *prefix, const char *format, va_list ap)
+{
+	char *msg, *line;
+	int len;
+
+	if (vasprintf(&msg, format, ap) < 0) {
+		return;
+	}
+
+	// Messages of other threads must not break the line being written
+	len = asprintf(&line, "# %s%s\n", prefix, msg);
+	if (len >= 0) {
+		info_out_comment(out, line, len);
+		free(line);
+	}
+	free(msg);
+}
+
+/** YAML encoder, messages are written as comments where they are logged. */
+const struct info_enc_s info_yaml = {
+	.begin = yaml_begin,
+	.exe = yaml_exe,
+	.cmdline_begin = yaml_cmdline_begin,
+	.cmdline_arg = yaml_cmdline_arg,
+	.cmdline_end = yaml_cmdline_end,
+	.mappings_begin = yaml_mappings_begin,
+	.mapping = yaml_mapping,
+	.mappings_end = yaml_nop,
+	.proc_dump_begin = yaml_proc_dump_begin,
+	.proc_file = yaml_proc_file,
+	.proc_dump_end = yaml_nop,
+	.threads_begin = yaml_threads_begin,
+	.thread_begin = yaml_thread_begin,
+	.thread_time = yaml_thread_time,
+	.registers_begin = yaml_registers_begin,
+	.reg = yaml_reg,
+	.registers_end = yaml_list_end,
+	.stack_ref = yaml_stack_ref,
+	.backtrace_begin = yaml_backtrace_begin,
+	.frame = yaml_frame,
+	.backtrace_end = yaml_list_end,
+	.thread_end = yaml_nop,
+	.threads_end = yaml_nop,
+	.stacks_begin = yaml_stacks_begin,
+	.stack_begin = yaml_stack_begin,
+	.stack_end = yaml_nop,
+	.stacks_end = yaml_nop,
+	.counter = yaml_counter,
+	.signature = yaml_signature,
+	.pair = yaml_pair,
+	.end = yaml_end,
+	.log = yaml_log,
+};